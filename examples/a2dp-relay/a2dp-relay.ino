@@ -0,0 +1,25 @@
+#include "AudioTools.h"
+#include "BTstack_A2DP.h"
+
+// the decoded audio from the phone is buffered and sent to the speaker
+RingBuffer<uint8_t> buffer(1024 * 8);
+QueueStream<uint8_t> queue(buffer);
+
+void setup() {
+  Serial.begin(115200);
+  waitFor(Serial);
+  AudioLogger::instance().begin(Serial, AudioLogger::Info);
+
+  queue.begin();
+
+  // receive from the phone: the SBC frames are forwarded to the speaker
+  // without transcoding if both use the same configuration
+  A2DPSink.setOutput(queue);
+  A2DPSink.setFrameOutput(A2DPSource);
+  A2DPSink.begin("rp2040-relay");
+
+  // and send to the speaker
+  A2DPSource.begin(queue);
+}
+
+void loop() {}
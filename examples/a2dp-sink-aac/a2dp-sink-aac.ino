@@ -0,0 +1,42 @@
+#include "AudioTools.h"
+#include "BTstack_A2DP.h"
+#include "A2DPDecoderAAC.h"
+
+// Receives AAC (e.g. from an iPhone) or SBC: AAC is preferred. This needs
+// the arduino-libhelix library. The decoding time per frame and the free
+// heap are printed, so that AAC can be compared with SBC (remove the
+// addDecoder() call to measure SBC).
+
+I2SStream out;
+A2DPDecoderAAC aac;
+
+int freeHeap() {
+#if defined(ARDUINO_ARCH_RP2040)
+  return rp2040.getFreeHeap();
+#else
+  return 0;
+#endif
+}
+
+void setup() {
+  Serial.begin(115200);
+  while(!Serial);
+  AudioLogger::instance().begin(Serial, AudioLogger::Info);
+
+  A2DPSink.addDecoder(aac, 1);
+  A2DPSink.setOutput(out);
+  A2DPSink.setVolume(50);
+  A2DPSink.begin("rp2040");
+}
+
+void loop() {
+  static uint32_t timeout = 0;
+  if (millis() > timeout) {
+    A2DPSinkTiming timing = A2DPSink.timing();
+    Serial.printf("receive: %u us/frame, decode: %u us/frame (max %u), heap: %d\n",
+                  (unsigned)timing.receive_us_per_frame,
+                  (unsigned)timing.decode_us_per_frame,
+                  (unsigned)timing.decode_max_us, freeHeap());
+    timeout = millis() + 10000;
+  }
+}
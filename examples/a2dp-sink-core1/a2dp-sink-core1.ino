@@ -0,0 +1,33 @@
+#include "AudioTools.h"
+#include "BTstack_A2DP.h"
+
+// The SBC decoding and the I2S output is done on the second core, so that
+// the Bluetooth processing is not blocked by the audio output
+
+I2SStream out;
+
+void setup() {
+  Serial.begin(115200);
+  while(!Serial);
+  AudioLogger::instance().begin(Serial, AudioLogger::Info);
+
+  A2DPSink.setOutput(out);
+  A2DPSink.setVolume(50);
+  A2DPSink.setDecodeInWorker(true);
+  A2DPSink.begin("rp2040");
+}
+
+void loop() {
+  static uint32_t timeout = 0;
+  if (millis() > timeout) {
+    A2DPSinkTiming timing = A2DPSink.timing();
+    Serial.printf("receive: %u us/frame, decode: %u us/frame\n",
+                  (unsigned)timing.receive_us_per_frame,
+                  (unsigned)timing.decode_us_per_frame);
+    timeout = millis() + 10000;
+  }
+}
+
+void setup1() {}
+
+void loop1() { A2DPSink.copy(); }
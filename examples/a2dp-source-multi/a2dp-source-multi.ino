@@ -0,0 +1,25 @@
+#include "AudioTools.h"
+#include "BTstack_A2DP.h"
+
+SineWaveGenerator<int16_t> sineWave(32000);
+GeneratedSoundStream<int16_t> in(sineWave);
+
+void setup() {
+  Serial.begin(115200);
+  waitFor(Serial);
+  AudioLogger::instance().begin(Serial, AudioLogger::Info);
+
+  // the sine wave is encoded once and sent to 2 speakers
+  A2DPSource.setSinkCount(2);
+  A2DPSource.setVolume(50);
+  A2DPSource.begin(in);
+}
+
+void loop() {
+  static uint32_t timeout = 0;
+  if (millis() > timeout) {
+    Serial.print("active speakers: ");
+    Serial.println(A2DPSource.activeSinks());
+    timeout = millis() + 5000;
+  }
+}
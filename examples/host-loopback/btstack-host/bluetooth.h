@@ -0,0 +1,8 @@
+/**
+ * @file bluetooth.h
+ * @author Phil Schatzmann
+ * @brief Host stand-in for the BTstack header: everything is defined in
+ * btstack.h
+ * @copyright Copyright (c) 2023
+ */
+#pragma once
@@ -0,0 +1,1547 @@
+/**
+ * @file btstack.h
+ * @author Phil Schatzmann
+ * @brief Host stand-in for the part of the BTstack API which is used by the
+ * A2DP sink and source: instead of a Bluetooth controller the HostLink
+ * connects the A2DPSource to the A2DPSink of the same program, as if the
+ * speaker was a second device. The link adds delay, jitter and packet loss
+ * to the media packets and the run loop clock (which paces the source)
+ * deviates from millis() (which paces the sink output) by the configured
+ * drift. All clocks are simulated: they only advance with delay(), so a run
+ * takes much less than the simulated time and does not depend on the load
+ * of the host.
+ *
+ * Only SBC streams and a single speaker are supported. The events use their
+ * own (consistent) layout: they are only read with the getters below, which
+ * are not verified against the packet layout of BTstack. The AVDTP pools are
+ * limited like the static pools of BTstack without malloc.
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "Arduino.h"
+#include "btstack_config.h"
+
+// -- types
+
+typedef uint8_t bd_addr_t[6];
+typedef uint8_t link_key_t[16];
+typedef int link_key_type_t;
+
+typedef void (*btstack_packet_handler_t)(uint8_t packet_type,
+                                         uint16_t channel, uint8_t *packet,
+                                         uint16_t size);
+typedef void (*a2dp_media_handler_t)(uint8_t local_seid, uint8_t *packet,
+                                     uint16_t size);
+
+struct btstack_packet_callback_registration_t {
+  btstack_packet_handler_t callback = nullptr;
+};
+
+struct btstack_timer_source_t {
+  uint32_t timeout = 0;
+  void (*process)(btstack_timer_source_t *ts) = nullptr;
+  void *context = nullptr;
+};
+
+struct btstack_tlv_t {
+  int (*get_tag)(void *context, uint32_t tag, uint8_t *buffer,
+                 uint32_t buffer_size);
+  int (*store_tag)(void *context, uint32_t tag, const uint8_t *data,
+                   uint32_t data_size);
+  void (*delete_tag)(void *context, uint32_t tag);
+};
+
+struct avdtp_media_packet_header_t {
+  uint8_t version;
+  uint8_t padding;
+  uint8_t extension;
+  uint8_t csrc_count;
+  uint8_t marker;
+  uint8_t payload_type;
+  uint16_t sequence_number;
+  uint32_t timestamp;
+  uint32_t synchronization_source;
+  uint32_t csrc_list[15];
+};
+
+struct avrcp_track_t {
+  uint8_t track_id[8];
+  uint32_t track_nr;
+  char *title;
+  char *artist;
+  char *album;
+  char *genre;
+  uint32_t song_length_ms;
+  uint32_t song_position_ms;
+};
+
+/// Local stream endpoint
+struct avdtp_stream_endpoint_t {
+  uint8_t seid = 0;
+  bool is_sink = false;
+  bool is_used = false;
+  bool is_delay_reporting = false;
+  uint8_t codec_type = 0;
+  const uint8_t *capabilities = nullptr;
+  uint16_t capabilities_len = 0;
+  uint32_t preferred_sampling_frequency = 0;
+  uint8_t preferred_channel_mode = 0;
+};
+
+typedef enum { AVDTP_AUDIO = 0 } avdtp_media_type_t;
+
+typedef enum {
+  AVDTP_CODEC_SBC = 0x00,
+  AVDTP_CODEC_MPEG_1_2_AUDIO = 0x01,
+  AVDTP_CODEC_MPEG_2_4_AAC = 0x02,
+  AVDTP_CODEC_ATRAC_FAMILY = 0x04,
+  AVDTP_CODEC_NON_A2DP = 0xFF
+} avdtp_media_codec_type_t;
+
+typedef enum {
+  AVDTP_CHANNEL_MODE_JOINT_STEREO = 1,
+  AVDTP_CHANNEL_MODE_STEREO = 2,
+  AVDTP_CHANNEL_MODE_DUAL_CHANNEL = 4,
+  AVDTP_CHANNEL_MODE_MONO = 8
+} avdtp_channel_mode_t;
+
+typedef enum {
+  SBC_CHANNEL_MODE_MONO = 0,
+  SBC_CHANNEL_MODE_DUAL_CHANNEL,
+  SBC_CHANNEL_MODE_STEREO,
+  SBC_CHANNEL_MODE_JOINT_STEREO
+} btstack_sbc_channel_mode_t;
+
+typedef enum { SBC_LOUDNESS = 0, SBC_SNR } btstack_sbc_allocation_method_t;
+
+typedef enum {
+  AVRCP_BATTERY_STATUS_NORMAL = 0,
+  AVRCP_BATTERY_STATUS_WARNING,
+  AVRCP_BATTERY_STATUS_CRITICAL,
+  AVRCP_BATTERY_STATUS_EXTERNAL,
+  AVRCP_BATTERY_STATUS_FULL_CHARGE
+} avrcp_battery_status_t;
+
+typedef enum {
+  AVRCP_OPERATION_ID_VOLUME_UP = 0x41,
+  AVRCP_OPERATION_ID_VOLUME_DOWN = 0x42,
+  AVRCP_OPERATION_ID_PLAY = 0x44,
+  AVRCP_OPERATION_ID_STOP = 0x45,
+  AVRCP_OPERATION_ID_PAUSE = 0x46,
+  AVRCP_OPERATION_ID_REWIND = 0x48,
+  AVRCP_OPERATION_ID_FAST_FORWARD = 0x49,
+  AVRCP_OPERATION_ID_FORWARD = 0x4B,
+  AVRCP_OPERATION_ID_BACKWARD = 0x4C
+} avrcp_operation_id_t;
+
+typedef enum {
+  AVRCP_PLAYBACK_STATUS_STOPPED = 0,
+  AVRCP_PLAYBACK_STATUS_PLAYING,
+  AVRCP_PLAYBACK_STATUS_PAUSED
+} avrcp_playback_status_t;
+
+typedef enum {
+  AVRCP_NOTIFICATION_EVENT_PLAYBACK_STATUS_CHANGED = 0x01,
+  AVRCP_NOTIFICATION_EVENT_TRACK_CHANGED = 0x02,
+  AVRCP_NOTIFICATION_EVENT_BATT_STATUS_CHANGED = 0x06,
+  AVRCP_NOTIFICATION_EVENT_NOW_PLAYING_CONTENT_CHANGED = 0x09,
+  AVRCP_NOTIFICATION_EVENT_VOLUME_CHANGED = 0x0D
+} avrcp_notification_event_id_t;
+
+typedef enum { HCI_POWER_OFF = 0, HCI_POWER_ON } HCI_POWER_MODE;
+
+typedef enum { HCI_STATE_OFF = 0, HCI_STATE_WORKING = 2 } HCI_STATE;
+
+// -- constants
+
+#define HCI_EVENT_PACKET 0x04
+#define HCI_EVENT_PIN_CODE_REQUEST 0x16
+#define BTSTACK_EVENT_STATE 0x60
+#define GAP_EVENT_INQUIRY_RESULT 0xD8
+#define GAP_EVENT_INQUIRY_COMPLETE 0xD9
+#define HCI_EVENT_A2DP_META 0xF0
+#define HCI_EVENT_AVRCP_META 0xF1
+
+#define ERROR_CODE_SUCCESS 0x00
+#define ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER 0x02
+#define ERROR_CODE_PAGE_TIMEOUT 0x04
+#define ERROR_CODE_COMMAND_DISALLOWED 0x0C
+#define BTSTACK_MEMORY_ALLOC_FAILED 0x56
+
+#define A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW 0x01
+#define A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION 0x02
+#define A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_MPEG_AAC_CONFIGURATION 0x03
+#define A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_OTHER_CONFIGURATION 0x04
+#define A2DP_SUBEVENT_STREAM_ESTABLISHED 0x05
+#define A2DP_SUBEVENT_START_STREAM_REQUESTED 0x06
+#define A2DP_SUBEVENT_STREAM_STARTED 0x07
+#define A2DP_SUBEVENT_STREAM_SUSPENDED 0x08
+#define A2DP_SUBEVENT_STREAM_RECONFIGURED 0x09
+#define A2DP_SUBEVENT_STREAM_RELEASED 0x0A
+#define A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED 0x0B
+#define A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED 0x0C
+#define A2DP_SUBEVENT_SIGNALING_DELAY_REPORTING_CAPABILITY 0x0D
+#define A2DP_SUBEVENT_SIGNALING_DELAY_REPORT 0x0E
+#define A2DP_SUBEVENT_SIGNALING_CAPABILITIES_DONE 0x0F
+
+#define AVRCP_SUBEVENT_CONNECTION_ESTABLISHED 0x01
+#define AVRCP_SUBEVENT_CONNECTION_RELEASED 0x02
+#define AVRCP_SUBEVENT_OPERATION 0x03
+#define AVRCP_SUBEVENT_OPERATION_START 0x04
+#define AVRCP_SUBEVENT_OPERATION_COMPLETE 0x05
+#define AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED 0x06
+#define AVRCP_SUBEVENT_NOTIFICATION_EVENT_BATT_STATUS_CHANGED 0x07
+#define AVRCP_SUBEVENT_NOTIFICATION_STATE 0x08
+#define AVRCP_SUBEVENT_NOTIFICATION_PLAYBACK_POS_CHANGED 0x09
+#define AVRCP_SUBEVENT_NOTIFICATION_PLAYBACK_STATUS_CHANGED 0x0A
+#define AVRCP_SUBEVENT_NOTIFICATION_NOW_PLAYING_CONTENT_CHANGED 0x0B
+#define AVRCP_SUBEVENT_NOTIFICATION_TRACK_CHANGED 0x0C
+#define AVRCP_SUBEVENT_NOTIFICATION_AVAILABLE_PLAYERS_CHANGED 0x0D
+#define AVRCP_SUBEVENT_NOTIFICATION_EVENT_TRACK_REACHED_END 0x0E
+#define AVRCP_SUBEVENT_SHUFFLE_AND_REPEAT_MODE 0x0F
+#define AVRCP_SUBEVENT_PLAY_STATUS 0x10
+#define AVRCP_SUBEVENT_PLAY_STATUS_QUERY 0x11
+#define AVRCP_SUBEVENT_PLAYER_APPLICATION_VALUE_RESPONSE 0x12
+#define AVRCP_SUBEVENT_NOW_PLAYING_TRACK_INFO 0x13
+#define AVRCP_SUBEVENT_NOW_PLAYING_TOTAL_TRACKS_INFO 0x14
+#define AVRCP_SUBEVENT_NOW_PLAYING_TITLE_INFO 0x15
+#define AVRCP_SUBEVENT_NOW_PLAYING_ARTIST_INFO 0x16
+#define AVRCP_SUBEVENT_NOW_PLAYING_ALBUM_INFO 0x17
+#define AVRCP_SUBEVENT_NOW_PLAYING_GENRE_INFO 0x18
+
+#define AVDTP_SBC_48000 1
+#define AVDTP_SBC_44100 2
+#define AVDTP_SBC_32000 4
+#define AVDTP_SBC_16000 8
+#define AVDTP_SBC_JOINT_STEREO 1
+#define AVDTP_SBC_STEREO 2
+#define AVDTP_SBC_DUAL_CHANNEL 4
+#define AVDTP_SBC_MONO 8
+
+#define AVDTP_SINK_FEATURE_MASK_HEADPHONE 0x0001
+#define AVDTP_SOURCE_FEATURE_MASK_PLAYER 0x0001
+#define AVRCP_FEATURE_MASK_CATEGORY_PLAYER_OR_RECORDER 0x0001
+#define AVRCP_FEATURE_MASK_CATEGORY_MONITOR_OR_AMPLIFIER 0x0002
+#define AVRCP_FEATURE_MASK_BROWSING 0x0040
+#define LM_LINK_POLICY_ENABLE_ROLE_SWITCH 0x0001
+#define LM_LINK_POLICY_ENABLE_SNIFF_MODE 0x0004
+#define INQUIRY_MODE_RSSI_AND_EIR 0x02
+#define DEVICE_ID_VENDOR_ID_SOURCE_BLUETOOTH 0x0001
+#define BLUETOOTH_COMPANY_ID_BLUEKITCHEN_GMBH 0x048F
+
+#ifndef UNUSED
+#  define UNUSED(x) (void)(x)
+#endif
+#define btstack_assert(condition) \
+  if (!(condition)) printf("btstack_assert: %s:%d\n", __FILE__, __LINE__)
+
+// -- utility functions
+
+static inline uint16_t little_endian_read_16(const uint8_t *buffer, int pos) {
+  return buffer[pos] | (buffer[pos + 1] << 8);
+}
+static inline uint32_t little_endian_read_32(const uint8_t *buffer, int pos) {
+  return little_endian_read_16(buffer, pos) |
+         ((uint32_t)little_endian_read_16(buffer, pos + 2) << 16);
+}
+static inline uint16_t big_endian_read_16(const uint8_t *buffer, int pos) {
+  return (buffer[pos] << 8) | buffer[pos + 1];
+}
+static inline uint32_t big_endian_read_32(const uint8_t *buffer, int pos) {
+  return ((uint32_t)big_endian_read_16(buffer, pos) << 16) |
+         big_endian_read_16(buffer, pos + 2);
+}
+static inline void little_endian_store_16(uint8_t *buffer, int pos,
+                                          uint16_t value) {
+  buffer[pos] = value;
+  buffer[pos + 1] = value >> 8;
+}
+static inline void little_endian_store_32(uint8_t *buffer, int pos,
+                                          uint32_t value) {
+  little_endian_store_16(buffer, pos, value);
+  little_endian_store_16(buffer, pos + 2, value >> 16);
+}
+static inline void big_endian_store_16(uint8_t *buffer, int pos,
+                                       uint16_t value) {
+  buffer[pos] = value >> 8;
+  buffer[pos + 1] = value;
+}
+static inline void big_endian_store_32(uint8_t *buffer, int pos,
+                                       uint32_t value) {
+  big_endian_store_16(buffer, pos, value >> 16);
+  big_endian_store_16(buffer, pos + 2, value);
+}
+static inline uint8_t get_bit16(uint16_t bitmap, int position) {
+  return (bitmap >> position) & 1;
+}
+static inline uint32_t btstack_min(uint32_t a, uint32_t b) {
+  return a < b ? a : b;
+}
+static inline uint32_t btstack_max(uint32_t a, uint32_t b) {
+  return a > b ? a : b;
+}
+static inline int bd_addr_cmp(const bd_addr_t a, const bd_addr_t b) {
+  return memcmp(a, b, sizeof(bd_addr_t));
+}
+static inline char *bd_addr_to_str(const bd_addr_t addr) {
+  static char buffer[18];
+  snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X", addr[0],
+           addr[1], addr[2], addr[3], addr[4], addr[5]);
+  return buffer;
+}
+static inline int sscanf_bd_addr(const char *str, bd_addr_t addr) {
+  unsigned int v[6];
+  if (sscanf(str, "%x:%x:%x:%x:%x:%x", &v[0], &v[1], &v[2], &v[3], &v[4],
+             &v[5]) != 6)
+    return 0;
+  for (int j = 0; j < 6; j++) addr[j] = v[j];
+  return 1;
+}
+
+static inline const char *avrcp_ctype2str(uint8_t) { return ""; }
+static inline const char *avrcp_event2str(uint8_t) { return ""; }
+static inline const char *avrcp_operation2str(uint8_t) { return ""; }
+static inline const char *avrcp_play_status2str(uint8_t) { return ""; }
+static inline const char *avrcp_repeat2str(uint8_t) { return ""; }
+static inline const char *avrcp_shuffle2str(uint8_t) { return ""; }
+
+// -- event layout of this stand-in
+
+enum {
+  // all events
+  HOST_EVENT_TYPE = 0,
+  HOST_EVENT_SIZE = 1,
+  HOST_EVENT_SUBEVENT = 2,
+  // HCI and GAP events
+  HOST_HCI_STATE = 2,
+  HOST_HCI_ADDR = 2,
+  HOST_GAP_COD = 8,
+  HOST_GAP_RSSI_AVAILABLE = 11,
+  HOST_GAP_RSSI = 12,
+  HOST_GAP_NAME_AVAILABLE = 13,
+  HOST_GAP_NAME_LEN = 14,
+  HOST_GAP_NAME = 15,
+  // A2DP subevents
+  HOST_A2DP_CID = 3,
+  HOST_A2DP_LOCAL_SEID = 5,
+  HOST_A2DP_REMOTE_SEID = 6,
+  HOST_A2DP_STATUS = 7,
+  HOST_A2DP_ADDR = 8,
+  HOST_A2DP_RECONFIGURE = 14,
+  HOST_A2DP_NUM_CHANNELS = 15,
+  HOST_A2DP_SAMPLING_FREQUENCY = 16,
+  HOST_A2DP_CHANNEL_MODE = 18,
+  HOST_A2DP_BLOCK_LENGTH = 19,
+  HOST_A2DP_SUBBANDS = 20,
+  HOST_A2DP_ALLOCATION_METHOD = 21,
+  HOST_A2DP_MIN_BITPOOL = 22,
+  HOST_A2DP_MAX_BITPOOL = 23,
+  HOST_A2DP_DELAY = 24,
+  HOST_A2DP_EVENT_SIZE = 26,
+  // AVRCP subevents
+  HOST_AVRCP_CID = 3,
+  HOST_AVRCP_STATUS = 5,
+  HOST_AVRCP_ADDR = 6,
+  HOST_AVRCP_VALUE = 12,
+  HOST_AVRCP_VALUE2 = 13,
+  HOST_AVRCP_VALUE32 = 14,
+  HOST_AVRCP_VALUE32B = 18,
+  HOST_AVRCP_TEXT_LEN = 22,
+  HOST_AVRCP_TEXT = 23,
+  HOST_AVRCP_EVENT_SIZE = 24,
+};
+
+// -- HCI and GAP event getters
+
+static inline uint8_t hci_event_packet_get_type(const uint8_t *event) {
+  return event[HOST_EVENT_TYPE];
+}
+static inline uint8_t hci_event_a2dp_meta_get_subevent_code(
+    const uint8_t *event) {
+  return event[HOST_EVENT_SUBEVENT];
+}
+static inline uint8_t btstack_event_state_get_state(const uint8_t *event) {
+  return event[HOST_HCI_STATE];
+}
+static inline void hci_event_pin_code_request_get_bd_addr(const uint8_t *event,
+                                                          bd_addr_t addr) {
+  memcpy(addr, event + HOST_HCI_ADDR, 6);
+}
+static inline void gap_event_inquiry_result_get_bd_addr(const uint8_t *event,
+                                                        bd_addr_t addr) {
+  memcpy(addr, event + HOST_HCI_ADDR, 6);
+}
+static inline uint32_t gap_event_inquiry_result_get_class_of_device(
+    const uint8_t *event) {
+  return little_endian_read_32(event, HOST_GAP_COD) & 0xFFFFFF;
+}
+static inline uint8_t gap_event_inquiry_result_get_rssi_available(
+    const uint8_t *event) {
+  return event[HOST_GAP_RSSI_AVAILABLE];
+}
+static inline uint8_t gap_event_inquiry_result_get_rssi(const uint8_t *event) {
+  return event[HOST_GAP_RSSI];
+}
+static inline uint8_t gap_event_inquiry_result_get_name_available(
+    const uint8_t *event) {
+  return event[HOST_GAP_NAME_AVAILABLE];
+}
+static inline uint8_t gap_event_inquiry_result_get_name_len(
+    const uint8_t *event) {
+  return event[HOST_GAP_NAME_LEN];
+}
+static inline const uint8_t *gap_event_inquiry_result_get_name(
+    const uint8_t *event) {
+  return event + HOST_GAP_NAME;
+}
+
+// -- A2DP event getters
+
+static inline uint16_t host_a2dp_cid(const uint8_t *event) {
+  return little_endian_read_16(event, HOST_A2DP_CID);
+}
+static inline uint8_t host_a2dp_local_seid(const uint8_t *event) {
+  return event[HOST_A2DP_LOCAL_SEID];
+}
+static inline uint8_t host_a2dp_remote_seid(const uint8_t *event) {
+  return event[HOST_A2DP_REMOTE_SEID];
+}
+static inline uint8_t host_a2dp_status(const uint8_t *event) {
+  return event[HOST_A2DP_STATUS];
+}
+static inline void host_a2dp_addr(const uint8_t *event, bd_addr_t addr) {
+  memcpy(addr, event + HOST_A2DP_ADDR, 6);
+}
+
+#define a2dp_subevent_signaling_connection_established_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_signaling_connection_established_get_bd_addr host_a2dp_addr
+#define a2dp_subevent_signaling_connection_established_get_status host_a2dp_status
+#define a2dp_subevent_signaling_connection_released_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_stream_established_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_stream_established_get_bd_addr host_a2dp_addr
+#define a2dp_subevent_stream_established_get_local_seid host_a2dp_local_seid
+#define a2dp_subevent_stream_established_get_remote_seid host_a2dp_remote_seid
+#define a2dp_subevent_stream_established_get_status host_a2dp_status
+#define a2dp_subevent_stream_reconfigured_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_stream_reconfigured_get_local_seid host_a2dp_local_seid
+#define a2dp_subevent_stream_reconfigured_get_status host_a2dp_status
+#define a2dp_subevent_stream_released_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_stream_released_get_local_seid host_a2dp_local_seid
+#define a2dp_subevent_stream_started_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_stream_started_get_local_seid host_a2dp_local_seid
+#define a2dp_subevent_stream_suspended_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_stream_suspended_get_local_seid host_a2dp_local_seid
+#define a2dp_subevent_start_stream_requested_get_a2dp_cid host_a2dp_cid
+#define a2dp_subevent_start_stream_requested_get_local_seid host_a2dp_local_seid
+#define a2dp_subevent_streaming_can_send_media_packet_now_get_a2dp_cid \
+  host_a2dp_cid
+#define a2dp_subevent_streaming_can_send_media_packet_now_get_local_seid \
+  host_a2dp_local_seid
+#define avdtp_subevent_signaling_delay_reporting_capability_get_remote_seid \
+  host_a2dp_remote_seid
+#define avdtp_subevent_signaling_capabilities_done_get_remote_seid \
+  host_a2dp_remote_seid
+#define avdtp_subevent_signaling_delay_report_get_avdtp_cid host_a2dp_cid
+#define avdtp_subevent_signaling_delay_report_get_local_seid \
+  host_a2dp_local_seid
+
+static inline uint16_t avdtp_subevent_signaling_delay_report_get_delay_100us(
+    const uint8_t *event) {
+  return little_endian_read_16(event, HOST_A2DP_DELAY);
+}
+
+#define a2dp_subevent_signaling_media_codec_sbc_configuration_get_a2dp_cid \
+  host_a2dp_cid
+#define avdtp_subevent_signaling_media_codec_sbc_configuration_get_avdtp_cid \
+  host_a2dp_cid
+#define a2dp_subevent_signaling_media_codec_sbc_configuration_get_local_seid \
+  host_a2dp_local_seid
+#define a2dp_subevent_signaling_media_codec_sbc_configuration_get_remote_seid \
+  host_a2dp_remote_seid
+
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure(
+    const uint8_t *event) {
+  return event[HOST_A2DP_RECONFIGURE];
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_num_channels(
+    const uint8_t *event) {
+  return event[HOST_A2DP_NUM_CHANNELS];
+}
+static inline uint16_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_sampling_frequency(
+    const uint8_t *event) {
+  return little_endian_read_16(event, HOST_A2DP_SAMPLING_FREQUENCY);
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_channel_mode(
+    const uint8_t *event) {
+  return event[HOST_A2DP_CHANNEL_MODE];
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_block_length(
+    const uint8_t *event) {
+  return event[HOST_A2DP_BLOCK_LENGTH];
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_subbands(
+    const uint8_t *event) {
+  return event[HOST_A2DP_SUBBANDS];
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_allocation_method(
+    const uint8_t *event) {
+  return event[HOST_A2DP_ALLOCATION_METHOD];
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_min_bitpool_value(
+    const uint8_t *event) {
+  return event[HOST_A2DP_MIN_BITPOOL];
+}
+static inline uint8_t
+a2dp_subevent_signaling_media_codec_sbc_configuration_get_max_bitpool_value(
+    const uint8_t *event) {
+  return event[HOST_A2DP_MAX_BITPOOL];
+}
+
+// only SBC is negotiated: the other configuration events are never sent
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_a2dp_cid \
+  host_a2dp_cid
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_local_seid \
+  host_a2dp_local_seid
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_reconfigure \
+  a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_num_channels \
+  a2dp_subevent_signaling_media_codec_sbc_configuration_get_num_channels
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_sampling_frequency \
+  a2dp_subevent_signaling_media_codec_sbc_configuration_get_sampling_frequency
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_object_type \
+  a2dp_subevent_signaling_media_codec_sbc_configuration_get_block_length
+#define a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_vbr \
+  a2dp_subevent_signaling_media_codec_sbc_configuration_get_subbands
+static inline uint32_t
+a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_bit_rate(
+    const uint8_t *event) {
+  return 0;
+}
+#define a2dp_subevent_signaling_media_codec_other_configuration_get_a2dp_cid \
+  host_a2dp_cid
+#define a2dp_subevent_signaling_media_codec_other_configuration_get_local_seid \
+  host_a2dp_local_seid
+#define a2dp_subevent_signaling_media_codec_other_configuration_get_remote_seid \
+  host_a2dp_remote_seid
+#define a2dp_subevent_signaling_media_codec_other_configuration_get_reconfigure \
+  a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure
+static inline uint16_t
+a2dp_subevent_signaling_media_codec_other_configuration_get_media_codec_information_len(
+    const uint8_t *event) {
+  return 0;
+}
+static inline const uint8_t *
+a2dp_subevent_signaling_media_codec_other_configuration_get_media_codec_information(
+    const uint8_t *event) {
+  return event + HOST_A2DP_EVENT_SIZE;
+}
+
+// -- AVRCP event getters
+
+static inline uint16_t host_avrcp_cid(const uint8_t *event) {
+  return little_endian_read_16(event, HOST_AVRCP_CID);
+}
+static inline uint8_t host_avrcp_value(const uint8_t *event) {
+  return event[HOST_AVRCP_VALUE];
+}
+static inline uint8_t host_avrcp_value2(const uint8_t *event) {
+  return event[HOST_AVRCP_VALUE2];
+}
+static inline uint32_t host_avrcp_value32(const uint8_t *event) {
+  return little_endian_read_32(event, HOST_AVRCP_VALUE32);
+}
+static inline uint8_t host_avrcp_text_len(const uint8_t *event) {
+  return event[HOST_AVRCP_TEXT_LEN];
+}
+static inline const uint8_t *host_avrcp_text(const uint8_t *event) {
+  return event + HOST_AVRCP_TEXT;
+}
+
+static inline uint8_t avrcp_subevent_connection_established_get_status(
+    const uint8_t *event) {
+  return event[HOST_AVRCP_STATUS];
+}
+static inline void avrcp_subevent_connection_established_get_bd_addr(
+    const uint8_t *event, bd_addr_t addr) {
+  memcpy(addr, event + HOST_AVRCP_ADDR, 6);
+}
+static inline uint32_t avrcp_subevent_play_status_get_song_position(
+    const uint8_t *event) {
+  return little_endian_read_32(event, HOST_AVRCP_VALUE32B);
+}
+
+#define avrcp_subevent_connection_established_get_avrcp_cid host_avrcp_cid
+#define avrcp_subevent_connection_released_get_avrcp_cid host_avrcp_cid
+#define avrcp_subevent_play_status_query_get_avrcp_cid host_avrcp_cid
+#define avrcp_subevent_notification_volume_changed_get_avrcp_cid host_avrcp_cid
+#define avrcp_subevent_notification_volume_changed_get_absolute_volume \
+  host_avrcp_value
+#define avrcp_subevent_operation_get_operation_id host_avrcp_value
+#define avrcp_subevent_operation_get_button_pressed host_avrcp_value2
+#define avrcp_subevent_operation_start_get_operation_id host_avrcp_value
+#define avrcp_subevent_operation_complete_get_operation_id host_avrcp_value
+#define avrcp_subevent_notification_event_batt_status_changed_get_battery_status \
+  host_avrcp_value
+#define avrcp_subevent_notification_state_get_event_id host_avrcp_value
+#define avrcp_subevent_notification_state_get_enabled host_avrcp_value2
+#define avrcp_subevent_notification_playback_status_changed_get_play_status \
+  host_avrcp_value
+#define avrcp_subevent_notification_playback_pos_changed_get_playback_position_ms \
+  host_avrcp_value32
+#define avrcp_subevent_play_status_get_play_status host_avrcp_value
+#define avrcp_subevent_play_status_get_song_length host_avrcp_value32
+#define avrcp_subevent_player_application_value_response_get_command_type \
+  host_avrcp_value
+#define avrcp_subevent_shuffle_and_repeat_mode_get_shuffle_mode host_avrcp_value
+#define avrcp_subevent_shuffle_and_repeat_mode_get_repeat_mode host_avrcp_value2
+#define avrcp_subevent_now_playing_track_info_get_track host_avrcp_value32
+#define avrcp_subevent_now_playing_total_tracks_info_get_total_tracks \
+  host_avrcp_value32
+#define avrcp_subevent_now_playing_title_info_get_value host_avrcp_text
+#define avrcp_subevent_now_playing_title_info_get_value_len host_avrcp_text_len
+#define avrcp_subevent_now_playing_artist_info_get_value host_avrcp_text
+#define avrcp_subevent_now_playing_artist_info_get_value_len host_avrcp_text_len
+#define avrcp_subevent_now_playing_album_info_get_value host_avrcp_text
+#define avrcp_subevent_now_playing_album_info_get_value_len host_avrcp_text_len
+#define avrcp_subevent_now_playing_genre_info_get_value host_avrcp_text
+#define avrcp_subevent_now_playing_genre_info_get_value_len host_avrcp_text_len
+
+// -- the virtual link
+
+/// Scenario of the HostLink
+struct host_link_config_t {
+  int delay_ms = 20;           // transport delay of the media packets
+  int jitter_ms = 30;          // additional random delay
+  double loss_rate = 0.005;    // probability that a media packet is lost
+  int drift_ppm = 300;         // run loop clock relative to millis()
+  int mtu = 895;               // L2CAP MTU (2-DH5)
+  int rate_kbps = 1000;        // air time of the media packets
+  int signaling_delay_ms = 5;  // AVDTP and AVRCP signaling
+  const char *speaker_name = "Host Speaker";
+  uint32_t seed = 1;
+};
+
+/**
+ * @brief Simulates the controller, the air and the speaker: the events are
+ * queued with their delivery time and are dispatched by process(), which
+ * also runs the BTstack timers. Everything runs in the thread which calls
+ * process(), like the BTstack run loop.
+ */
+class HostLink {
+ public:
+  host_link_config_t config;
+
+  /// Runs the due timers and delivers the due events: call repeatedly
+  void process() {
+    run_timers();
+    uint64_t now = time_us();
+    while (!queue.empty() && queue.begin()->first <= now) {
+      auto action = queue.begin()->second;
+      queue.erase(queue.begin());
+      action();
+    }
+  }
+
+  /// The phone (our source) sets the absolute volume (0 - 127) of the
+  /// speaker (our sink)
+  void setAbsoluteVolume(uint8_t volume) {
+    if (!conn.is_used || conn.sink_avrcp_cid == 0) return;
+    send_avrcp(avrcp_target, conn.sink_avrcp_cid,
+               AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED, volume);
+  }
+
+  /// Simulated time in ms since the start
+  uint32_t timeMs() { return clock_us / 1000; }
+
+  /// Simulated time in us: the air and the speaker use the clock of the sink
+  uint64_t time_us() { return clock_us; }
+
+  /// Advances the simulated time and processes everything which gets due
+  void advance(uint32_t us) {
+    uint64_t end_us = clock_us + us;
+    while (clock_us < end_us) {
+      clock_us += std::min<uint64_t>(end_us - clock_us, 1000);
+      process();
+    }
+  }
+
+  /// Media packets which were sent by the source
+  uint32_t sentPackets() { return sent_packets; }
+  /// Media packets which were lost on the link
+  uint32_t lostPackets() { return lost_packets; }
+  /// Bytes of the media packets incl. the RTP header
+  uint64_t sentBytes() { return sent_bytes; }
+  /// Stream endpoints which could not be created
+  int failedEndpoints() { return failed_endpoints; }
+
+  // -- BTstack API
+
+  uint32_t run_loop_time_ms() {
+    // the drift is applied to the elapsed time
+    int64_t us = time_us();
+    return (us + us * config.drift_ppm / 1000000) / 1000;
+  }
+
+  void add_timer(btstack_timer_source_t *ts) {
+    for (auto *timer : timers) {
+      if (timer == ts) return;
+    }
+    timers.push_back(ts);
+  }
+
+  int remove_timer(btstack_timer_source_t *ts) {
+    for (auto it = timers.begin(); it != timers.end(); ++it) {
+      if (*it == ts) {
+        timers.erase(it);
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  void add_hci_handler(btstack_packet_callback_registration_t *reg) {
+    hci_handlers.push_back(reg);
+  }
+
+  int power_control(HCI_POWER_MODE mode) {
+    if (mode != HCI_POWER_ON || is_powered) return 0;
+    is_powered = true;
+    random.seed(config.seed);
+    uint8_t event[3] = {BTSTACK_EVENT_STATE, 1, HCI_STATE_WORKING};
+    schedule(10, [this, event]() {
+      hci_state = HCI_STATE_WORKING;
+      send_hci(event, sizeof(event));
+    });
+    return 0;
+  }
+
+  HCI_STATE get_state() { return hci_state; }
+
+  int inquiry_start(uint8_t duration) {
+    inquiry_generation++;
+    uint32_t generation = inquiry_generation;
+    // the speaker answers if its sink was set up
+    if (has_sink_endpoints()) {
+      schedule(200, [this, generation]() {
+        if (generation != inquiry_generation) return;
+        std::vector<uint8_t> event(HOST_GAP_NAME + 248);
+        event[HOST_EVENT_TYPE] = GAP_EVENT_INQUIRY_RESULT;
+        memcpy(event.data() + HOST_HCI_ADDR, speaker_addr, 6);
+        little_endian_store_32(event.data(), HOST_GAP_COD, speaker_cod);
+        event[HOST_GAP_RSSI_AVAILABLE] = 1;
+        event[HOST_GAP_RSSI] = (uint8_t)-40;
+        event[HOST_GAP_NAME_AVAILABLE] = 1;
+        int len = strlen(config.speaker_name);
+        event[HOST_GAP_NAME_LEN] = len;
+        memcpy(event.data() + HOST_GAP_NAME, config.speaker_name, len);
+        send_hci(event.data(), event.size());
+      });
+    }
+    schedule(duration * 1280, [this, generation]() {
+      if (generation != inquiry_generation) return;
+      inquiry_complete();
+    });
+    return 0;
+  }
+
+  int inquiry_stop() {
+    inquiry_generation++;
+    schedule(1, [this]() { inquiry_complete(); });
+    return 0;
+  }
+
+  avdtp_stream_endpoint_t *create_stream_endpoint(bool isSink,
+                                                  uint8_t codecType,
+                                                  const uint8_t *caps,
+                                                  uint16_t capsLen) {
+    // the stream endpoints of the sink and the source share one pool
+    if (endpoints.size() >= MAX_NR_AVDTP_STREAM_ENDPOINTS) {
+      printf("HostLink: max %d stream endpoints\n",
+             MAX_NR_AVDTP_STREAM_ENDPOINTS);
+      failed_endpoints++;
+      return nullptr;
+    }
+    endpoints.emplace_back();
+    avdtp_stream_endpoint_t &ep = endpoints.back();
+    ep.seid = endpoints.size();
+    ep.is_sink = isSink;
+    ep.codec_type = codecType;
+    ep.capabilities = caps;
+    ep.capabilities_len = capsLen;
+    return &ep;
+  }
+
+  avdtp_stream_endpoint_t *endpoint(uint8_t seid) {
+    if (seid == 0 || seid > endpoints.size()) return nullptr;
+    return &endpoints[seid - 1];
+  }
+
+  uint8_t establish_stream(bd_addr_t address, uint16_t *cid) {
+    *cid = next_cid++;
+    uint16_t source_cid = *cid;
+    if (bd_addr_cmp(address, speaker_addr) != 0) {
+      // nobody answers
+      schedule(SOURCE_PAGE_TIMEOUT_MS, [this, source_cid]() {
+        send_a2dp(a2dp_source, A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED,
+                  source_cid, 0, 0, ERROR_CODE_PAGE_TIMEOUT, speaker_addr);
+      });
+      return ERROR_CODE_SUCCESS;
+    }
+    // the connection to the speaker uses an AVDTP connection on both sides
+    if (conn.is_used || MAX_NR_AVDTP_CONNECTIONS < 2) {
+      return BTSTACK_MEMORY_ALLOC_FAILED;
+    }
+    conn = host_connection_t();
+    conn.is_used = true;
+    conn.source_cid = source_cid;
+    conn.sink_cid = next_cid++;
+    conn.sequence_number = std::uniform_int_distribution<int>(0, 0xFFFF)(random);
+    schedule(30, [this]() {
+      send_a2dp(a2dp_sink, A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED,
+                conn.sink_cid, 0, 0, ERROR_CODE_SUCCESS, device_addr);
+      // the sink might have refused the connection
+      if (!conn.is_used) return;
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED,
+                conn.source_cid, 0, 0, ERROR_CODE_SUCCESS, speaker_addr);
+      schedule(config.signaling_delay_ms, [this]() { configure(); });
+      schedule(100, [this]() { connect_avrcp(); });
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  uint8_t start_stream(uint16_t cid) {
+    if (!is_established(cid) || conn.is_streaming)
+      return ERROR_CODE_COMMAND_DISALLOWED;
+    conn.is_streaming = true;
+    schedule(config.signaling_delay_ms, [this]() {
+      if (!conn.is_used) return;
+      send_a2dp(a2dp_sink, A2DP_SUBEVENT_STREAM_STARTED, conn.sink_cid,
+                conn.sink_seid, conn.source_seid, ERROR_CODE_SUCCESS,
+                device_addr);
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAM_STARTED, conn.source_cid,
+                conn.source_seid, conn.sink_seid, ERROR_CODE_SUCCESS,
+                speaker_addr);
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  uint8_t pause_stream(uint16_t cid) {
+    if (!is_established(cid) || !conn.is_streaming || conn.is_suspending)
+      return ERROR_CODE_COMMAND_DISALLOWED;
+    conn.is_suspending = true;
+    // the source can send until the suspend was accepted
+    schedule(config.signaling_delay_ms, [this]() {
+      if (!conn.is_used) return;
+      conn.is_streaming = false;
+      conn.is_suspending = false;
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAM_SUSPENDED, conn.source_cid,
+                conn.source_seid, conn.sink_seid, ERROR_CODE_SUCCESS,
+                speaker_addr);
+      // the media packets which are on the way arrive first
+      schedule_at(signaling_time(), [this]() {
+        if (!conn.is_used) return;
+        send_a2dp(a2dp_sink, A2DP_SUBEVENT_STREAM_SUSPENDED, conn.sink_cid,
+                  conn.sink_seid, conn.source_seid, ERROR_CODE_SUCCESS,
+                  device_addr);
+      });
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  uint8_t disconnect(uint16_t cid) {
+    if (!conn.is_used || (cid != conn.source_cid && cid != conn.sink_cid))
+      return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    host_connection_t old = conn;
+    conn.is_used = false;
+    if (old.source_seid > 0) endpoint(old.source_seid)->is_used = false;
+    if (old.sink_seid > 0) endpoint(old.sink_seid)->is_used = false;
+    schedule_at(signaling_time(), [this, old]() {
+      if (old.source_seid > 0) {
+        send_a2dp(a2dp_sink, A2DP_SUBEVENT_STREAM_RELEASED, old.sink_cid,
+                  old.sink_seid, old.source_seid, ERROR_CODE_SUCCESS,
+                  device_addr);
+        send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAM_RELEASED, old.source_cid,
+                  old.source_seid, old.sink_seid, ERROR_CODE_SUCCESS,
+                  speaker_addr);
+      }
+      send_a2dp(a2dp_sink, A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED,
+                old.sink_cid, 0, 0, ERROR_CODE_SUCCESS, device_addr);
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED,
+                old.source_cid, 0, 0, ERROR_CODE_SUCCESS, speaker_addr);
+      if (old.sink_avrcp_cid > 0) {
+        send_avrcp(avrcp_handler, old.sink_avrcp_cid,
+                   AVRCP_SUBEVENT_CONNECTION_RELEASED, 0);
+        send_avrcp(avrcp_handler, old.source_avrcp_cid,
+                   AVRCP_SUBEVENT_CONNECTION_RELEASED, 0);
+      }
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  uint8_t request_can_send_now(uint16_t cid) {
+    if (!is_established(cid) || cid != conn.source_cid)
+      return ERROR_CODE_COMMAND_DISALLOWED;
+    // the next packet can be sent when the air is free again
+    schedule_at(std::max(time_us(), conn.air_free_us), [this, cid]() {
+      if (!conn.is_used || cid != conn.source_cid) return;
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW,
+                conn.source_cid, conn.source_seid, conn.sink_seid,
+                ERROR_CODE_SUCCESS, speaker_addr);
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  int max_media_payload_size(uint16_t cid) {
+    if (!is_established(cid)) return 0;
+    return config.mtu - RTP_HEADER_SIZE;
+  }
+
+  uint8_t send_media(uint16_t cid, uint8_t marker, uint32_t timestamp,
+                     const uint8_t *payload, uint16_t size) {
+    if (!is_established(cid) || cid != conn.source_cid || !conn.is_streaming)
+      return ERROR_CODE_COMMAND_DISALLOWED;
+    if (size > max_media_payload_size(cid)) {
+      printf("HostLink: media payload %d > %d\n", size,
+             max_media_payload_size(cid));
+      return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+    std::vector<uint8_t> packet(RTP_HEADER_SIZE + size);
+    packet[0] = 0x80;  // RTP version 2
+    packet[1] = (marker ? 0x80 : 0) | RTP_PAYLOAD_TYPE;
+    big_endian_store_16(packet.data(), 2, conn.sequence_number++);
+    big_endian_store_32(packet.data(), 4, timestamp);
+    big_endian_store_32(packet.data(), 8, RTP_SSRC);
+    memcpy(packet.data() + RTP_HEADER_SIZE, payload, size);
+    sent_packets++;
+    sent_bytes += packet.size();
+
+    uint64_t now = time_us();
+    conn.air_free_us = std::max(now, conn.air_free_us) +
+                       (uint64_t)packet.size() * 8 * 1000 / config.rate_kbps;
+    if (std::uniform_real_distribution<double>(0.0, 1.0)(random) <
+        config.loss_rate) {
+      lost_packets++;
+      return ERROR_CODE_SUCCESS;
+    }
+    // L2CAP keeps the order of the packets
+    uint64_t arrival =
+        conn.air_free_us + config.delay_ms * 1000 +
+        std::uniform_int_distribution<int>(0, config.jitter_ms * 1000)(random);
+    if (arrival < conn.last_arrival_us) arrival = conn.last_arrival_us;
+    conn.last_arrival_us = arrival;
+    uint8_t seid = conn.sink_seid;
+    schedule_at(arrival, [this, seid, packet]() mutable {
+      if (media_handler != nullptr)
+        media_handler(seid, packet.data(), packet.size());
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  uint8_t delay_report(uint16_t cid, uint16_t delay100us) {
+    if (!is_established(cid) || cid != conn.sink_cid)
+      return ERROR_CODE_COMMAND_DISALLOWED;
+    schedule(config.signaling_delay_ms, [this, delay100us]() {
+      if (!conn.is_used) return;
+      std::vector<uint8_t> event =
+          a2dp_event(A2DP_SUBEVENT_SIGNALING_DELAY_REPORT, conn.source_cid,
+                     conn.source_seid, conn.sink_seid, ERROR_CODE_SUCCESS,
+                     speaker_addr);
+      little_endian_store_16(event.data(), HOST_A2DP_DELAY, delay100us);
+      a2dp_source(HCI_EVENT_PACKET, 0, event.data(), event.size());
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  /// AVRCP pass through command: it is received by the target on the other
+  /// side
+  uint8_t avrcp_operation(uint16_t avrcpCid, uint8_t operation) {
+    uint16_t peer = avrcp_peer(avrcpCid);
+    if (peer == 0) return ERROR_CODE_COMMAND_DISALLOWED;
+    schedule(config.signaling_delay_ms, [this, peer, operation]() {
+      send_avrcp(avrcp_target, peer, AVRCP_SUBEVENT_OPERATION, operation, 1);
+      send_avrcp(avrcp_target, peer, AVRCP_SUBEVENT_OPERATION, operation, 0);
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  /// AVRCP absolute volume which is set by the controller: it is received by
+  /// the target on the other side
+  uint8_t avrcp_set_absolute_volume(uint16_t avrcpCid, uint8_t volume) {
+    uint16_t peer = avrcp_peer(avrcpCid);
+    if (peer == 0) return ERROR_CODE_COMMAND_DISALLOWED;
+    schedule(config.signaling_delay_ms, [this, peer, volume]() {
+      send_avrcp(avrcp_target, peer,
+                 AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED, volume);
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  /// AVRCP volume notification of the target: it is received by the
+  /// controller on the other side
+  uint8_t avrcp_volume_notification(uint16_t avrcpCid, uint8_t volume) {
+    uint16_t peer = avrcp_peer(avrcpCid);
+    if (peer == 0) return ERROR_CODE_COMMAND_DISALLOWED;
+    schedule(config.signaling_delay_ms, [this, peer, volume]() {
+      send_avrcp(avrcp_controller, peer,
+                 AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED, volume);
+    });
+    return ERROR_CODE_SUCCESS;
+  }
+
+  btstack_packet_handler_t a2dp_sink = nullptr;
+  btstack_packet_handler_t a2dp_source = nullptr;
+  a2dp_media_handler_t media_handler = nullptr;
+  btstack_packet_handler_t avrcp_handler = nullptr;
+  btstack_packet_handler_t avrcp_controller = nullptr;
+  btstack_packet_handler_t avrcp_target = nullptr;
+
+ protected:
+  static const int RTP_HEADER_SIZE = 12;
+  static const uint8_t RTP_PAYLOAD_TYPE = 96;
+  static const uint32_t RTP_SSRC = 1;
+
+  /// Connection from the source to the speaker (our sink)
+  struct host_connection_t {
+    bool is_used = false;
+    bool is_established = false;
+    bool is_streaming = false;
+    bool is_suspending = false;
+    uint16_t source_cid = 0;
+    uint16_t sink_cid = 0;
+    uint8_t source_seid = 0;
+    uint8_t sink_seid = 0;
+    uint16_t source_avrcp_cid = 0;
+    uint16_t sink_avrcp_cid = 0;
+    uint16_t sequence_number = 0;
+    uint64_t air_free_us = 0;
+    uint64_t last_arrival_us = 0;
+  } conn;
+
+  // the phone (our source) and the speaker (our sink)
+  bd_addr_t device_addr = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+  bd_addr_t speaker_addr = {0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+  // Service Class: Rendering | Audio, Major Device Class: Audio, Minor:
+  // Loudspeaker
+  const uint32_t speaker_cod = 0x240414;
+  std::multimap<uint64_t, std::function<void()>> queue;
+  std::vector<btstack_timer_source_t *> timers;
+  std::vector<btstack_packet_callback_registration_t *> hci_handlers;
+  std::deque<avdtp_stream_endpoint_t> endpoints;
+  std::mt19937 random;
+  HCI_STATE hci_state = HCI_STATE_OFF;
+  bool is_powered = false;
+  uint32_t inquiry_generation = 0;
+  uint16_t next_cid = 0x41;
+  uint32_t sent_packets = 0;
+  uint32_t lost_packets = 0;
+  uint64_t sent_bytes = 0;
+  int failed_endpoints = 0;
+  uint64_t clock_us = 0;
+
+  void schedule(uint32_t delayMs, std::function<void()> action) {
+    schedule_at(time_us() + delayMs * 1000ull, action);
+  }
+
+  /// Actions with the same time are executed in the order of scheduling
+  void schedule_at(uint64_t timeUs, std::function<void()> action) {
+    queue.emplace(timeUs, action);
+  }
+
+  /// Signaling which is sent now arrives after the queued media packets
+  uint64_t signaling_time() {
+    return std::max<uint64_t>(time_us() + config.signaling_delay_ms * 1000,
+                    conn.last_arrival_us);
+  }
+
+  void run_timers() {
+    bool is_due = true;
+    while (is_due) {
+      is_due = false;
+      uint32_t now = run_loop_time_ms();
+      for (auto *timer : timers) {
+        if ((int32_t)(timer->timeout - now) <= 0) {
+          remove_timer(timer);
+          if (timer->process != nullptr) timer->process(timer);
+          is_due = true;
+          break;
+        }
+      }
+    }
+  }
+
+  bool is_established(uint16_t cid) {
+    return conn.is_used && conn.is_established &&
+           (cid == conn.source_cid || cid == conn.sink_cid);
+  }
+
+  bool has_sink_endpoints() {
+    for (auto &ep : endpoints) {
+      if (ep.is_sink) return true;
+    }
+    return false;
+  }
+
+  void inquiry_complete() {
+    uint8_t event[3] = {GAP_EVENT_INQUIRY_COMPLETE, 1, 0};
+    send_hci(event, sizeof(event));
+  }
+
+  /// Selects the first free SBC endpoint on both sides and the
+  /// configuration like BTstack: the preferred values of the source if the
+  /// sink supports them, otherwise the highest quality
+  void configure() {
+    if (!conn.is_used) return;
+    avdtp_stream_endpoint_t *src = free_sbc_endpoint(false);
+    avdtp_stream_endpoint_t *snk = free_sbc_endpoint(true);
+    if (src == nullptr || snk == nullptr) {
+      printf("HostLink: no free SBC stream endpoint\n");
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAM_ESTABLISHED, conn.source_cid,
+                0, 0, ERROR_CODE_COMMAND_DISALLOWED, speaker_addr);
+      return;
+    }
+    src->is_used = true;
+    snk->is_used = true;
+    conn.source_seid = src->seid;
+    conn.sink_seid = snk->seid;
+    const uint8_t *a = src->capabilities;
+    const uint8_t *b = snk->capabilities;
+    uint8_t rates = (a[0] >> 4) & (b[0] >> 4);
+    uint8_t modes = a[0] & b[0] & 0x0F;
+    uint8_t blocks = (a[1] >> 4) & (b[1] >> 4);
+    uint8_t subbands = (a[1] >> 2) & (b[1] >> 2) & 0x03;
+    uint8_t allocation = a[1] & b[1] & 0x03;
+    int min_bitpool = std::max(a[2], b[2]);
+    int max_bitpool = std::min(a[3], b[3]);
+    if (!rates || !modes || !blocks || !subbands || !allocation ||
+        min_bitpool > max_bitpool) {
+      printf("HostLink: SBC capabilities do not match\n");
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAM_ESTABLISHED, conn.source_cid,
+                0, 0, ERROR_CODE_COMMAND_DISALLOWED, speaker_addr);
+      return;
+    }
+
+    int rate = 0;
+    const int rate_values[] = {48000, 44100, 32000, 16000};
+    for (int j = 0; j < 4; j++) {
+      if (rates & (1 << j) && rate_values[j] == (int)src->preferred_sampling_frequency)
+        rate = rate_values[j];
+    }
+    for (int j : {1, 0, 2, 3}) {
+      if (rate == 0 && rates & (1 << j)) rate = rate_values[j];
+    }
+    uint8_t mode = modes & src->preferred_channel_mode;
+    for (uint8_t m : {AVDTP_SBC_JOINT_STEREO, AVDTP_SBC_STEREO,
+                      AVDTP_SBC_DUAL_CHANNEL, AVDTP_SBC_MONO}) {
+      if (mode == 0 && (modes & m)) mode = m;
+    }
+    int block_length = 0;
+    for (int j = 0; j < 4 && block_length == 0; j++) {
+      if (blocks & (1 << j)) block_length = 16 - 4 * j;
+    }
+
+    std::vector<uint8_t> event =
+        a2dp_event(A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION, 0,
+                   0, 0, ERROR_CODE_SUCCESS, speaker_addr);
+    event[HOST_A2DP_RECONFIGURE] = 0;
+    event[HOST_A2DP_NUM_CHANNELS] = mode == AVDTP_SBC_MONO ? 1 : 2;
+    little_endian_store_16(event.data(), HOST_A2DP_SAMPLING_FREQUENCY, rate);
+    event[HOST_A2DP_CHANNEL_MODE] = mode;
+    event[HOST_A2DP_BLOCK_LENGTH] = block_length;
+    event[HOST_A2DP_SUBBANDS] = (subbands & 1) ? 8 : 4;
+    event[HOST_A2DP_ALLOCATION_METHOD] = (allocation & 1) ? 1 : 2;
+    event[HOST_A2DP_MIN_BITPOOL] = min_bitpool;
+    event[HOST_A2DP_MAX_BITPOOL] = max_bitpool;
+
+    // the source learns the capabilities of the sink first
+    if (snk->is_delay_reporting) {
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_SIGNALING_DELAY_REPORTING_CAPABILITY,
+                conn.source_cid, conn.source_seid, conn.sink_seid,
+                ERROR_CODE_SUCCESS, speaker_addr);
+    }
+    send_a2dp(a2dp_source, A2DP_SUBEVENT_SIGNALING_CAPABILITIES_DONE,
+              conn.source_cid, conn.source_seid, conn.sink_seid,
+              ERROR_CODE_SUCCESS, speaker_addr);
+    set_ids(event, conn.sink_cid, conn.sink_seid, conn.source_seid,
+            device_addr);
+    a2dp_sink(HCI_EVENT_PACKET, 0, event.data(), event.size());
+    set_ids(event, conn.source_cid, conn.source_seid, conn.sink_seid,
+            speaker_addr);
+    a2dp_source(HCI_EVENT_PACKET, 0, event.data(), event.size());
+
+    schedule(config.signaling_delay_ms, [this]() {
+      if (!conn.is_used) return;
+      conn.is_established = true;
+      send_a2dp(a2dp_sink, A2DP_SUBEVENT_STREAM_ESTABLISHED, conn.sink_cid,
+                conn.sink_seid, conn.source_seid, ERROR_CODE_SUCCESS,
+                device_addr);
+      send_a2dp(a2dp_source, A2DP_SUBEVENT_STREAM_ESTABLISHED,
+                conn.source_cid, conn.source_seid, conn.sink_seid,
+                ERROR_CODE_SUCCESS, speaker_addr);
+    });
+  }
+
+  avdtp_stream_endpoint_t *free_sbc_endpoint(bool isSink) {
+    for (auto &ep : endpoints) {
+      if (ep.is_sink == isSink && !ep.is_used &&
+          ep.codec_type == AVDTP_CODEC_SBC && ep.capabilities_len >= 4)
+        return &ep;
+    }
+    return nullptr;
+  }
+
+  void connect_avrcp() {
+    if (!conn.is_used) return;
+    conn.source_avrcp_cid = next_cid++;
+    conn.sink_avrcp_cid = next_cid++;
+    send_avrcp(avrcp_handler, conn.sink_avrcp_cid,
+               AVRCP_SUBEVENT_CONNECTION_ESTABLISHED, 0);
+    send_avrcp(avrcp_handler, conn.source_avrcp_cid,
+               AVRCP_SUBEVENT_CONNECTION_ESTABLISHED, 0);
+  }
+
+  uint16_t avrcp_peer(uint16_t avrcpCid) {
+    if (!conn.is_used || avrcpCid == 0) return 0;
+    if (avrcpCid == conn.sink_avrcp_cid) return conn.source_avrcp_cid;
+    if (avrcpCid == conn.source_avrcp_cid) return conn.sink_avrcp_cid;
+    return 0;
+  }
+
+  void send_hci(const uint8_t *event, int size) {
+    std::vector<uint8_t> copy(event, event + size);
+    for (auto *reg : hci_handlers) {
+      if (reg->callback != nullptr)
+        reg->callback(HCI_EVENT_PACKET, 0, copy.data(), copy.size());
+    }
+  }
+
+  std::vector<uint8_t> a2dp_event(uint8_t subevent, uint16_t cid,
+                                  uint8_t localSeid, uint8_t remoteSeid,
+                                  uint8_t status, const bd_addr_t addr) {
+    std::vector<uint8_t> event(HOST_A2DP_EVENT_SIZE);
+    event[HOST_EVENT_TYPE] = HCI_EVENT_A2DP_META;
+    event[HOST_EVENT_SIZE] = HOST_A2DP_EVENT_SIZE - 2;
+    event[HOST_EVENT_SUBEVENT] = subevent;
+    event[HOST_A2DP_STATUS] = status;
+    set_ids(event, cid, localSeid, remoteSeid, addr);
+    return event;
+  }
+
+  void set_ids(std::vector<uint8_t> &event, uint16_t cid, uint8_t localSeid,
+               uint8_t remoteSeid, const bd_addr_t addr) {
+    little_endian_store_16(event.data(), HOST_A2DP_CID, cid);
+    event[HOST_A2DP_LOCAL_SEID] = localSeid;
+    event[HOST_A2DP_REMOTE_SEID] = remoteSeid;
+    memcpy(event.data() + HOST_A2DP_ADDR, addr, 6);
+  }
+
+  void send_a2dp(btstack_packet_handler_t handler, uint8_t subevent,
+                 uint16_t cid, uint8_t localSeid, uint8_t remoteSeid,
+                 uint8_t status, const bd_addr_t addr) {
+    if (handler == nullptr) return;
+    std::vector<uint8_t> event =
+        a2dp_event(subevent, cid, localSeid, remoteSeid, status, addr);
+    handler(HCI_EVENT_PACKET, 0, event.data(), event.size());
+  }
+
+  void send_avrcp(btstack_packet_handler_t handler, uint16_t avrcpCid,
+                  uint8_t subevent, uint8_t value, uint8_t value2 = 0) {
+    if (handler == nullptr) return;
+    std::vector<uint8_t> event(HOST_AVRCP_EVENT_SIZE);
+    event[HOST_EVENT_TYPE] = HCI_EVENT_AVRCP_META;
+    event[HOST_EVENT_SIZE] = HOST_AVRCP_EVENT_SIZE - 2;
+    event[HOST_EVENT_SUBEVENT] = subevent;
+    little_endian_store_16(event.data(), HOST_AVRCP_CID, avrcpCid);
+    event[HOST_AVRCP_STATUS] = ERROR_CODE_SUCCESS;
+    // the sink is connected to the phone, the source to the speaker
+    memcpy(event.data() + HOST_AVRCP_ADDR,
+           avrcpCid == conn.sink_avrcp_cid ? device_addr : speaker_addr, 6);
+    event[HOST_AVRCP_VALUE] = value;
+    event[HOST_AVRCP_VALUE2] = value2;
+    handler(HCI_EVENT_PACKET, 0, event.data(), event.size());
+  }
+};
+
+inline HostLink host_link;
+
+namespace btstack_a2dp {
+// the library uses the simulated clock of the sink
+inline unsigned long millis() { return host_link.timeMs(); }
+inline unsigned long micros() { return host_link.time_us(); }
+inline void delay(unsigned long ms) { host_link.advance(ms * 1000); }
+}  // namespace btstack_a2dp
+
+// -- BTstack API
+
+static inline void l2cap_init(void) {}
+static inline void sdp_init(void) {}
+static inline void sm_init(void) {}
+static inline uint8_t sdp_register_service(const uint8_t *record) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline void sdp_unregister_service(uint32_t handle) {}
+static inline void device_id_create_sdp_record(uint8_t *service,
+                                               uint32_t handle,
+                                               uint16_t vendorIdSource,
+                                               uint16_t vendorId,
+                                               uint16_t productId,
+                                               uint16_t version) {}
+static inline void a2dp_sink_create_sdp_record(uint8_t *service,
+                                               uint32_t handle,
+                                               uint16_t features,
+                                               const char *name,
+                                               const char *provider) {}
+static inline void a2dp_source_create_sdp_record(uint8_t *service,
+                                                 uint32_t handle,
+                                                 uint16_t features,
+                                                 const char *name,
+                                                 const char *provider) {}
+static inline void avrcp_controller_create_sdp_record(uint8_t *service,
+                                                      uint32_t handle,
+                                                      uint16_t features,
+                                                      const char *name,
+                                                      const char *provider) {}
+static inline void avrcp_target_create_sdp_record(uint8_t *service,
+                                                  uint32_t handle,
+                                                  uint16_t features,
+                                                  const char *name,
+                                                  const char *provider) {}
+
+static inline uint32_t btstack_run_loop_get_time_ms(void) {
+  return host_link.run_loop_time_ms();
+}
+static inline void btstack_run_loop_set_timer(btstack_timer_source_t *ts,
+                                              uint32_t timeoutMs) {
+  ts->timeout = btstack_run_loop_get_time_ms() + timeoutMs;
+}
+static inline void btstack_run_loop_set_timer_handler(
+    btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *)) {
+  ts->process = process;
+}
+static inline void btstack_run_loop_set_timer_context(
+    btstack_timer_source_t *ts, void *context) {
+  ts->context = context;
+}
+static inline void *btstack_run_loop_get_timer_context(
+    btstack_timer_source_t *ts) {
+  return ts->context;
+}
+static inline void btstack_run_loop_add_timer(btstack_timer_source_t *ts) {
+  host_link.add_timer(ts);
+}
+static inline int btstack_run_loop_remove_timer(btstack_timer_source_t *ts) {
+  return host_link.remove_timer(ts);
+}
+
+/// No persistent storage: the known speakers are not stored
+static inline void btstack_tlv_get_instance(const btstack_tlv_t **tlv,
+                                            void **context) {
+  *tlv = nullptr;
+  *context = nullptr;
+}
+
+static inline void hci_add_event_handler(
+    btstack_packet_callback_registration_t *reg) {
+  host_link.add_hci_handler(reg);
+}
+static inline int hci_power_control(HCI_POWER_MODE mode) {
+  return host_link.power_control(mode);
+}
+static inline HCI_STATE hci_get_state(void) { return host_link.get_state(); }
+static inline void hci_set_master_slave_policy(uint8_t policy) {}
+static inline void hci_set_inquiry_mode(uint8_t mode) {}
+
+static inline void gap_set_local_name(const char *name) {}
+static inline void gap_set_class_of_device(uint32_t cod) {}
+static inline void gap_discoverable_control(uint8_t enable) {}
+static inline void gap_connectable_control(uint8_t enable) {}
+static inline void gap_set_default_link_policy_settings(uint16_t settings) {}
+static inline void gap_set_allow_role_switch(bool allow) {}
+static inline void gap_set_page_timeout(uint16_t timeout) {}
+static inline int gap_inquiry_start(uint8_t duration) {
+  return host_link.inquiry_start(duration);
+}
+static inline int gap_inquiry_stop(void) { return host_link.inquiry_stop(); }
+static inline int gap_pin_code_response(const bd_addr_t addr,
+                                        const char *pin) {
+  return 0;
+}
+
+static inline void a2dp_sink_init(void) {}
+static inline void a2dp_source_init(void) {}
+static inline void a2dp_sink_register_packet_handler(
+    btstack_packet_handler_t handler) {
+  host_link.a2dp_sink = handler;
+}
+static inline void a2dp_source_register_packet_handler(
+    btstack_packet_handler_t handler) {
+  host_link.a2dp_source = handler;
+}
+static inline void a2dp_sink_register_media_handler(
+    a2dp_media_handler_t handler) {
+  host_link.media_handler = handler;
+}
+static inline avdtp_stream_endpoint_t *a2dp_sink_create_stream_endpoint(
+    avdtp_media_type_t mediaType, avdtp_media_codec_type_t codecType,
+    const uint8_t *caps, uint16_t capsLen, uint8_t *config,
+    uint16_t configLen) {
+  return host_link.create_stream_endpoint(true, codecType, caps, capsLen);
+}
+static inline avdtp_stream_endpoint_t *a2dp_source_create_stream_endpoint(
+    avdtp_media_type_t mediaType, avdtp_media_codec_type_t codecType,
+    const uint8_t *caps, uint16_t capsLen, uint8_t *config,
+    uint16_t configLen) {
+  return host_link.create_stream_endpoint(false, codecType, caps, capsLen);
+}
+static inline uint8_t avdtp_local_seid(const avdtp_stream_endpoint_t *ep) {
+  return ep->seid;
+}
+static inline void avdtp_set_preferred_sampling_frequency(
+    avdtp_stream_endpoint_t *ep, uint32_t frequency) {
+  ep->preferred_sampling_frequency = frequency;
+}
+static inline void avdtp_set_preferred_channel_mode(
+    avdtp_stream_endpoint_t *ep, uint8_t channelMode) {
+  ep->preferred_channel_mode = channelMode;
+}
+static inline void avdtp_sink_register_delay_reporting_category(uint8_t seid) {
+  avdtp_stream_endpoint_t *ep = host_link.endpoint(seid);
+  if (ep != nullptr) ep->is_delay_reporting = true;
+}
+static inline void avdtp_source_register_delay_reporting_category(
+    uint8_t seid) {
+  avdtp_stream_endpoint_t *ep = host_link.endpoint(seid);
+  if (ep != nullptr) ep->is_delay_reporting = true;
+}
+
+static inline uint8_t a2dp_source_establish_stream(bd_addr_t address,
+                                                   uint16_t *cid) {
+  return host_link.establish_stream(address, cid);
+}
+static inline uint8_t a2dp_source_start_stream(uint16_t cid, uint8_t seid) {
+  return host_link.start_stream(cid);
+}
+static inline uint8_t a2dp_source_pause_stream(uint16_t cid, uint8_t seid) {
+  return host_link.pause_stream(cid);
+}
+static inline uint8_t a2dp_source_disconnect(uint16_t cid) {
+  return host_link.disconnect(cid);
+}
+static inline uint8_t a2dp_sink_disconnect(uint16_t cid) {
+  return host_link.disconnect(cid);
+}
+static inline uint8_t a2dp_sink_start_stream_accept(uint16_t cid,
+                                                    uint8_t seid) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t a2dp_source_stream_endpoint_request_can_send_now(
+    uint16_t cid, uint8_t seid) {
+  return host_link.request_can_send_now(cid);
+}
+static inline int a2dp_max_media_payload_size(uint16_t cid, uint8_t seid) {
+  return host_link.max_media_payload_size(cid);
+}
+static inline uint8_t avdtp_source_stream_send_media_payload_rtp(
+    uint16_t cid, uint8_t seid, uint8_t marker, uint32_t timestamp,
+    const uint8_t *payload, uint16_t size) {
+  return host_link.send_media(cid, marker, timestamp, payload, size);
+}
+static inline uint8_t a2dp_sink_delay_report(uint16_t cid, uint8_t seid,
+                                             uint16_t delay100us) {
+  return host_link.delay_report(cid, delay100us);
+}
+
+static inline void avrcp_init(void) {}
+static inline void avrcp_controller_init(void) {}
+static inline void avrcp_target_init(void) {}
+static inline void avrcp_register_packet_handler(
+    btstack_packet_handler_t handler) {
+  host_link.avrcp_handler = handler;
+}
+static inline void avrcp_controller_register_packet_handler(
+    btstack_packet_handler_t handler) {
+  host_link.avrcp_controller = handler;
+}
+static inline void avrcp_target_register_packet_handler(
+    btstack_packet_handler_t handler) {
+  host_link.avrcp_target = handler;
+}
+static inline uint8_t avrcp_controller_play(uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_PLAY);
+}
+static inline uint8_t avrcp_controller_stop(uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_STOP);
+}
+static inline uint8_t avrcp_controller_pause(uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_PAUSE);
+}
+static inline uint8_t avrcp_controller_forward(uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_FORWARD);
+}
+static inline uint8_t avrcp_controller_backward(uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_BACKWARD);
+}
+static inline uint8_t avrcp_controller_press_and_hold_fast_forward(
+    uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_FAST_FORWARD);
+}
+static inline uint8_t avrcp_controller_press_and_hold_rewind(uint16_t cid) {
+  return host_link.avrcp_operation(cid, AVRCP_OPERATION_ID_REWIND);
+}
+static inline uint8_t avrcp_controller_release_press_and_hold_cmd(
+    uint16_t cid) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t avrcp_controller_enable_notification(
+    uint16_t cid, avrcp_notification_event_id_t eventId) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t avrcp_target_support_event(
+    uint16_t cid, avrcp_notification_event_id_t eventId) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t avrcp_target_battery_status_changed(
+    uint16_t cid, avrcp_battery_status_t status) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t avrcp_target_volume_changed(uint16_t cid,
+                                                  uint8_t volume) {
+  return host_link.avrcp_volume_notification(cid, volume);
+}
+static inline uint8_t avrcp_controller_set_absolute_volume(uint16_t cid,
+                                                           uint8_t volume) {
+  return host_link.avrcp_set_absolute_volume(cid, volume);
+}
+static inline uint8_t avrcp_target_set_now_playing_info(
+    uint16_t cid, const avrcp_track_t *track, uint16_t totalTracks) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t avrcp_target_set_playback_status(
+    uint16_t cid, avrcp_playback_status_t status) {
+  return ERROR_CODE_SUCCESS;
+}
+static inline uint8_t avrcp_target_play_status(
+    uint16_t cid, uint32_t songLengthMs, uint32_t songPositionMs,
+    avrcp_playback_status_t status) {
+  return ERROR_CODE_SUCCESS;
+}
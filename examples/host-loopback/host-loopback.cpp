@@ -0,0 +1,218 @@
+/**
+ * @file host-loopback.cpp
+ * @author Phil Schatzmann
+ * @brief Runs the A2DPSource and the A2DPSink on the host: the source
+ * discovers and connects the sink of the same program via the BTstack
+ * stand-in in btstack-host, which adds delay, jitter and packet loss to the
+ * media packets and lets the source clock deviate from the sink output
+ * clock. So the packetizing, the sequence checks, the jitter buffer, the
+ * concealment and the drift compensation are measured and checked on Linux
+ * with the connection setup and AVRCP of the stand-in. The source sets the
+ * volume of the speaker like a relay. At the end the sink pauses the source
+ * via AVRCP for 2 seconds and resumes it.
+ *
+ * The time is simulated, so a run takes less than a second: the streaming
+ * duration in seconds (default 300, because the drift compensation needs a
+ * few minutes to settle) and the drift in ppm can be passed as arguments.
+ * The program exits with 1 if one of the checks fails.
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ */
+#include <cmath>
+#include <cstdlib>
+
+#include "AudioTools.h"
+#include "BTstack_A2DP.h"
+
+// test scenario
+const int link_delay_ms = 20;
+const int link_jitter_ms = 30;
+const double loss_rate = 0.005;
+const int pause_ms = 2000;
+const int resume_ms = 3000;
+const int volume_ms = 1000;
+const int speaker_volume = 50;
+
+// limits which are checked
+const int max_latency_ms = 400;
+const int max_underruns = 0;
+const int max_drift_error_ppm = 100;
+
+/// 440 Hz sine as PCM input of the source
+class SineInput : public AudioStream {
+ public:
+  int available() override { return 1024; }
+
+  size_t readBytes(uint8_t *data, size_t len) override {
+    int16_t *samples = (int16_t *)data;
+    int channels = audioInfo().channels;
+    int sample_rate = audioInfo().sample_rate;
+    size_t count = len / (channels * sizeof(int16_t));
+    for (size_t j = 0; j < count; j++) {
+      int16_t sample = 16000 * sin(2 * M_PI * 440 * frames / sample_rate);
+      for (int ch = 0; ch < channels; ch++) samples[j * channels + ch] = sample;
+      frames++;
+    }
+    return count * channels * sizeof(int16_t);
+  }
+
+  uint64_t frames = 0;
+};
+
+/// Counts the PCM output of the sink
+class CountingOutput : public AudioOutput {
+ public:
+  size_t write(const uint8_t *data, size_t len) override {
+    frames += len / (audioInfo().channels * sizeof(int16_t));
+    return len;
+  }
+
+  uint64_t frames = 0;
+};
+
+SineInput input;
+CountingOutput out;
+
+int main(int argc, char **argv) {
+  const int duration_s = argc > 1 ? atoi(argv[1]) : 300;
+  const int clock_drift_ppm = argc > 2 ? atoi(argv[2]) : 300;
+  AudioLogger::instance().begin(Serial, AudioLogger::Warning);
+
+  host_link.config.delay_ms = link_delay_ms;
+  host_link.config.jitter_ms = link_jitter_ms;
+  host_link.config.loss_rate = loss_rate;
+  host_link.config.drift_ppm = clock_drift_ppm;
+  host_link.config.speaker_name = "Host Speaker";
+
+  // the speaker and the phone in one program: the source is faster than the
+  // output of the sink by clock_drift_ppm
+  A2DPSink.setOutput(out);
+  A2DPSink.begin("Host Speaker");
+  A2DPSource.begin(input, "Host Speaker");
+
+  // streaming, then pause and resume via AVRCP
+  const uint32_t pause_start_ms = duration_s * 1000;
+  const uint32_t pause_end_ms = pause_start_ms + pause_ms;
+  const uint32_t end_ms = pause_end_ms + resume_ms;
+  bool is_paused = false, is_resumed = false;
+  uint32_t next_sample_ms = 100;
+  uint32_t connected_ms = 0;
+  bool is_volume_set = false;
+  uint64_t pause_frames = 0, paused_output_frames = 0, resume_frames = 0;
+  double latency_sum_ms = 0;
+  int latency_count = 0;
+  int latency_max_ms = 0;
+  double drift_sum_ppm = 0;
+  int drift_count = 0;
+
+  for (uint32_t now = 0; now < end_ms; now = host_link.timeMs()) {
+    host_link.advance(1000);
+    if (now < next_sample_ms) continue;
+    next_sample_ms += 100;
+
+    if (connected_ms == 0 && out.frames > 0) connected_ms = now;
+    // the relay forwards the volume of the phone to the speaker
+    if (!is_volume_set && now >= volume_ms) {
+      A2DPSource.setFrameVolume(speaker_volume);
+      is_volume_set = true;
+    }
+    if (now >= pause_start_ms) {
+      if (!is_paused) {
+        A2DPSink.pause();
+        is_paused = true;
+      }
+      // the stream is suspended after the frames on the way were played
+      if (now < pause_start_ms + 500) pause_frames = out.frames;
+      if (!is_resumed && now >= pause_end_ms) {
+        paused_output_frames = out.frames - pause_frames;
+        resume_frames = out.frames;
+        A2DPSink.play();
+        is_resumed = true;
+      }
+      continue;
+    }
+    if (out.frames == 0) continue;
+
+    // end to end latency: time since the frame that is played now was
+    // generated
+    int sample_rate = out.audioInfo().sample_rate;
+    int latency_ms = (input.frames - out.frames) * 1000 / sample_rate;
+    latency_sum_ms += latency_ms;
+    latency_count++;
+    if (latency_ms > latency_max_ms) latency_max_ms = latency_ms;
+    // average compensation after the controller has settled
+    if (now > pause_start_ms / 2) {
+      drift_sum_ppm += A2DPSink.driftPpm();
+      drift_count++;
+    }
+  }
+
+  A2DPJitterBuffer &jitter_buffer = A2DPSink.jitterBuffer();
+  double seconds = duration_s;
+  printf("connected: audio after %d ms\n", (int)connected_ms);
+  printf("throughput: %.1f kbit/s, bitpool %d\n",
+         host_link.sentBytes() * 8 / seconds / 1000, A2DPSource.bitpool());
+  printf("latency: avg %.1f ms, max %d ms (source estimate %d ms)\n",
+         latency_count ? latency_sum_ms / latency_count : 0.0, latency_max_ms,
+         (int)A2DPSource.latencyUs() / 1000);
+  printf("jitter buffer: target %d frames, jitter %d us, %u underruns, %u "
+         "overflows\n",
+         jitter_buffer.targetFrames(), jitter_buffer.jitterUs(),
+         (unsigned)jitter_buffer.underruns(),
+         (unsigned)jitter_buffer.overflows());
+  printf("lost packets: %u (link %u of %u), concealed frames: %u\n",
+         (unsigned)A2DPSink.lostPackets(), (unsigned)host_link.lostPackets(),
+         (unsigned)host_link.sentPackets(),
+         (unsigned)A2DPSink.concealedFrames());
+  int drift_ppm = drift_count ? drift_sum_ppm / drift_count : 0;
+  printf("drift compensation: %d ppm (simulated drift %d ppm)\n", drift_ppm,
+         clock_drift_ppm);
+  printf("speaker volume: %d %% (set %d %%)\n", A2DPSink.volume(),
+         speaker_volume);
+
+  bool ok = true;
+  if (connected_ms == 0) {
+    printf("FAILED: no audio output\n");
+    ok = false;
+  }
+  if (latency_max_ms > max_latency_ms) {
+    printf("FAILED: latency %d ms > %d ms\n", latency_max_ms, max_latency_ms);
+    ok = false;
+  }
+  if ((int)jitter_buffer.underruns() > max_underruns) {
+    printf("FAILED: %u underruns\n", (unsigned)jitter_buffer.underruns());
+    ok = false;
+  }
+  if (paused_output_frames > 0) {
+    printf("FAILED: %u frames were played during the pause\n",
+           (unsigned)paused_output_frames);
+    ok = false;
+  }
+  if (out.frames == resume_frames) {
+    printf("FAILED: no audio output after the pause\n");
+    ok = false;
+  }
+  // the last packets before the pause can not be detected as lost
+  uint32_t lost = host_link.lostPackets();
+  if (A2DPSink.lostPackets() > lost || A2DPSink.lostPackets() + 3 < lost) {
+    printf("FAILED: %u lost packets detected, expected %u\n",
+           (unsigned)A2DPSink.lostPackets(), (unsigned)lost);
+    ok = false;
+  }
+  // the AVRCP volume is rounded to 0 - 127
+  if (abs(A2DPSink.volume() - speaker_volume) > 1) {
+    printf("FAILED: speaker volume %d %%, expected %d %%\n", A2DPSink.volume(),
+           speaker_volume);
+    ok = false;
+  }
+  // a faster source needs to be consumed faster
+  if (abs(drift_ppm - clock_drift_ppm) > max_drift_error_ppm) {
+    printf("FAILED: drift compensation %d ppm, expected %d ppm\n", drift_ppm,
+           clock_drift_ppm);
+    ok = false;
+  }
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
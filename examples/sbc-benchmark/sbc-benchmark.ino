@@ -0,0 +1,444 @@
+#include "AudioTools.h"
+#include "AudioTools/AudioCodecs/CodecSBC.h"
+#include "BTstack_A2DP.h"
+#include "A2DPVolume.h"
+// the AAC comparison needs the arduino-libhelix and the arduino-fdk-aac
+// library
+#define BENCHMARK_AAC 1
+#if BENCHMARK_AAC
+#include "A2DPDecoderAAC.h"
+#include "AudioTools/AudioCodecs/CodecAACFDK.h"
+#endif
+
+// Measures the cost of the A2DPEncoderSBC, the A2DPDecoderSBC and the volume
+// control (VolumeStream and the fixed point A2DPVolume) per frame for all the
+// SBC configurations that can be negotiated: sample rates, channel modes,
+// blocks, subbands, allocation methods and the bitpool range up to the
+// maximum which can be negotiated for the channel mode. The result is printed
+// as CSV, so that it can be compared between releases:
+// stage,sample_rate,channel_mode,channels,subbands,blocks,bitpool,allocation,
+// frame_bytes,ns_per_frame,frames_per_s,bytes_per_s,heap_bytes,heap_peak_bytes
+// heap_bytes is allocated by begin(), heap_peak_bytes is the low-water mark of
+// the free heap while the frames are processed (relative to the free heap
+// before begin()).
+// Finally the A2DPDecoderAAC is compared with the default SBC configuration
+// per 1024 samples (one AAC frame): the AAC frames are encoded from the same
+// sine wave at startup.
+
+const int frame_count = 200;
+// the PCM and the encoded frames are repeated, so that the buffers stay
+// small compared to the measured heap
+const int buffer_frames = 16;
+const int max_frame_bytes = 520;
+const int sample_rates[] = {16000, 32000, 44100, 48000};
+const btstack_sbc_channel_mode_t channel_modes[] = {
+    SBC_CHANNEL_MODE_MONO, SBC_CHANNEL_MODE_DUAL_CHANNEL,
+    SBC_CHANNEL_MODE_STEREO, SBC_CHANNEL_MODE_JOINT_STEREO};
+const int subbands_values[] = {4, 8};
+const int blocks_values[] = {4, 8, 12, 16};
+const int bitpool_values[] = {2, 16, 32, SBC_XQ_MAX_BITPOOL, SBC_MAX_BITPOOL};
+const btstack_sbc_allocation_method_t allocation_values[] = {SBC_LOUDNESS,
+                                                             SBC_SNR};
+
+/// Decoding cost of one codec configuration
+struct DecodeResult {
+  float ns_per_frame = 0;
+  int frame_samples = 0;
+  int heap = 0;
+  int heap_peak = 0;
+};
+
+NullStream null_out;
+Vector<int16_t> pcm;
+Vector<uint8_t> encoded;
+Vector<int> encoded_len;
+
+int freeHeap() {
+#if defined(ARDUINO_ARCH_RP2040)
+  return rp2040.getFreeHeap();
+#elif defined(ESP32)
+  return ESP.getFreeHeap();
+#else
+  return 0;
+#endif
+}
+
+/// Tracks the lowest free heap
+struct HeapWatermark {
+  int start = freeHeap();
+  int low = start;
+  void update() {
+    int heap = freeHeap();
+    if (heap < low) low = heap;
+  }
+  int used() { return start - low; }
+};
+
+const char *modeName(btstack_sbc_channel_mode_t mode) {
+  switch (mode) {
+    case SBC_CHANNEL_MODE_MONO:
+      return "mono";
+    case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+      return "dual";
+    case SBC_CHANNEL_MODE_STEREO:
+      return "stereo";
+    default:
+      return "joint";
+  }
+}
+
+/// Max bitpool which can be negotiated: the limit of the channel mode (A2DP
+/// spec 12.9) and the capabilities of the sink and the source
+int maxBitpool(btstack_sbc_channel_mode_t mode, int subbands) {
+  bool is_single = mode == SBC_CHANNEL_MODE_MONO ||
+                   mode == SBC_CHANNEL_MODE_DUAL_CHANNEL;
+  return btstack_min(SBC_MAX_BITPOOL, (is_single ? 16 : 32) * subbands);
+}
+
+void printResult(const char *stage, media_codec_configuration_sbc_t &cfg,
+                 int bitpool, int frameBytes, uint32_t us, int bytesPerFrame,
+                 int heap, int heapPeak) {
+  float ns_per_frame = 1000.0f * us / frame_count;
+  float frames_per_s = ns_per_frame > 0 ? 1000000000.0f / ns_per_frame : 0;
+  Serial.printf("%s,%d,%s,%d,%d,%d,%d,%s,%d,%.0f,%.0f,%.0f,%d,%d\n", stage,
+                cfg.sampling_frequency, modeName(cfg.channel_mode),
+                cfg.num_channels, cfg.subbands, cfg.block_length, bitpool,
+                cfg.allocation_method == SBC_SNR ? "snr" : "loudness",
+                frameBytes, ns_per_frame, frames_per_s,
+                frames_per_s * bytesPerFrame, heap, heapPeak);
+}
+
+/// Fills the PCM buffer with a sine wave with a different phase per channel
+void createPCM(int sampleRate, int channels, int samples) {
+  pcm.resize(samples * channels);
+  for (int j = 0; j < samples; j++) {
+    for (int ch = 0; ch < channels; ch++) {
+      pcm[j * channels + ch] =
+          16000 * sin(2 * PI * (440 + 110 * ch) * j / sampleRate);
+    }
+  }
+}
+
+DecodeResult benchmark(media_codec_configuration_sbc_t &cfg, int bitpool) {
+  DecodeResult result;
+  cfg.min_bitpool_value = bitpool;
+  cfg.max_bitpool_value = bitpool;
+  int frame_samples = cfg.subbands * cfg.block_length;
+  int pcm_bytes = frame_samples * cfg.num_channels * sizeof(int16_t);
+  createPCM(cfg.sampling_frequency, cfg.num_channels,
+            frame_samples * buffer_frames);
+
+  // encode
+  encoded.resize(buffer_frames * max_frame_bytes);
+  encoded_len.resize(buffer_frames);
+  HeapWatermark heap;
+  A2DPEncoderSBC *p_encoder = new A2DPEncoderSBC();
+  p_encoder->setConfiguration(cfg);
+  p_encoder->begin();
+  int encoder_heap = heap.start - freeHeap();
+  heap.update();
+  int frame_bytes = p_encoder->frameLengthEncoded();
+  if (!p_encoder->isFrameEncoder() ||
+      p_encoder->frameLengthDecoded() != pcm_bytes ||
+      frame_bytes > max_frame_bytes) {
+    Serial.printf("# unsupported: %s %d bitpool %d\n",
+                  modeName(cfg.channel_mode), frame_samples, bitpool);
+    delete p_encoder;
+    return result;
+  }
+  // the first frames allocate the buffers: they are measured separately
+  for (int j = 0; j < buffer_frames; j++) {
+    encoded_len[j] = p_encoder->encodeFrame(
+        (const uint8_t *)(pcm.data() + j * frame_samples * cfg.num_channels),
+        pcm_bytes, encoded.data() + j * max_frame_bytes, max_frame_bytes);
+    heap.update();
+  }
+  uint32_t start = micros();
+  for (int j = 0; j < frame_count; j++) {
+    int pos = j % buffer_frames;
+    p_encoder->encodeFrame(
+        (const uint8_t *)(pcm.data() + pos * frame_samples * cfg.num_channels),
+        pcm_bytes, encoded.data() + pos * max_frame_bytes, max_frame_bytes);
+  }
+  uint32_t us = micros() - start;
+  heap.update();
+  printResult("encode", cfg, bitpool, frame_bytes, us, pcm_bytes,
+              encoder_heap, heap.used());
+  delete p_encoder;
+
+  // decode the encoded frames
+  HeapWatermark dec_heap;
+  A2DPDecoderSBC *p_decoder = new A2DPDecoderSBC();
+  p_decoder->setConfiguration(cfg);
+  p_decoder->begin();
+  AudioDecoder &decoder = p_decoder->decoder();
+  decoder.setOutput(null_out);
+  decoder.begin();
+  int decoder_heap = dec_heap.start - freeHeap();
+  dec_heap.update();
+  for (int j = 0; j < buffer_frames; j++) {
+    decoder.write(encoded.data() + j * max_frame_bytes, encoded_len[j]);
+    dec_heap.update();
+  }
+  start = micros();
+  for (int j = 0; j < frame_count; j++) {
+    int pos = j % buffer_frames;
+    decoder.write(encoded.data() + pos * max_frame_bytes, encoded_len[pos]);
+  }
+  us = micros() - start;
+  dec_heap.update();
+  printResult("decode", cfg, bitpool, frame_bytes, us, frame_bytes,
+              decoder_heap, dec_heap.used());
+  decoder.end();
+  delete p_decoder;
+  result.ns_per_frame = 1000.0f * us / frame_count;
+  result.frame_samples = frame_samples;
+  result.heap = decoder_heap;
+  result.heap_peak = dec_heap.used();
+  return result;
+}
+
+#if BENCHMARK_AAC
+/// Collects the ADTS frames of the AAC encoder
+class ADTSCollector : public Print {
+ public:
+  Vector<uint8_t> data;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t len) override {
+    for (size_t j = 0; j < len; j++) data.push_back(buffer[j]);
+    return len;
+  }
+};
+
+/// Appends up to 32 bits MSB first
+struct BitWriter {
+  Vector<uint8_t> &data;
+  int pos = 0;
+  void write(uint32_t value, int bits) {
+    for (int j = bits - 1; j >= 0; j--) {
+      if (pos % 8 == 0) data.push_back(0);
+      if ((value >> j) & 1) data[data.size() - 1] |= 0x80 >> (pos % 8);
+      pos++;
+    }
+  }
+};
+
+// LATM AudioMuxElements as received by the sink: the StreamMuxConfig (AAC
+// LC, 44.1 kHz, stereo) followed by the length and the access unit
+Vector<uint8_t> aac_payloads;
+Vector<int> aac_payload_pos;
+
+/// Encodes the sine wave and converts the ADTS frames into LATM payloads
+bool createAACPayloads() {
+  const int sample_rate = 44100, channels = 2, samples = 1024;
+  ADTSCollector adts;
+  AACEncoderFDK *p_encoder = new AACEncoderFDK(adts);
+  p_encoder->setAudioInfo(AudioInfo(sample_rate, channels, 16));
+  p_encoder->begin();
+  // the sine wave is continued frame by frame to keep the buffer small
+  pcm.resize(samples * channels);
+  for (int frame = 0; frame < buffer_frames; frame++) {
+    for (int j = 0; j < samples; j++) {
+      int n = frame * samples + j;
+      for (int ch = 0; ch < channels; ch++) {
+        pcm[j * channels + ch] =
+            16000 * sin(2 * PI * (440 + 110 * ch) * n / sample_rate);
+      }
+    }
+    p_encoder->write((const uint8_t *)pcm.data(),
+                     pcm.size() * sizeof(int16_t));
+  }
+  p_encoder->end();
+  delete p_encoder;
+
+  aac_payloads.clear();
+  aac_payload_pos.clear();
+  int pos = 0;
+  while (pos + 7 <= adts.data.size()) {
+    const uint8_t *header = adts.data.data() + pos;
+    if (header[0] != 0xFF || (header[1] & 0xF0) != 0xF0) break;
+    int header_size = (header[1] & 0x01) ? 7 : 9;
+    int frame_size = ((header[3] & 0x03) << 11) | (header[4] << 3) |
+                     (header[5] >> 5);
+    if (frame_size <= header_size || pos + frame_size > adts.data.size()) break;
+    int au_size = frame_size - header_size;
+    aac_payload_pos.push_back(aac_payloads.size());
+    BitWriter writer{aac_payloads};
+    writer.write(0, 1);  // useSameStreamMux
+    writer.write(0, 1);  // audioMuxVersion
+    writer.write(1, 1);  // allStreamsSameTimeFraming
+    writer.write(0, 6 + 4 + 3);  // numSubFrames, numProgram, numLayer
+    writer.write(2, 5);  // AAC LC
+    writer.write(4, 4);  // 44100
+    writer.write(channels, 4);
+    writer.write(0, 3);  // frameLengthFlag, dependsOnCoreCoder, extensionFlag
+    writer.write(0, 3);  // frameLengthType
+    writer.write(0xFF, 8);  // latmBufferFullness
+    writer.write(0, 2);  // otherDataPresent, crcCheckPresent
+    for (int len = au_size; len >= 0; len -= 255) {
+      writer.write(btstack_min(len, 255), 8);
+    }
+    for (int j = 0; j < au_size; j++) {
+      writer.write(header[header_size + j], 8);
+    }
+    pos += frame_size;
+  }
+  aac_payload_pos.push_back(aac_payloads.size());
+  return aac_payload_pos.size() > 1;
+}
+
+/// Decodes the AAC payloads like the sink: readFrames() converts them into
+/// ADTS frames for the Helix decoder
+DecodeResult benchmarkAAC() {
+  DecodeResult result;
+  if (!createAACPayloads()) {
+    Serial.println("# no AAC frames were encoded");
+    return result;
+  }
+  int payload_count = aac_payload_pos.size() - 1;
+  HeapWatermark heap;
+  A2DPDecoderAAC *p_aac = new A2DPDecoderAAC();
+  p_aac->begin();
+  AudioDecoder &decoder = p_aac->decoder();
+  decoder.setOutput(null_out);
+  decoder.begin();
+  result.heap = heap.start - freeHeap();
+  heap.update();
+  uint8_t *frame = nullptr;
+  int frame_size = 0;
+  uint32_t us = 0;
+  int payload_bytes = 0;
+  for (int j = 0; j < buffer_frames + frame_count; j++) {
+    int idx = j % payload_count;
+    uint8_t *payload = aac_payloads.data() + aac_payload_pos[idx];
+    int payload_size = aac_payload_pos[idx + 1] - aac_payload_pos[idx];
+    payload_bytes += payload_size;
+    uint32_t start = micros();
+    if (p_aac->readFrames(payload, payload_size, frame, frame_size) == 1) {
+      decoder.write(frame, frame_size);
+    }
+    // the first frames allocate the buffers: they are not timed
+    if (j >= buffer_frames) us += micros() - start;
+    else heap.update();
+  }
+  heap.update();
+  result.ns_per_frame = 1000.0f * us / frame_count;
+  result.frame_samples = p_aac->frameLengthDecoded() / (2 * sizeof(int16_t));
+  result.heap_peak = heap.used();
+  float frames_per_s =
+      result.ns_per_frame > 0 ? 1000000000.0f / result.ns_per_frame : 0;
+  Serial.printf("aac-decode,44100,stereo,2,0,0,0,-,%d,%.0f,%.0f,%.0f,%d,%d\n",
+                frame_size, result.ns_per_frame, frames_per_s,
+                frames_per_s * payload_bytes / (buffer_frames + frame_count),
+                result.heap, result.heap_peak);
+  decoder.end();
+  delete p_aac;
+  return result;
+}
+
+/// RAM and CPU of AAC and of the default SBC configuration per 1024 samples
+void benchmarkAACvsSBC() {
+  media_codec_configuration_sbc_t cfg;
+  cfg.reconfigure = 0;
+  cfg.sampling_frequency = 44100;
+  cfg.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+  cfg.num_channels = 2;
+  cfg.subbands = 8;
+  cfg.block_length = 16;
+  cfg.allocation_method = SBC_LOUDNESS;
+  DecodeResult sbc = benchmark(cfg, SBC_MAX_BITPOOL);
+  DecodeResult aac = benchmarkAAC();
+  if (sbc.frame_samples == 0 || aac.frame_samples == 0) return;
+  Serial.printf(
+      "# aac vs sbc per 1024 samples: cpu %.0f vs %.0f us, heap %d vs %d "
+      "bytes, peak %d vs %d bytes\n",
+      aac.ns_per_frame / 1000 * 1024 / aac.frame_samples,
+      sbc.ns_per_frame / 1000 * 1024 / sbc.frame_samples, aac.heap, sbc.heap,
+      aac.heap_peak, sbc.heap_peak);
+}
+#endif
+
+/// The volume control only depends on the frame size
+void benchmarkVolume(media_codec_configuration_sbc_t &cfg) {
+  AudioInfo info(cfg.sampling_frequency, cfg.num_channels, 16);
+  int channels = cfg.num_channels;
+  int frame_samples = cfg.subbands * cfg.block_length;
+  int pcm_bytes = frame_samples * channels * sizeof(int16_t);
+  createPCM(cfg.sampling_frequency, channels, frame_samples * buffer_frames);
+
+  HeapWatermark heap;
+  VolumeStream volume;
+  volume.setOutput(null_out);
+  auto vcfg = volume.defaultConfig();
+  vcfg.copyFrom(info);
+  vcfg.volume = 0.5;
+  volume.begin(vcfg);
+  int volume_heap = heap.start - freeHeap();
+  uint32_t start = micros();
+  for (int j = 0; j < frame_count; j++) {
+    int pos = j % buffer_frames;
+    volume.write((const uint8_t *)(pcm.data() + pos * frame_samples * channels),
+                 pcm_bytes);
+  }
+  uint32_t us = micros() - start;
+  heap.update();
+  printResult("volume", cfg, 0, 0, us, pcm_bytes, volume_heap, heap.used());
+
+  // fixed point volume which is applied in place
+  A2DPVolume a2dp_volume;
+  a2dp_volume.begin(channels);
+  a2dp_volume.setGain(A2DPVolume::Q15_ONE / 2);
+  start = micros();
+  for (int j = 0; j < frame_count; j++) {
+    int pos = j % buffer_frames;
+    a2dp_volume.process(pcm.data() + pos * frame_samples * channels,
+                        frame_samples * channels);
+  }
+  us = micros() - start;
+  printResult("a2dp-volume", cfg, 0, 0, us, pcm_bytes, 0, 0);
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial);
+  AudioLogger::instance().begin(Serial, AudioLogger::Warning);
+
+  Serial.println(
+      "stage,sample_rate,channel_mode,channels,subbands,blocks,bitpool,"
+      "allocation,frame_bytes,ns_per_frame,frames_per_s,bytes_per_s,"
+      "heap_bytes,heap_peak_bytes");
+  media_codec_configuration_sbc_t cfg;
+  cfg.reconfigure = 0;
+  for (int sample_rate : sample_rates) {
+    cfg.sampling_frequency = sample_rate;
+    for (btstack_sbc_channel_mode_t mode : channel_modes) {
+      cfg.channel_mode = mode;
+      cfg.num_channels = mode == SBC_CHANNEL_MODE_MONO ? 1 : 2;
+      for (int subbands : subbands_values) {
+        cfg.subbands = subbands;
+        for (int blocks : blocks_values) {
+          cfg.block_length = blocks;
+          cfg.allocation_method = SBC_LOUDNESS;
+          if (mode != SBC_CHANNEL_MODE_DUAL_CHANNEL &&
+              mode != SBC_CHANNEL_MODE_STEREO) {
+            benchmarkVolume(cfg);
+          }
+          for (btstack_sbc_allocation_method_t allocation :
+               allocation_values) {
+            cfg.allocation_method = allocation;
+            for (int bitpool : bitpool_values) {
+              if (bitpool > maxBitpool(mode, subbands)) continue;
+              benchmark(cfg, bitpool);
+            }
+          }
+        }
+      }
+    }
+  }
+#if BENCHMARK_AAC
+  benchmarkAACvsSBC();
+#endif
+  Serial.println("# done");
+}
+
+void loop() {}
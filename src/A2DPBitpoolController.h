@@ -0,0 +1,80 @@
+/**
+ * @file A2DPBitpoolController.h
+ * @author Phil Schatzmann
+ * @brief Adaptive SBC bitpool for the A2DP source
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPConfig.h"
+#include "AudioTools.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief Determines the SBC bitpool from the link quality: when packets queue
+ * up, the can-send-now events are late or audio had to be dropped, the
+ * bitpool is reduced in big steps towards the negotiated minimum. After the
+ * link has been good for BITPOOL_RECOVER_MS it is raised again in small steps
+ * up to the negotiated maximum.
+ * @author Phil Schatzmann
+ */
+class A2DPBitpoolController {
+ public:
+  /// Starts with the maximum bitpool
+  void begin(int minBitpool, int maxBitpool, uint32_t now) {
+    min_bitpool = minBitpool;
+    max_bitpool = maxBitpool < minBitpool ? minBitpool : maxBitpool;
+    current_bitpool = max_bitpool;
+    change_time_ms = now;
+    good_since_ms = now;
+  }
+
+  /// Call periodically with the number of packets waiting to be sent, the
+  /// latency of the last can-send-now request and whether audio was dropped:
+  /// returns the new bitpool
+  int update(uint32_t now, int backlogPackets, uint32_t sendLatencyMs,
+             bool isDropped) {
+    if (max_bitpool == 0) return current_bitpool;
+    bool is_degraded = backlogPackets >= BITPOOL_BACKLOG_HIGH ||
+                       sendLatencyMs >= BITPOOL_LATENCY_HIGH_MS || isDropped;
+    if (is_degraded) {
+      good_since_ms = now;
+      // give the last reduction some time to take effect
+      if (now - change_time_ms >= BITPOOL_HOLD_MS &&
+          current_bitpool > min_bitpool) {
+        set_bitpool(current_bitpool - BITPOOL_STEP_DOWN, now);
+        LOGW("Link degraded (backlog %d, latency %d ms): bitpool %d",
+             backlogPackets, (int)sendLatencyMs, current_bitpool);
+      }
+    } else if (now - good_since_ms >= BITPOOL_RECOVER_MS &&
+               current_bitpool < max_bitpool) {
+      good_since_ms = now;
+      set_bitpool(current_bitpool + BITPOOL_STEP_UP, now);
+      LOGI("Link recovered: bitpool %d", current_bitpool);
+    }
+    return current_bitpool;
+  }
+
+  /// Actual bitpool
+  int bitpool() { return current_bitpool; }
+
+ protected:
+  int min_bitpool = 0;
+  int max_bitpool = 0;
+  int current_bitpool = 0;
+  uint32_t change_time_ms = 0;
+  uint32_t good_since_ms = 0;
+
+  void set_bitpool(int value, uint32_t now) {
+    if (value < min_bitpool) value = min_bitpool;
+    if (value > max_bitpool) value = max_bitpool;
+    current_bitpool = value;
+    change_time_ms = now;
+  }
+};
+
+}  // namespace btstack_a2dp
@@ -0,0 +1,112 @@
+/**
+ * @file A2DPCodecRegistry.h
+ * @author Phil Schatzmann
+ * @brief Registered codecs with their stream endpoints
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPConfig.h"
+#include "A2DPCodecs.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief Registry of the A2DPEncoder or A2DPDecoder implementations: each
+ * codec gets its own stream endpoint (SEP). The codecs are sorted by
+ * descending priority, so that the endpoints are created in this order and
+ * the peer sees the preferred codec first. The configuration events are
+ * routed with the local seid to the codec of the endpoint. A codec can have
+ * an endpoint per link, because an endpoint serves only one connection.
+ * @author Phil Schatzmann
+ */
+template <class T>
+class A2DPCodecRegistry {
+ public:
+  struct entry_t {
+    T *p_codec = nullptr;
+    int priority = 0;
+    uint8_t local_seid = 0;  // endpoint of the first link
+    uint8_t link_seids[A2DP_MAX_LINKS] = {0};
+
+    /// Records the endpoint which was created for the link
+    void setSeid(int link, uint8_t seid) {
+      if (link < 0 || link >= A2DP_MAX_LINKS) return;
+      link_seids[link] = seid;
+      if (link == 0) local_seid = seid;
+    }
+  };
+
+  /// Adds a codec: a higher priority is preferred
+  bool add(T &codec, int priority = 0) {
+    if (indexOf(codec) >= 0) return false;
+    if (count >= A2DP_MAX_CODECS) {
+      LOGE("A2DPCodecRegistry: max %d codecs", A2DP_MAX_CODECS);
+      return false;
+    }
+    // insert sorted by priority: same priority keeps the order of add()
+    int pos = count;
+    while (pos > 0 && entries[pos - 1].priority < priority) {
+      entries[pos] = entries[pos - 1];
+      pos--;
+    }
+    entries[pos] = entry_t();
+    entries[pos].p_codec = &codec;
+    entries[pos].priority = priority;
+    count++;
+    return true;
+  }
+
+  /// Removes all codecs
+  void clear() { count = 0; }
+
+  /// Number of registered codecs
+  int size() { return count; }
+
+  /// Provides the entry at the indicated position
+  entry_t &operator[](int idx) { return entries[idx]; }
+
+  /// Determines if a codec of the indicated type was registered
+  bool contains(avdtp_media_codec_type_t type) {
+    for (int j = 0; j < count; j++) {
+      if (entries[j].p_codec->codecType() == type) return true;
+    }
+    return false;
+  }
+
+  /// Provides the codec of the stream endpoint or nullptr
+  T *find(uint8_t localSeid) {
+    if (localSeid == 0) return nullptr;
+    for (int j = 0; j < count; j++) {
+      for (int l = 0; l < A2DP_MAX_LINKS; l++) {
+        if (entries[j].link_seids[l] == localSeid) return entries[j].p_codec;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Codec with the highest priority or nullptr
+  T *first() { return count > 0 ? entries[0].p_codec : nullptr; }
+
+  /// Local seid of the codec or 0
+  uint8_t seid(T &codec) {
+    int idx = indexOf(codec);
+    return idx >= 0 ? entries[idx].local_seid : 0;
+  }
+
+ protected:
+  entry_t entries[A2DP_MAX_CODECS];
+  int count = 0;
+
+  int indexOf(T &codec) {
+    for (int j = 0; j < count; j++) {
+      if (entries[j].p_codec == &codec) return j;
+    }
+    return -1;
+  }
+};
+
+}  // namespace btstack_a2dp
@@ -1,4 +1,5 @@
 #pragma once
+#include "A2DPConfig.h"
 #include "AudioTools.h"
 #include "AudioTools/AudioCodecs/CodecSBC.h"
 
@@ -47,6 +48,34 @@ class A2DPEncoder {
   virtual int frameLengthDecoded() = 0;
   virtual AudioInfo audioInfo() = 0;
   virtual avdtp_media_codec_type_t codecType() = 0;
+  /// Algorithmic delay of the encoder in samples (per channel)
+  virtual int delaySamples() { return 0; }
+  /// Negotiated bitpool range: 0 if the bitrate can not be changed
+  virtual int minBitpool() { return 0; }
+  virtual int maxBitpool() { return 0; }
+  /// Changes the bitrate between two frames
+  virtual bool setBitpool(int bitpool) { return false; }
+  /// Defines the preferred configuration for the created stream endpoint
+  virtual void setupEndpoint(avdtp_stream_endpoint_t *endpoint) {}
+  /// encodeFrame() is supported: encoder() is not used
+  virtual bool isFrameEncoder() { return false; }
+  /// Encodes a single frame of PCM data directly into out: returns the
+  /// number of encoded bytes or -1 on error
+  virtual int encodeFrame(const uint8_t *pcm, int len, uint8_t *out,
+                          int outLen) {
+    return -1;
+  }
+  /// Checks if the configuration of an additional link can be served with
+  /// the same encoded frames: the bitpool range is narrowed to all links
+  virtual bool joinConfiguration(uint8_t *packet, uint16_t size) {
+    return false;
+  }
+  /// Checks if the frames of a received stream with the indicated
+  /// configuration can be sent without transcoding
+  virtual bool acceptsFrames(uint8_t *packet, uint16_t size) { return false; }
+  /// Prefers the configuration of a received stream for the next
+  /// negotiation, so that its frames can be sent without transcoding
+  virtual void preferConfiguration(uint8_t *packet, uint16_t size) {}
 };
 
 /**
@@ -65,6 +94,50 @@ class A2DPDecoder {
   virtual AudioInfo audioInfo() = 0;
   virtual avdtp_media_codec_type_t codecType() = 0;
   virtual bool isReconfigure() = 0;
+  virtual int frameLengthDecoded() = 0;
+  /// Attenuates the encoded frame by shift * 6 dB: returns false if this is
+  /// not supported for the frame
+  virtual bool scaleVolume(uint8_t *frame, int len, int shift) { return false; }
+  /// Max size of an encoded frame as it is stored in the jitter buffer
+  virtual int maxFrameLength() { return MAX_SBC_FRAME_SIZE; }
+
+  /// Extracts the encoded frames from the media payload (after the media
+  /// packet header): returns the number of frames of frameSize bytes which
+  /// start at frames. The default implementation handles the SBC media
+  /// payload header.
+  virtual int readFrames(uint8_t *payload, int size, uint8_t *&frames,
+                         int &frameSize) {
+    if (size < 1) return 0;
+    int num_frames = payload[0] & 0x0F;
+    if (num_frames == 0) return 0;
+    frames = payload + 1;
+    frameSize = (size - 1) / num_frames;
+    if ((size - 1) % num_frames != 0) {
+      LOGW("Invalid SBC payload: %d bytes for %d frames", size - 1,
+           num_frames);
+    }
+    return num_frames;
+  }
+};
+
+/**
+ * @brief Receives the encoded frames of the A2DP sink, so that they can be
+ * sent on without decoding (e.g. by the A2DPSource in a relay)
+ * @author Phil Schatzmann
+ */
+class A2DPFrameOutput {
+ public:
+  /// The configuration event of the received stream
+  virtual void setFrameConfiguration(uint8_t *packet, uint16_t size) = 0;
+  /// Writes frameCount encoded frames of frameSize bytes: returns false if
+  /// they are not accepted, so that they need to be decoded
+  virtual bool writeFrames(const uint8_t *frames, int frameCount,
+                           int frameSize) = 0;
+  /// The received stream was paused or closed
+  virtual void endFrames() = 0;
+  /// The volume (0 - 100) of the received stream: it is applied by the
+  /// receiver of the frames
+  virtual void setFrameVolume(int volumePercent) = 0;
 };
 
 /**
@@ -79,38 +152,8 @@ class A2DPEncoderSBC : public A2DPEncoder {
   int configSize() override { return sizeof(media_sbc_codec_configuration); }
 
   void setValues(uint16_t cid, uint8_t *packet, uint16_t size) override {
-    avdtp_channel_mode_t channel_mode;
-    uint8_t allocation_method;
-
-    sbc_config.reconfigure =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure(
-            packet);
-    sbc_config.num_channels =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_num_channels(
-            packet);
-    sbc_config.sampling_frequency =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_sampling_frequency(
-            packet);
-    sbc_config.block_length =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_block_length(
-            packet);
-    sbc_config.subbands =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_subbands(
-            packet);
-    sbc_config.min_bitpool_value =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_min_bitpool_value(
-            packet);
-    sbc_config.max_bitpool_value =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_max_bitpool_value(
-            packet);
-
-    channel_mode = (avdtp_channel_mode_t)
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_channel_mode(
-            packet);
-    allocation_method =
-        a2dp_subevent_signaling_media_codec_sbc_configuration_get_allocation_method(
-            packet);
-
+    read_values(packet, sbc_config);
+    limit_xq_bitpool(sbc_config);
     LOGI(
         "A2DP Source: Received SBC codec configuration, sampling "
         "frequency %u, a2dp_cid 0x%02x, local seid 0x%02x, remote seid "
@@ -120,28 +163,80 @@ class A2DPEncoderSBC : public A2DPEncoder {
             packet),
         a2dp_subevent_signaling_media_codec_sbc_configuration_get_remote_seid(
             packet));
+    dump();
+  }
 
-    // Adapt Bluetooth spec definition to SBC Encoder expected input
-    sbc_config.allocation_method =
-        (btstack_sbc_allocation_method_t)(allocation_method - 1);
-    switch (channel_mode) {
-      case AVDTP_CHANNEL_MODE_JOINT_STEREO:
-        sbc_config.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+  /// Defines the configuration without a configuration event (e.g. to
+  /// measure the encoder): call begin() afterwards
+  void setConfiguration(const media_codec_configuration_sbc_t &cfg) {
+    sbc_config = cfg;
+  }
+
+  /// The SBC frames can be shared if the sink was configured with the same
+  /// parameters (incl. the channel mode) and an overlapping bitpool range
+  bool joinConfiguration(uint8_t *packet, uint16_t size) override {
+    if (packet[2] != A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION)
+      return false;
+    media_codec_configuration_sbc_t cfg;
+    read_values(packet, cfg);
+    if (!is_same_format(cfg)) {
+      LOGW("A2DP Source: SBC configuration differs from the active stream");
+      cfg.dump();
+      return false;
+    }
+    int min_bitpool = btstack_max(cfg.min_bitpool_value,
+                                  sbc_config.min_bitpool_value);
+    int max_bitpool = btstack_min(cfg.max_bitpool_value,
+                                  sbc_config.max_bitpool_value);
+    if (min_bitpool > max_bitpool) {
+      LOGW("A2DP Source: SBC bitpool ranges do not overlap");
+      return false;
+    }
+    sbc_config.min_bitpool_value = min_bitpool;
+    sbc_config.max_bitpool_value = max_bitpool;
+    LOGI("A2DP Source: shared SBC stream with bitpool [%d, %d]", min_bitpool,
+         max_bitpool);
+    return true;
+  }
+
+  /// The received SBC frames can be sent as they are if the stream uses the
+  /// same parameters and an overlapping bitpool range: the bitpool of each
+  /// frame is checked when it is sent
+  bool acceptsFrames(uint8_t *packet, uint16_t size) override {
+    if (packet[2] != A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION)
+      return false;
+    media_codec_configuration_sbc_t cfg;
+    read_values(packet, cfg);
+    return is_same_format(cfg) &&
+           cfg.min_bitpool_value <= sbc_config.max_bitpool_value &&
+           cfg.max_bitpool_value >= sbc_config.min_bitpool_value;
+  }
+
+  /// Selects the sample rate and channel mode (mono, dual channel, stereo or
+  /// joint stereo) of the received stream for the stream endpoints
+  void preferConfiguration(uint8_t *packet, uint16_t size) override {
+    if (packet[2] != A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION)
+      return;
+    media_codec_configuration_sbc_t cfg;
+    read_values(packet, cfg);
+    uint8_t channel_mode = AVDTP_SBC_JOINT_STEREO;
+    switch (cfg.channel_mode) {
+      case SBC_CHANNEL_MODE_JOINT_STEREO:
+        channel_mode = AVDTP_SBC_JOINT_STEREO;
         break;
-      case AVDTP_CHANNEL_MODE_STEREO:
-        sbc_config.channel_mode = SBC_CHANNEL_MODE_STEREO;
+      case SBC_CHANNEL_MODE_MONO:
+        channel_mode = AVDTP_SBC_MONO;
         break;
-      case AVDTP_CHANNEL_MODE_DUAL_CHANNEL:
-        sbc_config.channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
+      case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+        channel_mode = AVDTP_SBC_DUAL_CHANNEL;
         break;
-      case AVDTP_CHANNEL_MODE_MONO:
-        sbc_config.channel_mode = SBC_CHANNEL_MODE_MONO;
+      case SBC_CHANNEL_MODE_STEREO:
+        channel_mode = AVDTP_SBC_STEREO;
         break;
       default:
-        btstack_assert(false);
         break;
     }
-    dump();
+    setPreferred(cfg.sampling_frequency, channel_mode);
   }
 
   void begin() override {
@@ -150,6 +245,23 @@ class A2DPEncoderSBC : public A2DPEncoder {
     sbc_codec.setBitpool(sbc_config.max_bitpool_value);
     sbc_codec.setBlocks(sbc_config.block_length);
     sbc_codec.setAllocationMethod(sbc_config.allocation_method);
+    begin_frame_encoder();
+  }
+
+  /// We call libsbc directly, so that each frame is encoded from the PCM
+  /// buffer into the media packet without any intermediate buffer
+  bool isFrameEncoder() override { return is_sbc_active; }
+
+  int encodeFrame(const uint8_t *pcm, int len, uint8_t *out,
+                  int outLen) override {
+    if (!is_sbc_active) return -1;
+    ssize_t written = 0;
+    ssize_t consumed = sbc_encode(&sbc, pcm, len, out, outLen, &written);
+    if (consumed != len) {
+      LOGE("sbc_encode: %d of %d bytes", (int)consumed, len);
+      return -1;
+    }
+    return written;
   }
 
   uint8_t *codecCapabilities() override { return media_sbc_codec_capabilities; }
@@ -157,8 +269,14 @@ class A2DPEncoderSBC : public A2DPEncoder {
     return sizeof(media_sbc_codec_capabilities);
   }
   AudioEncoder &encoder() override { return sbc_codec; }
-  int frameLengthEncoded() override { return sbc_codec.bytesCompressed(); };
-  int frameLengthDecoded() override { return sbc_codec.bytesUncompressed(); };
+  int frameLengthEncoded() override {
+    return is_sbc_active ? sbc_get_frame_length(&sbc)
+                         : sbc_codec.bytesCompressed();
+  };
+  int frameLengthDecoded() override {
+    return is_sbc_active ? sbc_get_codesize(&sbc)
+                         : sbc_codec.bytesUncompressed();
+  };
   AudioInfo audioInfo() override {
     AudioInfo info;
     info.bits_per_sample = 16;
@@ -169,20 +287,214 @@ class A2DPEncoderSBC : public A2DPEncoder {
 
   avdtp_media_codec_type_t codecType() { return AVDTP_CODEC_SBC; }
 
+  /// Limits the advertised sample rates (e.g. AVDTP_SBC_44100 |
+  /// AVDTP_SBC_48000) and channel modes (e.g. AVDTP_SBC_JOINT_STEREO)
+  void setCapabilities(uint8_t sampleRates, uint8_t channelModes) {
+    media_sbc_codec_capabilities[0] =
+        ((sampleRates & 0x0F) << 4) | (channelModes & 0x0F);
+  }
+
+  /// Defines the configuration that is selected if the sink supports it:
+  /// the sample rate in Hz (e.g. 48000 if the input runs natively at 48 kHz)
+  /// and the channel mode (e.g. AVDTP_SBC_JOINT_STEREO)
+  void setPreferred(int sampleRate, uint8_t channelMode) {
+    preferred_sample_rate = sampleRate;
+    preferred_channel_mode = channelMode;
+    // the endpoints which already exist use it for the next negotiation
+    for (int j = 0; j < endpoint_count; j++) apply_preferred(endpoints[j]);
+  }
+
+  /// SBC XQ: prefers dual channel, where the bitpool applies to each
+  /// channel, and limits it to maxBitpool (38: 452 kbps at 44.1 kHz). Sinks
+  /// without dual channel keep joint stereo with the standard bitpool range.
+  /// Call before begin().
+  void setHighQuality(bool active, int maxBitpool = SBC_XQ_MAX_BITPOOL) {
+    // 128 is the limit for dual channel with 8 subbands
+    if (maxBitpool > 128) maxBitpool = 128;
+    if (maxBitpool < 2) maxBitpool = 2;
+    xq_max_bitpool = active ? maxBitpool : 0;
+    setPreferred(preferred_sample_rate,
+                 active ? AVDTP_SBC_DUAL_CHANNEL : AVDTP_SBC_JOINT_STEREO);
+  }
+
+  void setupEndpoint(avdtp_stream_endpoint_t *endpoint) override {
+    if (endpoint_count < A2DP_MAX_LINKS) endpoints[endpoint_count++] = endpoint;
+    apply_preferred(endpoint);
+  }
+
+  /// The analysis filter of SBC spans 10 blocks of subbands samples
+  int delaySamples() override { return 10 * sbc_config.subbands; }
+
+  int minBitpool() override { return sbc_config.min_bitpool_value; }
+
+  int maxBitpool() override { return sbc_config.max_bitpool_value; }
+
+  /// Restarts the encoder with the new bitpool: no renegotiation is needed
+  /// because the bitpool is signaled in each frame header
+  bool setBitpool(int bitpool) override {
+    if (bitpool < sbc_config.min_bitpool_value ||
+        bitpool > sbc_config.max_bitpool_value)
+      return false;
+    // libsbc picks up the new bitpool with the next frame
+    if (is_sbc_active) {
+      sbc.bitpool = bitpool;
+      return true;
+    }
+    sbc_codec.setBitpool(bitpool);
+    return sbc_codec.begin();
+  }
+
  protected:
   uint8_t media_sbc_codec_configuration[4];
   media_codec_configuration_sbc_t sbc_config;
   SBCEncoder sbc_codec;
+  int preferred_sample_rate = 44100;
+  uint8_t preferred_channel_mode = AVDTP_SBC_JOINT_STEREO;
+  avdtp_stream_endpoint_t *endpoints[A2DP_MAX_LINKS];
+  int endpoint_count = 0;
+  int xq_max_bitpool = 0;
+  sbc_t sbc;
+  bool is_sbc_active = false;
+
+  void apply_preferred(avdtp_stream_endpoint_t *endpoint) {
+    if (preferred_sample_rate > 0)
+      avdtp_set_preferred_sampling_frequency(endpoint, preferred_sample_rate);
+    if (preferred_channel_mode > 0)
+      avdtp_set_preferred_channel_mode(endpoint, preferred_channel_mode);
+  }
+
+  /// With SBC XQ the negotiated dual channel bitpool range is limited to the
+  /// XQ bitrate: the sinks report the same max bitpool for all channel modes
+  void limit_xq_bitpool(media_codec_configuration_sbc_t &cfg) {
+    if (xq_max_bitpool == 0 ||
+        cfg.channel_mode != SBC_CHANNEL_MODE_DUAL_CHANNEL)
+      return;
+    cfg.max_bitpool_value = btstack_max(
+        cfg.min_bitpool_value, btstack_min(cfg.max_bitpool_value,
+                                           xq_max_bitpool));
+  }
+
+  /// Same SBC parameters (except for the bitpool)
+  bool is_same_format(media_codec_configuration_sbc_t &cfg) {
+    return cfg.num_channels == sbc_config.num_channels &&
+           cfg.sampling_frequency == sbc_config.sampling_frequency &&
+           cfg.block_length == sbc_config.block_length &&
+           cfg.subbands == sbc_config.subbands &&
+           cfg.channel_mode == sbc_config.channel_mode &&
+           cfg.allocation_method == sbc_config.allocation_method;
+  }
+
+  /// Reads the configuration from the SBC configuration event
+  void read_values(uint8_t *packet, media_codec_configuration_sbc_t &cfg) {
+    cfg.reconfigure =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure(
+            packet);
+    cfg.num_channels =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_num_channels(
+            packet);
+    cfg.sampling_frequency =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_sampling_frequency(
+            packet);
+    cfg.block_length =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_block_length(
+            packet);
+    cfg.subbands =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_subbands(
+            packet);
+    cfg.min_bitpool_value =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_min_bitpool_value(
+            packet);
+    cfg.max_bitpool_value =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_max_bitpool_value(
+            packet);
+
+    avdtp_channel_mode_t channel_mode = (avdtp_channel_mode_t)
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_channel_mode(
+            packet);
+    uint8_t allocation_method =
+        a2dp_subevent_signaling_media_codec_sbc_configuration_get_allocation_method(
+            packet);
+
+    // Adapt Bluetooth spec definition to SBC Encoder expected input
+    cfg.allocation_method =
+        (btstack_sbc_allocation_method_t)(allocation_method - 1);
+    switch (channel_mode) {
+      case AVDTP_CHANNEL_MODE_JOINT_STEREO:
+        cfg.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+        break;
+      case AVDTP_CHANNEL_MODE_STEREO:
+        cfg.channel_mode = SBC_CHANNEL_MODE_STEREO;
+        break;
+      case AVDTP_CHANNEL_MODE_DUAL_CHANNEL:
+        cfg.channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
+        break;
+      case AVDTP_CHANNEL_MODE_MONO:
+        cfg.channel_mode = SBC_CHANNEL_MODE_MONO;
+        break;
+      default:
+        btstack_assert(false);
+        cfg.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+        break;
+    }
+  }
 
   uint8_t media_sbc_codec_capabilities[4] = {
-      // // we support all configurations with bitpool 2-53
-      (AVDTP_SBC_44100 << 4) | AVDTP_SBC_STEREO,
-      0xFF,  //(AVDTP_SBC_BLOCK_LENGTH_16 << 4) | (AVDTP_SBC_SUBBANDS_8 << 2) |
-             // AVDTP_SBC_ALLOCATION_METHOD_LOUDNESS,
-      2, 53};
+      // all sample rates and channel modes: libsbc encodes all of them, but
+      // joint stereo stays preferred because with dual channel the bitpool
+      // applies per channel, which doubles the bitrate
+      ((AVDTP_SBC_48000 | AVDTP_SBC_44100 | AVDTP_SBC_32000 | AVDTP_SBC_16000)
+       << 4) |
+          AVDTP_SBC_MONO | AVDTP_SBC_DUAL_CHANNEL | AVDTP_SBC_STEREO |
+          AVDTP_SBC_JOINT_STEREO,
+      0xFF,  // all block lengths, subbands and allocation methods
+      2, SBC_MAX_BITPOOL};
 
   void dump() { sbc_config.dump(); };
 
+  /// Sets up libsbc with the negotiated configuration (incl. the channel
+  /// mode, which can not be selected in the SBCEncoder)
+  void begin_frame_encoder() {
+    if (is_sbc_active) sbc_finish(&sbc);
+    is_sbc_active = sbc_init(&sbc, 0) == 0;
+    if (!is_sbc_active) {
+      LOGE("sbc_init");
+      return;
+    }
+    switch (sbc_config.sampling_frequency) {
+      case 16000:
+        sbc.frequency = SBC_FREQ_16000;
+        break;
+      case 32000:
+        sbc.frequency = SBC_FREQ_32000;
+        break;
+      case 48000:
+        sbc.frequency = SBC_FREQ_48000;
+        break;
+      default:
+        sbc.frequency = SBC_FREQ_44100;
+        break;
+    }
+    switch (sbc_config.channel_mode) {
+      case SBC_CHANNEL_MODE_MONO:
+        sbc.mode = SBC_MODE_MONO;
+        break;
+      case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+        sbc.mode = SBC_MODE_DUAL_CHANNEL;
+        break;
+      case SBC_CHANNEL_MODE_STEREO:
+        sbc.mode = SBC_MODE_STEREO;
+        break;
+      default:
+        sbc.mode = SBC_MODE_JOINT_STEREO;
+        break;
+    }
+    sbc.blocks = (sbc_config.block_length / 4) - 1;  // SBC_BLK_4 - SBC_BLK_16
+    sbc.subbands = sbc_config.subbands == 4 ? SBC_SB_4 : SBC_SB_8;
+    sbc.allocation =
+        sbc_config.allocation_method == SBC_SNR ? SBC_AM_SNR : SBC_AM_LOUDNESS;
+    sbc.bitpool = sbc_config.max_bitpool_value;
+    sbc.endian = SBC_LE;
+  }
 };
 
 /**
@@ -203,8 +515,45 @@ class A2DPDecoderSBC : public A2DPDecoder {
 
   avdtp_media_codec_type_t codecType() { return AVDTP_CODEC_SBC; }
 
+  /// Limits the advertised sample rates (e.g. AVDTP_SBC_48000 if the output
+  /// runs natively at 48 kHz) and channel modes: the source selects the
+  /// configuration from these
+  void setCapabilities(uint8_t sampleRates, uint8_t channelModes) {
+    media_sbc_codec_capabilities[0] =
+        ((sampleRates & 0x0F) << 4) | (channelModes & 0x0F);
+  }
+
   bool isReconfigure() override { return sbc_config.reconfigure; }
 
+  /// PCM bytes of a decoded SBC frame
+  int frameLengthDecoded() override {
+    return sbc_config.block_length * sbc_config.subbands *
+           sbc_config.num_channels * sizeof(int16_t);
+  }
+
+  /// Max SBC frame size of the negotiated configuration: with dual channel
+  /// the bitpool applies to each channel (bitpool 53: 224 bytes)
+  int maxFrameLength() override {
+    int channels = sbc_config.num_channels;
+    int subbands = sbc_config.subbands;
+    int blocks = sbc_config.block_length;
+    int bitpool = sbc_config.max_bitpool_value;
+    int data_bits = blocks * bitpool;
+    switch (sbc_config.channel_mode) {
+      case SBC_CHANNEL_MODE_MONO:
+      case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+        data_bits = blocks * channels * bitpool;
+        break;
+      case SBC_CHANNEL_MODE_JOINT_STEREO:
+        data_bits = subbands + blocks * bitpool;
+        break;
+      default:
+        break;
+    }
+    int len = 4 + (4 * subbands * channels) / 8 + (data_bits + 7) / 8;
+    return btstack_max(len, MAX_SBC_FRAME_SIZE);
+  }
+
   void setValues(uint8_t *packet, uint16_t size) override {
     LOGI("A2DP  Sink      : Received SBC codec configuration");
     uint8_t allocation_method;
@@ -255,11 +604,18 @@ class A2DPDecoderSBC : public A2DPDecoder {
         break;
       default:
         btstack_assert(false);
+        sbc_config.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
         break;
     }
     dump();
   }
 
+  /// Defines the configuration without a configuration event (e.g. to
+  /// measure the decoder)
+  void setConfiguration(const media_codec_configuration_sbc_t &cfg) {
+    sbc_config = cfg;
+  }
+
   AudioInfo audioInfo() override {
     AudioInfo info;
     info.bits_per_sample = 16;
@@ -268,18 +624,84 @@ class A2DPDecoderSBC : public A2DPDecoder {
     return info;
   }
 
+  /**
+   * @brief Attenuates the frame in the compressed domain: each scale factor
+   * step is 6 dB, so we just subtract shift from all scale factors and
+   * update the CRC. With the SNR allocation the bit allocation only depends
+   * on the differences of the scale factors, so it stays the same if no
+   * scale factor gets negative. With the loudness allocation it would
+   * change, so these frames are left untouched.
+   */
+  bool scaleVolume(uint8_t *frame, int len, int shift) override {
+    if (shift <= 0) return true;
+    if (len < 4 || frame[0] != SBC_FRAME_SYNCWORD) return false;
+    int channel_mode = (frame[1] >> 2) & 0x03;
+    bool is_snr = (frame[1] >> 1) & 0x01;
+    int subbands = (frame[1] & 0x01) ? 8 : 4;
+    int channels = channel_mode == SBC_MODE_MONO ? 1 : 2;
+    if (!is_snr) return false;
+
+    int join_bits = channel_mode == SBC_MODE_JOINT_STEREO ? subbands : 0;
+    int scf_count = channels * subbands;
+    int crc_bits = 16 + join_bits + scf_count * 4;
+    if (len < 4 + (join_bits + scf_count * 4 + 7) / 8) return false;
+    if (crc8(frame, crc_bits) != frame[3]) return false;
+
+    // the scale factors are nibble aligned
+    int scf_pos = 32 + join_bits;
+    for (int j = 0; j < scf_count; j++) {
+      if (get_nibble(frame, scf_pos + j * 4) < shift) return false;
+    }
+    for (int j = 0; j < scf_count; j++) {
+      int pos = scf_pos + j * 4;
+      set_nibble(frame, pos, get_nibble(frame, pos) - shift);
+    }
+    frame[3] = crc8(frame, crc_bits);
+    return true;
+  }
+
  protected:
+  // the channel modes in the frame header are the SBC_MODE_* of sbc.h
+  static const uint8_t SBC_FRAME_SYNCWORD = 0x9C;
+
   uint8_t media_sbc_codec_configuration[4];
   media_codec_configuration_sbc_t sbc_config;
   SBCDecoder sbc_codec;
   // // we support all configurations with bitpool 2-53
   uint8_t media_sbc_codec_capabilities[4] = {
-      (AVDTP_SBC_44100 << 4) | AVDTP_SBC_STEREO,
-      0xFF,  //(AVDTP_SBC_BLOCK_LENGTH_16 << 4) | (AVDTP_SBC_SUBBANDS_8 << 2) |
-             // AVDTP_SBC_ALLOCATION_METHOD_LOUDNESS,
-      2, 53};
+      // all sample rates and channel modes: the decoder takes them from the
+      // frame header
+      0xFF,
+      0xFF,  // all block lengths, subbands and allocation methods
+      2, SBC_MAX_BITPOOL};
 
   void dump() { sbc_config.dump(); };
+
+  int get_nibble(uint8_t *frame, int bitPos) {
+    uint8_t value = frame[bitPos / 8];
+    return bitPos % 8 == 0 ? value >> 4 : value & 0x0F;
+  }
+
+  void set_nibble(uint8_t *frame, int bitPos, int value) {
+    uint8_t &byte = frame[bitPos / 8];
+    byte = bitPos % 8 == 0 ? (byte & 0x0F) | (value << 4)
+                           : (byte & 0xF0) | (value & 0x0F);
+  }
+
+  /// SBC CRC-8 (polynomial 0x1D, initial value 0x0F) over the header bytes 1
+  /// and 2 followed by the bits after the CRC field
+  uint8_t crc8(const uint8_t *frame, int bits) {
+    uint8_t crc = 0x0F;
+    for (int j = 0; j < bits; j++) {
+      int byte_idx = j / 8;
+      uint8_t value = byte_idx < 2 ? frame[byte_idx + 1] : frame[byte_idx + 2];
+      int bit = (value >> (7 - j % 8)) & 0x01;
+      bool feedback = ((crc >> 7) & 0x01) ^ bit;
+      crc = crc << 1;
+      if (feedback) crc ^= 0x1D;
+    }
+    return crc;
+  }
 };
 
 }  // namespace btstack_a2dp
\ No newline at end of file
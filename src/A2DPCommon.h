@@ -29,6 +29,8 @@
 #include "AudioTools.h"
 #include "AudioTools/AudioCodecs/CodecSBC.h"
 #include "A2DPCodecs.h"
+#include "A2DPCodecRegistry.h"
+#include "A2DPVolume.h"
 
 // #define BYTES_PER_FRAME     (2*NUM_CHANNELS)
 // #define BYTES_PER_AUDIO_SAMPLE (2 * NUM_CHANNELS)
@@ -48,6 +50,7 @@ enum MetadataType {
   MDSongPos
 };
 
+class A2DPStackClass;
 
 /**
  * @brief Common A2DP functionality
@@ -71,8 +74,12 @@ class A2DPCommon {
       volume_percentage = 0;
     }
     // Request update from target
-    avrcp_target_volume_changed(get_avrcp_cid(),
-                                percent_to_volume(volume_percentage));
+    uint16_t cids[A2DP_MAX_LINKS];
+    int count = get_avrcp_cids(cids, A2DP_MAX_LINKS);
+    for (int j = 0; j < count; j++) {
+      avrcp_target_volume_changed(cids[j],
+                                  percent_to_volume(volume_percentage));
+    }
 
     // update volume stream
     avrcp_volume_changed(volume_percentage);
@@ -91,42 +98,42 @@ class A2DPCommon {
   /// avrcp play
   bool play() {
     TRACEI();
-    return ERROR_CODE_SUCCESS == avrcp_controller_play(get_avrcp_cid());
+    return avrcp_controller_command(avrcp_controller_play);
   }
 
   /// avrcp stop
   bool stop() {
     TRACEI();
-    return ERROR_CODE_SUCCESS == avrcp_controller_stop(get_avrcp_cid());
+    return avrcp_controller_command(avrcp_controller_stop);
   }
 
   /// avrcp pause
   bool pause() {
     TRACEI();
-    return ERROR_CODE_SUCCESS == avrcp_controller_pause(get_avrcp_cid());
+    return avrcp_controller_command(avrcp_controller_pause);
   }
 
   /// avrcp forward
   bool next() {
     TRACEI();
-    return ERROR_CODE_SUCCESS == avrcp_controller_forward(get_avrcp_cid());
+    return avrcp_controller_command(avrcp_controller_forward);
   }
 
   /// avrcp backward
   bool previous() {
     TRACEI();
-    return ERROR_CODE_SUCCESS == avrcp_controller_backward(get_avrcp_cid());
+    return avrcp_controller_command(avrcp_controller_backward);
   }
 
   /// avrcp fast_forwar
   bool fastForward(bool start) {
     TRACEI();
     if (start) {
-      return ERROR_CODE_SUCCESS ==
-             avrcp_controller_press_and_hold_fast_forward(get_avrcp_cid());
+      return avrcp_controller_command(
+          avrcp_controller_press_and_hold_fast_forward);
     } else {
-      return ERROR_CODE_SUCCESS ==
-             avrcp_controller_release_press_and_hold_cmd(get_avrcp_cid());
+      return avrcp_controller_command(
+          avrcp_controller_release_press_and_hold_cmd);
     }
   }
 
@@ -134,12 +141,10 @@ class A2DPCommon {
   bool rewind(bool start) {
     TRACEI();
     if (start) {
-      return ERROR_CODE_SUCCESS ==
-             avrcp_controller_press_and_hold_rewind(get_avrcp_cid());
-
+      return avrcp_controller_command(avrcp_controller_press_and_hold_rewind);
     } else {
-      return ERROR_CODE_SUCCESS ==
-             avrcp_controller_release_press_and_hold_cmd(get_avrcp_cid());
+      return avrcp_controller_command(
+          avrcp_controller_release_press_and_hold_cmd);
     }
   }
 
@@ -166,10 +171,8 @@ class A2DPCommon {
  operator bool() { return is_active; }
 
  protected:
-#if defined(RP2040_HOWER)
-  BluetoothHCI _hci;
-#endif
-  VolumeStream volume_stream;
+  friend class A2DPStackClass;
+  A2DPVolume volume_control;
   int volume_percentage = 100;
   bool is_active = false;
   bool is_playing = false;
@@ -179,9 +182,70 @@ class A2DPCommon {
 
   virtual int get_avrcp_cid() = 0;
 
+  /// AVRCP connections which receive the commands: the sink sends them to
+  /// the active phone
+  virtual int get_avrcp_cids(uint16_t *cids, int max) {
+    int cid = get_avrcp_cid();
+    if (cid == 0 || max < 1) return 0;
+    cids[0] = cid;
+    return 1;
+  }
+
+  /// Sends the AVRCP controller command to all connections: false if there
+  /// is no connection or if a command fails
+  bool avrcp_controller_command(uint8_t (*command)(uint16_t)) {
+    uint16_t cids[A2DP_MAX_LINKS];
+    int count = get_avrcp_cids(cids, A2DP_MAX_LINKS);
+    bool result = count > 0;
+    for (int j = 0; j < count; j++) {
+      if (command(cids[j]) != ERROR_CODE_SUCCESS) result = false;
+    }
+    return result;
+  }
+
+  /// Sink or source: the A2DP events of BTstack are separate for each role
+  virtual bool isSink() = 0;
+
+  /// Determines if the A2DP connection belongs to this object
+  virtual bool hasConnection(uint16_t a2dpCid) = 0;
+
+  /// Determines if there is an A2DP connection to the device
+  virtual bool hasAddress(bd_addr_t address) = 0;
+
+  /// Determines if the local stream endpoint belongs to this object
+  virtual bool hasSeid(uint8_t localSeid) = 0;
+
+  /// Determines if a new connection can be accepted
+  virtual bool acceptsConnection() = 0;
+
+  /// Max number of AVDTP and AVRCP connections of this object
+  virtual int maxConnections() = 0;
+
+  /// Number of stream endpoints which are created by this object
+  virtual int streamEndpointCount() = 0;
+
+  /// Number of paired devices whose link keys are kept by this object
+  virtual int linkKeyCount() = 0;
+
+  virtual void hci_packet_handler(uint8_t packet_type, uint16_t channel,
+                                  uint8_t *packet, uint16_t size) {}
+
+  virtual void a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
+                                   uint8_t *packet, uint16_t size) {}
+
+  virtual void handle_l2cap_media_data_packet(uint8_t seid, uint8_t *packet,
+                                              uint16_t size) {}
+
+  virtual void avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
+                                    uint8_t *packet, uint16_t size) {}
+
+  virtual void avrcp_target_packet_handler(uint8_t packet_type,
+                                           uint16_t channel, uint8_t *packet,
+                                           uint16_t size) {}
+
   virtual void set_playing(bool playing) { is_playing = playing; }
 
-  int percent_to_volume(int percent) { return volume_percentage * 127 / 100; }
+  int percent_to_volume(int percent) { return percent * 127 / 100; }
 
   int volume_to_percent(int volume) { return volume * 100 / 127; }
 
@@ -213,11 +277,13 @@ class A2DPCommon {
     memset(avrcp_subevent_value, 0, sizeof(avrcp_subevent_value));
     switch (packet[2]) {
       case AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED: {
-        int vol = volume_to_percent(
+        uint8_t vol =
             avrcp_subevent_notification_volume_changed_get_absolute_volume(
-                packet));
-        LOGI("AVRCP Controller: Notification Absolute Volume %d %%", vol);
-        avrcp_volume_changed(vol);
+                packet);
+        volume_percentage = volume_to_percent(vol);
+        LOGI("AVRCP Controller: Notification Absolute Volume %d %%",
+             volume_percentage);
+        avrcp_absolute_volume_changed(vol);
       } break;
       case AVRCP_SUBEVENT_NOTIFICATION_EVENT_BATT_STATUS_CHANGED:
         // see avrcp_battery_status_t
@@ -398,16 +464,15 @@ class A2DPCommon {
 
   // volume is from 0 to 100
   void avrcp_volume_changed(uint8_t volume) {
-    // calculate eff volume factor
-    // float max_current = get_max_input_amplitude();
-    // float max_factor = 32767.0f / max_current;
-    // float vol_float = volume_as_float(volume_percentage);
-    // We adjust the volume: if we receive only max amplitude of 2500 we can
-    // multiply the values by a factor of 13
-    float factor = mapFloat(volume, 0.0, 100.0, 0.0, 1.0);
-    LOGI("avrcp_volume_changed: %d -> %f", volume, factor);
-    // adjust volume
-    volume_stream.setVolume(factor);
+    // map the percentage to the AVRCP absolute volume
+    avrcp_absolute_volume_changed(percent_to_volume(volume));
+  }
+
+  // AVRCP absolute volume from 0 to 127
+  void avrcp_absolute_volume_changed(uint8_t volume) {
+    volume_control.setVolume(volume);
+    LOGI("avrcp_absolute_volume_changed: %d -> gain %d", volume,
+         (int)volume_control.gain());
   }
 };
 
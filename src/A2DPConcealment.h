@@ -0,0 +1,155 @@
+/**
+ * @file A2DPConcealment.h
+ * @author Phil Schatzmann
+ * @brief Packet loss concealment for the decoded PCM data
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPConfig.h"
+#include "AudioTools.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief Packet loss concealment which is placed between the decoder and
+ * the volume control: the decoded PCM data is passed on unchanged and the
+ * last frame is kept. For each lost frame the last frame is repeated with a
+ * decaying gain and the first frame after the loss is overlap-added with the
+ * continuation of the concealment signal, so that there are no clicks.
+ * All calculations are done in Q15 fixed point.
+ * @author Phil Schatzmann
+ */
+class A2DPConcealment : public AudioOutput {
+ public:
+  /// Defines the output of the PCM data
+  void setOutput(Print &out) { p_out = &out; }
+
+  /// Starts the processing: frameSamples is the number of samples per
+  /// channel of a decoded frame
+  bool begin(AudioInfo info, int frameSamples) {
+    setAudioInfo(info);
+    channels = info.channels;
+    history_len = frameSamples * channels;
+    history.resize(history_len);
+    memset(history.data(), 0, history_len * sizeof(int16_t));
+    history_pos = 0;
+    gain = Q15_ONE;
+    overlap_remaining = 0;
+    is_history_valid = false;
+    return true;
+  }
+
+  void end() override {
+    history.resize(0);
+    history_len = 0;
+    history_pos = 0;
+    is_history_valid = false;
+  }
+
+  /// Passes the decoded PCM data on and records it as history
+  size_t write(const uint8_t *data, size_t len) override {
+    if (p_out == nullptr) return 0;
+    if (history_len == 0) return p_out->write(data, len);
+    const int16_t *samples = (const int16_t *)data;
+    int sample_count = len / sizeof(int16_t);
+    int pos = 0;
+
+    // crossfade from the concealment signal to the received signal
+    if (overlap_remaining > 0) {
+      int16_t mixed[CONCEALMENT_OVERLAP_SAMPLES * NUM_CHANNELS];
+      int overlap_len = CONCEALMENT_OVERLAP_SAMPLES * channels;
+      int n = 0;
+      while (overlap_remaining > 0 && pos < sample_count &&
+             n < (int)(sizeof(mixed) / sizeof(int16_t))) {
+        int32_t weight = (int32_t)(overlap_len - overlap_remaining) * Q15_ONE /
+                         overlap_len;
+        int32_t conceal = (int32_t)next_history_sample() * gain >> 15;
+        mixed[n++] = (int16_t)((samples[pos] * weight +
+                                conceal * (Q15_ONE - weight)) >> 15);
+        pos++;
+        overlap_remaining--;
+      }
+      p_out->write((const uint8_t *)mixed, n * sizeof(int16_t));
+    }
+    if (pos < sample_count) {
+      p_out->write((const uint8_t *)(samples + pos),
+                   (sample_count - pos) * sizeof(int16_t));
+    }
+
+    record_history(samples, sample_count);
+    gain = Q15_ONE;
+    return len;
+  }
+
+  /// Outputs frameCount synthesized frames as replacement for lost frames
+  void conceal(int frameCount) {
+    if (p_out == nullptr || history_len == 0) return;
+    int16_t buffer[CONCEALMENT_OVERLAP_SAMPLES * NUM_CHANNELS];
+    int buffer_len = sizeof(buffer) / sizeof(int16_t);
+    for (int frame = 0; frame < frameCount; frame++) {
+      // ramp the gain down over the frame
+      int32_t start_gain = gain;
+      int32_t end_gain = is_history_valid
+                             ? (gain * CONCEALMENT_DECAY_Q15) >> 15
+                             : 0;
+      int n = 0;
+      for (int j = 0; j < history_len; j++) {
+        int32_t sample_gain =
+            start_gain + (end_gain - start_gain) * j / history_len;
+        buffer[n++] = (int16_t)((next_history_sample() * sample_gain) >> 15);
+        if (n == buffer_len) {
+          p_out->write((const uint8_t *)buffer, n * sizeof(int16_t));
+          n = 0;
+        }
+      }
+      if (n > 0) p_out->write((const uint8_t *)buffer, n * sizeof(int16_t));
+      gain = end_gain;
+      concealed_frames++;
+    }
+    overlap_remaining = CONCEALMENT_OVERLAP_SAMPLES * channels;
+  }
+
+  /// Number of frames which were synthesized
+  uint32_t concealedFrames() { return concealed_frames; }
+
+ protected:
+  static const int32_t Q15_ONE = 32767;
+  Print *p_out = nullptr;
+  Vector<int16_t> history;
+  int history_len = 0;
+  int history_pos = 0;
+  int channels = NUM_CHANNELS;
+  int32_t gain = Q15_ONE;
+  int overlap_remaining = 0;
+  bool is_history_valid = false;
+  uint32_t concealed_frames = 0;
+
+  /// Provides the history as endless loop
+  int16_t next_history_sample() {
+    int16_t result = history[history_pos];
+    history_pos = (history_pos + 1) % history_len;
+    return result;
+  }
+
+  /// Keeps the last history_len samples: the repetition starts with the
+  /// oldest one
+  void record_history(const int16_t *samples, int sampleCount) {
+    if (sampleCount >= history_len) {
+      memcpy(history.data(), samples + sampleCount - history_len,
+             history_len * sizeof(int16_t));
+    } else {
+      memmove(history.data(), history.data() + sampleCount,
+              (history_len - sampleCount) * sizeof(int16_t));
+      memcpy(history.data() + history_len - sampleCount, samples,
+             sampleCount * sizeof(int16_t));
+    }
+    history_pos = 0;
+    is_history_valid = true;
+  }
+};
+
+}  // namespace btstack_a2dp
@@ -27,6 +27,9 @@
 #define BTSTACK_FILE__ "btstack_a2dp"
 #define AVRCP_BROWSING_ENABLED
 #define NUM_CHANNELS 2
+#define VOLUME_RAMP_FRAMES 256
+#define A2DP_MAX_CODECS MAX_NR_AVDTP_STREAM_ENDPOINTS
+#define A2DP_MAX_LINKS MAX_NR_AVDTP_CONNECTIONS
 
 #define ENABLE_LOG_INFO
 #define ENABLE_LOG_ERROR
@@ -38,10 +41,49 @@
 #define OPTIMAL_FRAMES_MAX 40
 #define ADDITIONAL_FRAMES 20
 #define MAX_SBC_FRAME_SIZE 120
+// dual channel with bitpool 53
+#define MAX_SBC_DUAL_FRAME_SIZE 224
+#define MAX_AAC_FRAME_SIZE 1024
+#define JITTER_BUFFER_FACTOR 3
+#define SINK_PLAYBACK_TIMEOUT_MS 5
+#define MAX_CONCEALED_FRAMES 20
+#define CONCEALMENT_OVERLAP_SAMPLES 32
+#define CONCEALMENT_DECAY_Q15 16384
+#define DRIFT_MAX_PPM 1000
+#define DRIFT_KP_PPM 100
+#define DRIFT_KI_PPM 1
+#define DRIFT_UPDATE_FRAMES 100
+#define SINK_DELAY_REPORT_INTERVAL_MS 1000
+#define SINK_DELAY_REPORT_MIN_CHANGE_US 2000
+#define SINK_CONFIG_EVENT_SIZE 64
+// phones which are kept connected (max A2DP_MAX_LINKS): the other AVDTP
+// connections stay available for the source, e.g. in a relay
+#define SINK_MAX_LINKS 2
 //#define ENABLE_AVDTP_ACCEPTOR_EXPLICIT_START_STREAM_CONFIRMATION
 
 // Source
 #define MAX_AMPLITUDE_INPUT 32767
 #define AUDIO_TIMEOUT_MS 10
+#define SOURCE_PREROLL_MS 50
+#define SOURCE_MAX_CATCHUP_MS 100
+#define SOURCE_INPUT_TIMEOUT_MS 20
+// speakers which are reconnected without inquiry: persisted with BTstack TLV
+#define SOURCE_MAX_KNOWN_SINKS 4
+#define SOURCE_KNOWN_SINKS_TAG 0x41325350  // 'A2SP'
+// page timeout for the reconnect to a known speaker
+#define SOURCE_PAGE_TIMEOUT_MS 2560
+#define SBC_MAX_BITPOOL 53
+#define SBC_XQ_MAX_BITPOOL 38
+// 8 frames of 119 bytes (bitpool 53) or 6 of 164 bytes (XQ dual channel
+// bitpool 38)
 #define SBC_STORAGE_SIZE 1030
 #define SBC_PACKET_COUNT 5
+#define A2DP_MEDIA_HEADER_SIZE 1
+#define A2DP_MAX_FRAMES_PER_PACKET 15
+#define A2DP_PACKET_POOL_SIZE 4
+#define BITPOOL_BACKLOG_HIGH 2
+#define BITPOOL_LATENCY_HIGH_MS 30
+#define BITPOOL_STEP_DOWN 4
+#define BITPOOL_STEP_UP 1
+#define BITPOOL_HOLD_MS 500
+#define BITPOOL_RECOVER_MS 3000
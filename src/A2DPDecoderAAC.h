@@ -0,0 +1,313 @@
+/**
+ * @file A2DPDecoderAAC.h
+ * @author Phil Schatzmann
+ * @brief AAC decoder for the A2DP sink: this needs the arduino-libhelix
+ * library, so it is not included by BTstack_A2DP.h
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPCodecs.h"
+#include "AudioTools/AudioCodecs/CodecAACHelix.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief aac attributes
+ */
+struct media_codec_configuration_aac_t {
+  uint8_t reconfigure;
+  uint8_t object_type;
+  uint32_t sampling_frequency;
+  uint8_t num_channels;
+  uint32_t bit_rate;
+  uint8_t vbr;
+
+  void dump() {
+    TRACED();
+    LOGI("- object_type: 0x%x", object_type);
+    LOGI("- sampling_frequency: %d", (int)sampling_frequency);
+    LOGI("- num_channels: %d", num_channels);
+    LOGI("- bit_rate: %d", (int)bit_rate);
+    LOGI("- vbr: %d", vbr);
+  }
+};
+
+/**
+ * @brief MPEG-2/4 AAC Decoder implementation: A2DP transports AAC as LATM
+ * AudioMuxElements (RFC 3016, with the StreamMuxConfig in band). We convert
+ * each access unit into an ADTS frame, so that it can be stored in the jitter
+ * buffer and decoded by the Helix AAC decoder. Only AAC LC with 1024 samples
+ * per frame is supported.
+ *
+ * The decoder needs about 30 kBytes of RAM and roughly 8 times the CPU time
+ * of SBC per frame, but a frame contains 1024 instead of 128 samples: use
+ * A2DPSink.timing() to compare the decoding time with the frame duration.
+ * Register it with A2DPSink.addDecoder(aac, 1) to prefer it over SBC.
+ * @author Phil Schatzmann
+ */
+class A2DPDecoderAAC : public A2DPDecoder {
+ public:
+  uint8_t *config() override { return media_aac_codec_configuration; }
+  int configSize() override { return sizeof(media_aac_codec_configuration); }
+
+  void begin() override {
+    // limit the buffers of the decoder to a single frame
+    aac_codec.setMaxFrameSize(MAX_AAC_FRAME_SIZE);
+    aac_codec.setMaxPCMSize(AAC_FRAME_SAMPLES * 2 * sizeof(int16_t));
+    is_mux_config = false;
+  }
+
+  uint8_t *codecCapabilities() override { return media_aac_codec_capabilities; }
+  int codecCapabilitiesSize() override {
+    return sizeof(media_aac_codec_capabilities);
+  }
+
+  AudioDecoder &decoder() override { return aac_codec; }
+
+  avdtp_media_codec_type_t codecType() override {
+    return AVDTP_CODEC_MPEG_2_4_AAC;
+  }
+
+  bool isReconfigure() override { return aac_config.reconfigure; }
+
+  /// PCM bytes of a decoded AAC frame
+  int frameLengthDecoded() override {
+    return AAC_FRAME_SAMPLES * aac_config.num_channels * sizeof(int16_t);
+  }
+
+  /// ADTS header + access unit
+  int maxFrameLength() override { return MAX_AAC_FRAME_SIZE; }
+
+  void setValues(uint8_t *packet, uint16_t size) override {
+    if (packet[2] == A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_OTHER_CONFIGURATION) {
+      set_values_other(packet);
+    } else {
+      LOGI("A2DP  Sink      : Received AAC codec configuration");
+      aac_config.reconfigure =
+          a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_reconfigure(
+              packet);
+      aac_config.object_type =
+          a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_object_type(
+              packet);
+      aac_config.sampling_frequency =
+          a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_sampling_frequency(
+              packet);
+      aac_config.num_channels =
+          a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_num_channels(
+              packet);
+      aac_config.bit_rate =
+          a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_bit_rate(
+              packet);
+      aac_config.vbr =
+          a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_vbr(
+              packet);
+    }
+    dump();
+  }
+
+  AudioInfo audioInfo() override {
+    AudioInfo info;
+    info.bits_per_sample = 16;
+    info.channels = aac_config.num_channels;
+    info.sample_rate = aac_config.sampling_frequency;
+    return info;
+  }
+
+  /// Converts the LATM AudioMuxElement of the media payload into an ADTS
+  /// frame
+  int readFrames(uint8_t *payload, int size, uint8_t *&frames,
+                 int &frameSize) override {
+    bit_reader_t reader{payload, size, 0};
+    bool use_same_stream_mux = reader.read(1);
+    if (!use_same_stream_mux) {
+      is_mux_config = read_stream_mux_config(reader);
+    }
+    if (!is_mux_config) {
+      LOGW("AAC: no valid StreamMuxConfig");
+      return 0;
+    }
+
+    // PayloadLengthInfo
+    int len = 0;
+    int tmp = 0;
+    do {
+      tmp = reader.read(8);
+      len += tmp;
+    } while (tmp == 255 && !reader.isEnd());
+
+    if (reader.available() < len * 8) {
+      LOGW("AAC: invalid payload length %d", len);
+      return 0;
+    }
+    if (len + ADTS_HEADER_SIZE > MAX_AAC_FRAME_SIZE) {
+      LOGW("AAC: frame too big: %d", len);
+      return 0;
+    }
+
+    // PayloadMux: the access unit is not byte aligned
+    write_adts_header(len);
+    uint8_t *access_unit = adts_frame + ADTS_HEADER_SIZE;
+    if (reader.pos % 8 == 0) {
+      memcpy(access_unit, payload + reader.pos / 8, len);
+    } else {
+      for (int j = 0; j < len; j++) access_unit[j] = reader.read(8);
+    }
+    frames = adts_frame;
+    frameSize = len + ADTS_HEADER_SIZE;
+    return 1;
+  }
+
+ protected:
+  static const int AAC_FRAME_SAMPLES = 1024;
+  static const int ADTS_HEADER_SIZE = 7;
+  static const int AOT_AAC_LC = 2;
+
+  /// Reads up to 32 bits MSB first
+  struct bit_reader_t {
+    const uint8_t *data;
+    int size;
+    int pos;
+
+    uint32_t read(int bits) {
+      uint32_t result = 0;
+      for (int j = 0; j < bits; j++) {
+        int byte_idx = pos / 8;
+        int bit = byte_idx < size ? (data[byte_idx] >> (7 - pos % 8)) & 1 : 0;
+        result = (result << 1) | bit;
+        pos++;
+      }
+      return result;
+    }
+    int available() { return size * 8 - pos; }
+    bool isEnd() { return available() <= 0; }
+  };
+
+  uint8_t media_aac_codec_configuration[6];
+  media_codec_configuration_aac_t aac_config;
+  AACDecoderHelix aac_codec;
+  bool is_mux_config = false;
+  int adts_profile = AOT_AAC_LC - 1;
+  int adts_sampling_index = 4;
+  int adts_channel_config = 2;
+  uint8_t adts_frame[MAX_AAC_FRAME_SIZE];
+
+  uint8_t media_aac_codec_capabilities[6] = {
+      // MPEG-2 AAC LC, MPEG-4 AAC LC
+      0xC0,
+      // 44100
+      0x01,
+      // 48000, 1 or 2 channels
+      0x8C,
+      // VBR, max bitrate 320000
+      0x84, 0xE2, 0x00};
+
+  void dump() { aac_config.dump(); }
+
+  /// Older BTstack versions report AAC as other codec with the raw codec
+  /// information
+  void set_values_other(uint8_t *packet) {
+    LOGI("A2DP  Sink      : Received other codec configuration");
+    int len =
+        a2dp_subevent_signaling_media_codec_other_configuration_get_media_codec_information_len(
+            packet);
+    const uint8_t *info =
+        a2dp_subevent_signaling_media_codec_other_configuration_get_media_codec_information(
+            packet);
+    if (len < 6) return;
+    aac_config.reconfigure =
+        a2dp_subevent_signaling_media_codec_other_configuration_get_reconfigure(
+            packet);
+    aac_config.object_type = info[0];
+    aac_config.sampling_frequency = 44100;
+    if (info[2] & 0x80) aac_config.sampling_frequency = 48000;
+    aac_config.num_channels = (info[2] & 0x04) ? 2 : 1;
+    aac_config.vbr = info[3] >> 7;
+    aac_config.bit_rate = ((info[3] & 0x7F) << 16) | (info[4] << 8) | info[5];
+  }
+
+  /// Parses the StreamMuxConfig (audioMuxVersion 0 with a single program
+  /// and layer) including the AudioSpecificConfig
+  bool read_stream_mux_config(bit_reader_t &reader) {
+    int audio_mux_version = reader.read(1);
+    if (audio_mux_version != 0) {
+      LOGW("AAC: audioMuxVersion %d not supported", audio_mux_version);
+      return false;
+    }
+    reader.read(1);  // allStreamsSameTimeFraming
+    int num_sub_frames = reader.read(6);
+    int num_program = reader.read(4);
+    int num_layer = reader.read(3);
+    if (num_sub_frames != 0 || num_program != 0 || num_layer != 0) {
+      LOGW("AAC: multiple subframes, programs or layers not supported");
+      return false;
+    }
+
+    // AudioSpecificConfig
+    int object_type = reader.read(5);
+    if (object_type == 31) object_type = 32 + reader.read(6);
+    int sampling_index = reader.read(4);
+    if (sampling_index == 15) {
+      LOGW("AAC: explicit sampling frequency not supported");
+      return false;
+    }
+    int channel_config = reader.read(4);
+    if (object_type != AOT_AAC_LC || channel_config == 0 ||
+        channel_config > 2) {
+      LOGW("AAC: object type %d with channel config %d not supported",
+           object_type, channel_config);
+      return false;
+    }
+    // GASpecificConfig
+    if (reader.read(1)) {
+      LOGW("AAC: 960 samples per frame not supported");
+      return false;
+    }
+    if (reader.read(1)) reader.read(14);  // dependsOnCoreCoder
+    reader.read(1);                       // extensionFlag
+
+    int frame_length_type = reader.read(3);
+    if (frame_length_type != 0) {
+      LOGW("AAC: frameLengthType %d not supported", frame_length_type);
+      return false;
+    }
+    reader.read(8);  // latmBufferFullness
+
+    if (reader.read(1)) {  // otherDataPresent
+      int escape = 0;
+      do {
+        escape = reader.read(1);
+        reader.read(8);
+      } while (escape && !reader.isEnd());
+    }
+    if (reader.read(1)) reader.read(8);  // crcCheckSum
+
+    if (!is_mux_config || adts_sampling_index != sampling_index ||
+        adts_channel_config != channel_config) {
+      LOGI("AAC: sampling index %d, channel config %d", sampling_index,
+           channel_config);
+    }
+    adts_profile = object_type - 1;
+    adts_sampling_index = sampling_index;
+    adts_channel_config = channel_config;
+    return !reader.isEnd();
+  }
+
+  /// ADTS header without CRC for an access unit of len bytes
+  void write_adts_header(int len) {
+    int frame_len = len + ADTS_HEADER_SIZE;
+    adts_frame[0] = 0xFF;
+    adts_frame[1] = 0xF1;  // MPEG-4, layer 0, no CRC
+    adts_frame[2] = (adts_profile << 6) | (adts_sampling_index << 2) |
+                    ((adts_channel_config >> 2) & 0x01);
+    adts_frame[3] = ((adts_channel_config & 0x03) << 6) | (frame_len >> 11);
+    adts_frame[4] = (frame_len >> 3) & 0xFF;
+    adts_frame[5] = ((frame_len & 0x07) << 5) | 0x1F;  // buffer fullness
+    adts_frame[6] = 0xFC;  // buffer fullness, 1 raw data block
+  }
+};
+
+}  // namespace btstack_a2dp
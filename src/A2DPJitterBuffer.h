@@ -0,0 +1,258 @@
+/**
+ * @file A2DPJitterBuffer.h
+ * @author Phil Schatzmann
+ * @brief Adaptive jitter buffer for received encoded frames
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <atomic>
+
+#include "A2DPConfig.h"
+#include "AudioTools.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief Jitter buffer which stores complete encoded frames (e.g. SBC)
+ * between the L2CAP receive callback and the decoder. Playback is held back
+ * until the target fill level has been reached. The target is adapted from
+ * the measured packet inter-arrival jitter (RFC 3550) within the range
+ * OPTIMAL_FRAMES_MIN - OPTIMAL_FRAMES_MAX.
+ *
+ * The buffer is a lock-free single-producer/single-consumer queue: write()
+ * can be called from the Bluetooth callback while read() is called from
+ * another core or thread. Lost frames are recorded as empty slots, so that
+ * they can be concealed at the right position. The ready state is only
+ * changed by the reading side: the writing side provides the fill level with
+ * the write index and the target as atomic value. If the buffer fills up,
+ * the reading side drops the oldest frames, so that there is always room for
+ * the next packet and the latest audio is kept.
+ * @author Phil Schatzmann
+ */
+class A2DPJitterBuffer {
+ public:
+  /// Result of read() for a frame that was lost
+  static const int LOST_FRAME = -1;
+
+  /// Allocates the frame storage: frameDurationUs is the playback time of a
+  /// single frame and maxFrameSize the size of the largest encoded frame
+  bool begin(int frameDurationUs, int maxFrameSize = MAX_SBC_FRAME_SIZE) {
+    LOGI("A2DPJitterBuffer::begin: frame duration %d us, max %d bytes",
+         frameDurationUs, maxFrameSize);
+    if (frameDurationUs <= 0 || maxFrameSize <= 0) return false;
+    frame_duration_us = frameDurationUs;
+    max_frame_size = maxFrameSize;
+    // the reserve for frames which are larger than any SBC frame (e.g. AAC)
+    // is limited to the memory used for SBC
+    int additional = ADDITIONAL_FRAMES;
+    if (maxFrameSize > MAX_SBC_DUAL_FRAME_SIZE)
+      additional = ADDITIONAL_FRAMES * MAX_SBC_FRAME_SIZE / maxFrameSize;
+    if (additional < 2) additional = 2;
+    // one slot stays empty to distinguish a full from an empty buffer
+    int slot_count = max_frames + additional + 1;
+    slot_sizes.resize(slot_count);
+    slot_data.resize(slot_count * max_frame_size);
+    clear();
+    return true;
+  }
+
+  /// Releases the frame storage
+  void end() {
+    clear();
+    slot_sizes.resize(0);
+    slot_data.resize(0);
+  }
+
+  /// Removes all frames: playback is held back until the target is reached.
+  /// Call while nothing is read.
+  void clear() {
+    read_pos = 0;
+    write_pos = 0;
+    is_ready = false;
+    last_arrival_us = 0;
+    last_num_frames = 0;
+    packet_frames = 1;
+    jitter_us = 0;
+    target_frames = min_frames;
+  }
+
+  /// Defines the range in frames in which the target fill level is adapted
+  void setRange(int minFrames, int maxFrames) {
+    min_frames = minFrames;
+    max_frames = maxFrames < minFrames ? minFrames : maxFrames;
+    target_frames = min_frames;
+  }
+
+  /// Adds numFrames encoded frames of frameSize bytes that were received at
+  /// timeUs
+  bool write(const uint8_t *data, int frameSize, int numFrames,
+             uint32_t timeUs) {
+    if (slot_sizes.size() == 0) return false;
+    if (frameSize <= 0 || frameSize > max_frame_size) {
+      LOGW("Invalid frame size: %d", frameSize);
+      return false;
+    }
+    update_jitter(timeUs, numFrames);
+    for (int j = 0; j < numFrames; j++) {
+      add_slot(data + (j * frameSize), frameSize);
+    }
+    return true;
+  }
+
+  /// Records numFrames lost frames which need to be concealed
+  bool writeLost(int numFrames) {
+    if (slot_sizes.size() == 0) return false;
+    for (int j = 0; j < numFrames; j++) {
+      add_slot(nullptr, 0);
+    }
+    return true;
+  }
+
+  /// Provides the next frame: returns the frame size, LOST_FRAME or 0 if
+  /// playback is on hold
+  int read(uint8_t *data, int len) {
+    if (!updateReady()) return 0;
+    drop_oldest();
+    int pos = read_pos.load(std::memory_order_relaxed);
+    if (write_pos.load(std::memory_order_acquire) == pos) {
+      // underrun: wait until we have reached the target again
+      LOGW("A2DPJitterBuffer: underrun");
+      underrun_count++;
+      is_ready = false;
+      return 0;
+    }
+    int size = slot_sizes[pos];
+    int result = size == 0 ? LOST_FRAME : size;
+    if (result > len) {
+      LOGE("Buffer too small: %d < %d", len, result);
+      return 0;
+    }
+    if (result > 0)
+      memcpy(data, slot_data.data() + pos * max_frame_size, result);
+    read_pos.store(next(pos), std::memory_order_release);
+    return result;
+  }
+
+  /// Number of buffered frames
+  int available() {
+    if (slot_sizes.size() == 0) return 0;
+    int result = write_pos.load(std::memory_order_acquire) -
+                 read_pos.load(std::memory_order_acquire);
+    return result < 0 ? result + slot_sizes.size() : result;
+  }
+
+  /// Reading side: releases the playback when the target fill level has been
+  /// reached and provides the result of isReady()
+  bool updateReady() {
+    if (!is_ready && available() >= target_frames) {
+      LOGI("A2DPJitterBuffer: ready with %d frames", available());
+      is_ready = true;
+    }
+    return is_ready;
+  }
+
+  /// Playback is active (the target fill level has been reached)
+  bool isReady() { return is_ready; }
+
+  /// Current target fill level in frames
+  int targetFrames() { return target_frames; }
+
+  /// Smoothed packet inter-arrival jitter in us
+  int jitterUs() { return jitter_us; }
+
+  /// Number of times the buffer ran empty during playback
+  uint32_t underruns() { return underrun_count; }
+
+  /// Number of frames that were dropped because the buffer was full
+  uint32_t overflows() { return overflow_count; }
+
+  /// Number of frames that can be stored
+  int capacity() { return slot_sizes.size() > 0 ? slot_sizes.size() - 1 : 0; }
+
+ protected:
+  // slot j holds slot_sizes[j] bytes at slot_data[j * max_frame_size]
+  Vector<uint16_t> slot_sizes;
+  Vector<uint8_t> slot_data;
+  int max_frame_size = MAX_SBC_FRAME_SIZE;
+  // read_pos is only updated by the consumer, write_pos by the producer
+  std::atomic<int> read_pos{0};
+  std::atomic<int> write_pos{0};
+  int min_frames = OPTIMAL_FRAMES_MIN;
+  int max_frames = OPTIMAL_FRAMES_MAX;
+  // written by the writing side, read by the reading side
+  std::atomic<int> target_frames{OPTIMAL_FRAMES_MIN};
+  std::atomic<int> jitter_us{0};
+  int frame_duration_us = 0;
+  int last_num_frames = 0;
+  // frames of the last packet: the reading side keeps room for them
+  std::atomic<int> packet_frames{1};
+  uint32_t last_arrival_us = 0;
+  uint32_t underrun_count = 0;
+  std::atomic<uint32_t> overflow_count{0};
+  // only changed by the reading side
+  std::atomic<bool> is_ready{false};
+
+  int next(int pos) { return (pos + 1) % slot_sizes.size(); }
+
+  void add_slot(const uint8_t *data, int frameSize) {
+    int pos = write_pos.load(std::memory_order_relaxed);
+    int next_pos = next(pos);
+    if (next_pos == read_pos.load(std::memory_order_acquire)) {
+      // the reading side did not make room (e.g. it is not reading): the
+      // frame can not be stored
+      overflow_count++;
+      return;
+    }
+    slot_sizes[pos] = frameSize;
+    if (frameSize > 0)
+      memcpy(slot_data.data() + pos * max_frame_size, data, frameSize);
+    write_pos.store(next_pos, std::memory_order_release);
+  }
+
+  /// The expected distance between two packets is the playback time of the
+  /// previous packet: the deviation is smoothed with a gain of 1/16
+  void update_jitter(uint32_t timeUs, int numFrames) {
+    if (last_num_frames > 0) {
+      int32_t expected = last_num_frames * frame_duration_us;
+      int32_t deviation = (int32_t)(timeUs - last_arrival_us) - expected;
+      if (deviation < 0) deviation = -deviation;
+      int jitter = jitter_us.load(std::memory_order_relaxed);
+      jitter_us.store(jitter + (deviation - jitter) / 16);
+      update_target();
+    }
+    last_arrival_us = timeUs;
+    last_num_frames = numFrames;
+    packet_frames = numFrames;
+  }
+
+  /// Reading side: drops the oldest frames so that the next packet fits into
+  /// the buffer. The read index is only moved by the reading side.
+  void drop_oldest() {
+    int excess = available() - (capacity() - packet_frames);
+    if (excess <= 0) return;
+    int pos = read_pos.load(std::memory_order_relaxed);
+    read_pos.store((pos + excess) % slot_sizes.size(),
+                   std::memory_order_release);
+    overflow_count += excess;
+    LOGW("A2DPJitterBuffer: dropped %d old frames", excess);
+  }
+
+  /// Keeps enough frames to bridge JITTER_BUFFER_FACTOR times the jitter
+  void update_target() {
+    int extra = (JITTER_BUFFER_FACTOR * jitter_us + frame_duration_us - 1) /
+                frame_duration_us;
+    int target = min_frames + extra;
+    if (target > max_frames) target = max_frames;
+    if (target != target_frames) {
+      LOGD("A2DPJitterBuffer: target %d -> %d frames (jitter %d us)",
+           target_frames.load(), target, jitter_us.load());
+      target_frames = target;
+    }
+  }
+};
+
+}  // namespace btstack_a2dp
@@ -0,0 +1,295 @@
+/**
+ * @file A2DPPacketPool.h
+ * @author Phil Schatzmann
+ * @brief Preallocated media packets for the A2DP source
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPConfig.h"
+#include "AudioTools.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief A media packet: the first byte is reserved for the SBC media
+ * payload header, followed by the encoded frames.
+ */
+struct a2dp_media_packet_t {
+  uint8_t data[A2DP_MEDIA_HEADER_SIZE + SBC_STORAGE_SIZE];
+  int size = 0;
+  int frames = 0;
+  uint32_t frame_index = 0;  // number of frames encoded before this packet
+
+  /// Encoded data after the header
+  uint8_t *payload() { return data + A2DP_MEDIA_HEADER_SIZE; }
+
+  /// Size including the header
+  int packetSize() { return A2DP_MEDIA_HEADER_SIZE + size; }
+};
+
+/**
+ * @brief Pool of preallocated media packets: the encoder writes the
+ * encoded frames directly into the payload of the packet that is filled
+ * (with frameBuffer() and commitFrame() or as AudioOutput), so that a
+ * complete packet can be sent without any intermediate copy.
+ * A packet is complete when it contains framesPerPacket() whole frames: the
+ * remaining frames are written to the next packet.
+ *
+ * Several links (readers) can send the same packets: each reader has its
+ * own position and a packet is released when all active readers have sent
+ * it. Reader 0 is active by default, so a single link can just use peek()
+ * and release().
+ * @author Phil Schatzmann
+ */
+class A2DPPacketPool : public AudioOutput {
+ public:
+  /// Starts the pool: each packet is filled with framesPerPacket frames of
+  /// frameSize bytes
+  bool begin(int frameSize, int framesPerPacket) {
+    LOGI("A2DPPacketPool::begin: %d frames of %d bytes", framesPerPacket,
+         frameSize);
+    frame_size = frameSize;
+    clear();
+    if (frame_size <= 0) return false;
+    setFramesPerPacket(framesPerPacket);
+    return true;
+  }
+
+  /// Defines the number of frames per packet: this is limited by the storage
+  /// size and the 4 bit frame count of the SBC header
+  void setFramesPerPacket(int frames) {
+    if (frame_size <= 0) return;
+    frames = limit_frames(frames);
+    if (frames != frames_per_packet) {
+      // the filled packets might not fit any more
+      frames_per_packet = frames;
+      clear();
+    }
+  }
+
+  /// Changes the frame size (e.g. after a bitpool change): the packet which
+  /// is filled is completed with the frames of the old size.
+  void setFrameSize(int frameSize, int framesPerPacket) {
+    if (frameSize <= 0) return;
+    if (packet_count < A2DP_PACKET_POOL_SIZE && packets[fill_pos].size > 0) {
+      complete_packet();
+    }
+    frame_size = frameSize;
+    frames_per_packet = limit_frames(framesPerPacket);
+  }
+
+  /// Size of an encoded frame
+  int frameSize() { return frame_size; }
+
+  /// Number of frames in a complete packet
+  int framesPerPacket() { return frames_per_packet; }
+
+  /// Removes all packets
+  void clear() {
+    for (auto &packet : packets) {
+      packet.size = 0;
+      packet.frames = 0;
+    }
+    fill_pos = 0;
+    send_pos = 0;
+    packet_count = 0;
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) {
+      reader_pos[j] = 0;
+      reader_count[j] = 0;
+    }
+  }
+
+  /// Activates a reader: it starts with the next complete packet
+  void addReader(int reader) {
+    if (reader < 0 || reader >= A2DP_MAX_LINKS) return;
+    reader_active[reader] = true;
+    reader_pos[reader] = fill_pos;
+    reader_count[reader] = 0;
+  }
+
+  /// Deactivates a reader: its pending packets are released
+  void removeReader(int reader) {
+    if (reader < 0 || reader >= A2DP_MAX_LINKS) return;
+    reader_active[reader] = false;
+    update_release();
+  }
+
+  /// Drops the oldest packet of the readers which are behind, if all packets
+  /// are in use but another reader is waiting for new packets: so a slow
+  /// link does not stall the others. Returns true if a packet became free.
+  bool dropLagging() {
+    if (!isFull()) return true;
+    int min_count = packet_count;
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) {
+      if (reader_active[j] && reader_count[j] < min_count)
+        min_count = reader_count[j];
+    }
+    if (min_count == packet_count) return false;
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) {
+      if (reader_active[j] && reader_count[j] == packet_count) {
+        next_packet(j);
+        reader_dropped[j]++;
+      }
+    }
+    update_release();
+    return true;
+  }
+
+  /// Number of packets which were dropped for the reader because it was
+  /// behind the others
+  uint32_t droppedPackets(int reader) {
+    return (reader >= 0 && reader < A2DP_MAX_LINKS) ? reader_dropped[reader]
+                                                    : 0;
+  }
+
+  /// Appends the encoded data to the packet which is filled
+  size_t write(const uint8_t *data, size_t len) override {
+    size_t result = 0;
+    while (result < len) {
+      if (packet_count == A2DP_PACKET_POOL_SIZE) {
+        // all packets are waiting to be sent
+        dropped_bytes += len - result;
+        break;
+      }
+      a2dp_media_packet_t &packet = packets[fill_pos];
+      if (packet.size == 0) packet.frame_index = frame_count;
+      int capacity = frames_per_packet * frame_size;
+      int n = capacity - packet.size;
+      if (n > (int)(len - result)) n = len - result;
+      memcpy(packet.payload() + packet.size, data + result, n);
+      packet.size += n;
+      int frames = packet.size / frame_size;
+      frame_count += frames - packet.frames;
+      packet.frames = frames;
+      result += n;
+      if (packet.size >= capacity) complete_packet();
+    }
+    return len;
+  }
+
+  /// Provides the memory for the next frame in the packet which is filled,
+  /// so that the encoder can write into it directly: nullptr if all
+  /// packets are waiting to be sent
+  uint8_t *frameBuffer() {
+    if (packet_count == A2DP_PACKET_POOL_SIZE) return nullptr;
+    a2dp_media_packet_t &packet = packets[fill_pos];
+    return packet.payload() + packet.size;
+  }
+
+  /// Available bytes at frameBuffer()
+  int frameBufferSize() {
+    if (packet_count == A2DP_PACKET_POOL_SIZE) return 0;
+    return SBC_STORAGE_SIZE - packets[fill_pos].size;
+  }
+
+  /// Confirms the frame of len bytes which was encoded into frameBuffer()
+  void commitFrame(int len) {
+    if (packet_count == A2DP_PACKET_POOL_SIZE || len <= 0) return;
+    a2dp_media_packet_t &packet = packets[fill_pos];
+    if (packet.size == 0) packet.frame_index = frame_count;
+    packet.size += len;
+    packet.frames++;
+    frame_count++;
+    if (packet.frames >= frames_per_packet ||
+        packet.size + frame_size > SBC_STORAGE_SIZE) {
+      complete_packet();
+    }
+  }
+
+  /// Number of complete packets which are waiting to be sent
+  int available() { return packet_count; }
+
+  /// Number of complete packets which the reader still needs to send
+  int available(int reader) { return reader_count[reader]; }
+
+  /// Number of frames in all packets (including the one that is filled)
+  int frames() {
+    int result = 0;
+    for (auto &packet : packets) result += packet.frames;
+    return result;
+  }
+
+  /// All packets are complete and waiting to be sent
+  bool isFull() { return packet_count == A2DP_PACKET_POOL_SIZE; }
+
+  /// Provides the next complete packet of the reader or nullptr
+  a2dp_media_packet_t *peek(int reader = 0) {
+    if (reader_count[reader] == 0) return nullptr;
+    return &packets[reader_pos[reader]];
+  }
+
+  /// Confirms that the packet provided by peek() was sent: it is released
+  /// when all active readers have sent it
+  void release(int reader = 0) {
+    if (reader_count[reader] == 0) return;
+    next_packet(reader);
+    update_release();
+  }
+
+  /// Number of encoded bytes that were lost because no packet was free
+  uint32_t droppedBytes() { return dropped_bytes; }
+
+ protected:
+  a2dp_media_packet_t packets[A2DP_PACKET_POOL_SIZE];
+  int frame_size = 0;
+  int frames_per_packet = SBC_PACKET_COUNT;
+  int fill_pos = 0;
+  int send_pos = 0;
+  int packet_count = 0;
+  uint32_t dropped_bytes = 0;
+  uint32_t frame_count = 0;
+  bool reader_active[A2DP_MAX_LINKS] = {true};
+  int reader_pos[A2DP_MAX_LINKS] = {0};
+  int reader_count[A2DP_MAX_LINKS] = {0};
+  uint32_t reader_dropped[A2DP_MAX_LINKS] = {0};
+
+  /// The packet which is filled is complete: it is queued for all readers
+  void complete_packet() {
+    fill_pos = (fill_pos + 1) % A2DP_PACKET_POOL_SIZE;
+    packet_count++;
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) {
+      if (reader_active[j]) reader_count[j]++;
+    }
+  }
+
+  void next_packet(int reader) {
+    reader_pos[reader] = (reader_pos[reader] + 1) % A2DP_PACKET_POOL_SIZE;
+    reader_count[reader]--;
+  }
+
+  /// Releases the oldest packets which were sent by all active readers
+  void update_release() {
+    int pending = 0;
+    bool is_active = false;
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) {
+      if (!reader_active[j]) continue;
+      is_active = true;
+      if (reader_count[j] > pending) pending = reader_count[j];
+    }
+    // without any reader the packets wait for the next one
+    if (!is_active) return;
+    while (packet_count > pending) {
+      packets[send_pos].size = 0;
+      packets[send_pos].frames = 0;
+      send_pos = (send_pos + 1) % A2DP_PACKET_POOL_SIZE;
+      packet_count--;
+    }
+  }
+
+  /// Limits the frames by the storage size and the 4 bit frame count of the
+  /// SBC header
+  int limit_frames(int frames) {
+    int max_frames = SBC_STORAGE_SIZE / frame_size;
+    if (max_frames > A2DP_MAX_FRAMES_PER_PACKET)
+      max_frames = A2DP_MAX_FRAMES_PER_PACKET;
+    if (frames > max_frames) frames = max_frames;
+    if (frames < 1) frames = 1;
+    return frames;
+  }
+};
+
+}  // namespace btstack_a2dp
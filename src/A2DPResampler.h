@@ -0,0 +1,192 @@
+/**
+ * @file A2DPResampler.h
+ * @author Phil Schatzmann
+ * @brief Clock drift compensation for the sink
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPConfig.h"
+#include "AudioTools.h"
+#include "A2DPVolume.h"
+
+namespace btstack_a2dp {
+
+/**
+ * @brief Resampler with a ratio that can be changed in steps of 1 ppm. The
+ * position is a 32.32 fixed point value and the samples are linearly
+ * interpolated in Q15, so that no floating point operations are needed.
+ * The volume is applied in the same pass, so that the PCM data is only
+ * touched once.
+ * @author Phil Schatzmann
+ */
+class A2DPResampler : public AudioOutput {
+ public:
+  /// Defines the output of the PCM data
+  void setOutput(Print &out) { p_out = &out; }
+
+  /// Defines the output which is informed about the negotiated audio format
+  void setOutput(AudioOutput &out) {
+    p_out = &out;
+    p_info_out = &out;
+  }
+
+  /// Defines the output which is informed about the negotiated audio format
+  void setOutput(AudioStream &out) {
+    p_out = &out;
+    p_info_out = &out;
+  }
+
+  /// Defines the volume control which is applied to the output
+  void setVolume(A2DPVolume &volume) { p_volume = &volume; }
+
+  bool begin(AudioInfo info) override {
+    setAudioInfo(info);
+    // the output runs with the negotiated format, so that no additional
+    // resampling is needed
+    if (p_info_out != nullptr) p_info_out->setAudioInfo(info);
+    channels = info.channels;
+    memset(last_samples, 0, sizeof(last_samples));
+    phase = 0;
+    setRatioPpm(0);
+    output_frames = 0;
+    return true;
+  }
+
+  /// Defines the deviation from the 1:1 ratio: a positive value consumes
+  /// more input samples than it produces
+  void setRatioPpm(int ppm) {
+    ratio_ppm = ppm;
+    // 2^32 / 1000000 = 4294.967
+    step = (1ULL << 32) + (int64_t)ppm * 4295;
+  }
+
+  /// Current deviation from the 1:1 ratio in ppm
+  int ratioPpm() { return ratio_ppm; }
+
+  /// Total number of output frames (samples per channel)
+  uint32_t outputFrames() { return output_frames; }
+
+  size_t write(const uint8_t *data, size_t len) override {
+    if (p_out == nullptr) return 0;
+    const int16_t *samples = (const int16_t *)data;
+    int frames = len / (channels * sizeof(int16_t));
+    int16_t buffer[64 * NUM_CHANNELS];
+    int buffer_len = sizeof(buffer) / sizeof(int16_t);
+    if (ratio_ppm == 0 && phase == 0) {
+      // nothing to resample
+      output_frames += frames;
+      update_last_samples(samples, frames * channels);
+      if (p_volume == nullptr || p_volume->isUnity()) {
+        return p_out->write(data, len);
+      }
+      int sample_count = frames * channels;
+      for (int pos = 0; pos < sample_count; pos += buffer_len) {
+        int n = sample_count - pos;
+        if (n > buffer_len) n = buffer_len;
+        memcpy(buffer, samples + pos, n * sizeof(int16_t));
+        p_volume->process(buffer, n);
+        p_out->write((const uint8_t *)buffer, n * sizeof(int16_t));
+      }
+      return len;
+    }
+
+    int n = 0;
+    // index 0 is the last sample of the previous write, index j+1 is
+    // input frame j
+    while ((int64_t)(phase >> 32) < frames) {
+      int idx = phase >> 32;
+      int32_t weight = (phase >> 17) & 0x7FFF;
+      int32_t gain = p_volume ? p_volume->nextGain() : A2DPVolume::Q15_ONE;
+      for (int ch = 0; ch < channels; ch++) {
+        int32_t a = idx == 0 ? last_samples[ch]
+                             : samples[(idx - 1) * channels + ch];
+        int32_t b = samples[idx * channels + ch];
+        int32_t sample = a + (((b - a) * weight) >> 15);
+        buffer[n++] = A2DPVolume::scale(sample, gain);
+      }
+      if (n + channels > buffer_len) {
+        p_out->write((const uint8_t *)buffer, n * sizeof(int16_t));
+        n = 0;
+      }
+      output_frames++;
+      phase += step;
+    }
+    if (n > 0) p_out->write((const uint8_t *)buffer, n * sizeof(int16_t));
+    phase -= (uint64_t)frames << 32;
+    update_last_samples(samples, frames * channels);
+    return len;
+  }
+
+ protected:
+  Print *p_out = nullptr;
+  AudioInfoSupport *p_info_out = nullptr;
+  A2DPVolume *p_volume = nullptr;
+  int channels = NUM_CHANNELS;
+  int16_t last_samples[NUM_CHANNELS];
+  uint64_t phase = 0;
+  uint64_t step = 1ULL << 32;
+  int ratio_ppm = 0;
+  uint32_t output_frames = 0;
+
+  void update_last_samples(const int16_t *samples, int sampleCount) {
+    if (sampleCount < channels) return;
+    memcpy(last_samples, samples + sampleCount - channels,
+           channels * sizeof(int16_t));
+  }
+};
+
+/**
+ * @brief Estimates the clock drift between the A2DP source and the local
+ * output from the fill level of the jitter buffer and determines the
+ * resampling ratio with a PI controller, so that the fill level (and
+ * therefore the latency) stays at the target.
+ * @author Phil Schatzmann
+ */
+class A2DPDriftController {
+ public:
+  void begin() {
+    avg_fill_q8 = -1;
+    integral = 0;
+    frame_count = 0;
+    ratio_ppm = 0;
+  }
+
+  /// Call once per decoded frame with the actual and the target fill level:
+  /// returns the new ratio in ppm
+  int update(int fillFrames, int targetFrames) {
+    // smooth the saw tooth which is caused by the packet arrivals
+    if (avg_fill_q8 < 0) avg_fill_q8 = fillFrames << 8;
+    avg_fill_q8 += ((fillFrames << 8) - avg_fill_q8) / 64;
+    if (++frame_count < DRIFT_UPDATE_FRAMES) return ratio_ppm;
+    frame_count = 0;
+
+    int32_t error_q8 = avg_fill_q8 - (targetFrames << 8);
+    integral += error_q8 * DRIFT_KI_PPM / 256;
+    integral = clamp(integral);
+    ratio_ppm = clamp(error_q8 * DRIFT_KP_PPM / 256 + integral);
+    LOGD("A2DPDriftController: fill %d / %d -> %d ppm", avg_fill_q8 >> 8,
+         targetFrames, ratio_ppm);
+    return ratio_ppm;
+  }
+
+  /// Current deviation in ppm
+  int ratioPpm() { return ratio_ppm; }
+
+ protected:
+  int32_t avg_fill_q8 = -1;
+  int32_t integral = 0;
+  int frame_count = 0;
+  int ratio_ppm = 0;
+
+  int32_t clamp(int32_t ppm) {
+    if (ppm > DRIFT_MAX_PPM) return DRIFT_MAX_PPM;
+    if (ppm < -DRIFT_MAX_PPM) return -DRIFT_MAX_PPM;
+    return ppm;
+  }
+};
+
+}  // namespace btstack_a2dp
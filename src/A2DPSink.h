@@ -61,48 +61,45 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <atomic>
+#ifndef ARDUINO
+#  include <thread>
+#endif
+
 #include "A2DPCommon.h"
+#include "A2DPConcealment.h"
+#include "A2DPJitterBuffer.h"
+#include "A2DPResampler.h"
+#include "A2DPStack.h"
 
 namespace btstack_a2dp {
 
 // -- Declare Sink Callback functions
-extern "C" void sink_hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                                        uint8_t *packet, uint16_t size);
-extern "C" void sink_a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                         uint8_t *packet, uint16_t event_size);
-extern "C" void sink_handle_l2cap_media_data_packet(uint8_t seid,
-                                                    uint8_t *packet,
-                                                    uint16_t size);
-extern "C" void sink_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                          uint8_t *packet, uint16_t size);
-extern "C" void sink_avrcp_controller_packet_handler(uint8_t packet_type,
-                                                     uint16_t channel,
-                                                     uint8_t *packet,
-                                                     uint16_t size);
-extern "C" void sink_avrcp_target_packet_handler(uint8_t packet_type,
-                                                 uint16_t channel,
-                                                 uint8_t *packet,
-                                                 uint16_t size);
-
-extern "C" void sink_handle_l2cap_media_data_packet(uint8_t seid,
-                                                    uint8_t *packet,
-                                                    uint16_t size);
-extern "C" void sink_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                          uint8_t *packet, uint16_t size);
-extern "C" void sink_avrcp_controller_packet_handler(uint8_t packet_type,
-                                                     uint16_t channel,
-                                                     uint8_t *packet,
-                                                     uint16_t size);
-
-extern "C" void sink_avrcp_target_packet_handler(uint8_t packet_type,
-                                                 uint16_t channel,
-                                                 uint8_t *packet,
-                                                 uint16_t size);
+extern "C" inline void sink_playback_timeout_handler(
+    btstack_timer_source_t *timer);
+extern "C" inline void sink_stop_timeout_handler(
+    btstack_timer_source_t *timer);
 
 // void sink_playback_handler(int16_t *buffer, uint16_t num_audio_frames);
 
 /**
- * @brief A2DPSink for the RP2040
+ * @brief Processing time per SBC frame in us on the receiving (Bluetooth)
+ * and on the decoding side.
+ */
+struct A2DPSinkTiming {
+  uint32_t frames_received = 0;
+  uint32_t frames_decoded = 0;
+  uint32_t receive_us_per_frame = 0;
+  uint32_t receive_max_us = 0;
+  uint32_t decode_us_per_frame = 0;
+  uint32_t decode_max_us = 0;
+  uint32_t switch_ms = 0;  // last switch to another phone until audio
+};
+
+/**
+ * @brief A2DPSink for the RP2040: up to SINK_MAX_LINKS phones can be
+ * connected at the same time and the playback switches to the phone which
+ * starts streaming.
  * @author Phil Schatzmann
  */
 
@@ -111,14 +108,16 @@ class A2DPSinkClass : public A2DPCommon {
   A2DPSinkClass() = default;
 
   void setOutput(AudioStream &out) {
-    volume_stream.setOutput(out);
-    dec_stream.setOutput(&volume_stream);
+    resampler.setOutput(out);
+    concealment.setOutput(resampler);
+    dec_stream.setOutput(&concealment);
     dec_stream.setDecoder(&(get_decoder().decoder()));
   }
 
   void setOutput(AudioOutput &out) {
-    volume_stream.setOutput(out);
-    dec_stream.setOutput(&volume_stream);
+    resampler.setOutput(out);
+    concealment.setOutput(resampler);
+    dec_stream.setOutput(&concealment);
     dec_stream.setDecoder(&(get_decoder().decoder()));
   }
 
@@ -135,45 +134,162 @@ class A2DPSinkClass : public A2DPCommon {
     }
 
     // turn on!
-    LOGI("Power On ...\n");
-    if (hci_power_control(HCI_POWER_ON) != 0) {
-      LOGE("hci_power_control");
-      return false;
-    }
-
-    return true;
+    return A2DPStack.powerOn();
   }
 
   /// Stops the processing
   void end() {
     TRACEI();
     stop();
-    a2dp_sink_disconnect(get_avrcp_cid());
+    for (auto &conn : a2dp_connections) {
+      if (conn.is_used) a2dp_sink_disconnect(conn.a2dp_cid);
+    }
     dec_stream.end();
     is_active = false;
   }
 
-  /// Sets the decoder
-  void setDecoder(A2DPDecoder &dec) { p_decoder = &dec; }
+  /// Defines if the playback switches to a phone which starts streaming while
+  /// another phone is playing (default: true). Otherwise the playing phone
+  /// keeps the output until it pauses.
+  void setSwitchToLatest(bool active) { is_switch_to_latest = active; }
+
+  /// Sends an AVRCP pause to the phone which has lost the output (default:
+  /// true)
+  void setPauseInactive(bool active) { is_pause_inactive = active; }
+
+  /// Forwards the received SBC frames without decoding, e.g. to the
+  /// A2DPSource (relay): the frames are only decoded if they are not
+  /// accepted. The volume is forwarded as well and not applied here.
+  void setFrameOutput(A2DPFrameOutput &out) { p_frame_output = &out; }
+
+  /// Number of connected phones
+  int connectedCount() {
+    int result = 0;
+    for (auto &conn : a2dp_connections) {
+      if (conn.is_used) result++;
+    }
+    return result;
+  }
+
+  /// Sets the decoder: this replaces all registered decoders
+  void setDecoder(A2DPDecoder &dec) {
+    decoders.clear();
+    decoders.add(dec);
+    p_decoder = &dec;
+  }
+
+  /// Registers an additional decoder with its own stream endpoint: the
+  /// source selects the codec, the endpoints of the decoders with a higher
+  /// priority are announced first. Call before begin().
+  bool addDecoder(A2DPDecoder &dec, int priority = 0) {
+    return decoders.add(dec, priority);
+  }
+
+  /// Uses the default SBC decoder only
+  void resetDecoder() {
+    decoders.clear();
+    p_decoder = &decoder_sbc;
+  }
+
+  /// Provides access to the jitter buffer (e.g. to read the statistics or
+  /// to change the range)
+  A2DPJitterBuffer &jitterBuffer() { return jitter_buffer; }
+
+  /// Number of media packets which were lost (based on the RTP sequence
+  /// number)
+  uint32_t lostPackets() { return lost_packets; }
 
-  void resetDecoder() { p_decoder = &decoder_sbc; }
+  /// Number of media packets which were received more than once or too late
+  uint32_t duplicatePackets() { return duplicate_packets; }
+
+  /// Number of frames which were synthesized to replace lost frames
+  uint32_t concealedFrames() { return concealment.concealedFrames(); }
+
+  /// Actual clock drift compensation in ppm: a positive value means that
+  /// the source is faster than the output
+  int driftPpm() { return resampler.ratioPpm(); }
+
+  /// Activates/deactivates the clock drift compensation (default: active)
+  void setDriftCompensation(bool active) { is_drift_compensation = active; }
+
+  /// Applies the volume to the scale factors of the SBC frames before they
+  /// are decoded (in steps of 6 dB): only the remaining gain is applied to
+  /// the PCM samples. With isCoarse the volume is rounded to 6 dB steps, so
+  /// that the PCM samples are not touched at all. Call before the stream is
+  /// started.
+  void setCompressedVolume(bool active, bool isCoarse = false) {
+    is_compressed_volume = active;
+    is_coarse_volume = isCoarse;
+  }
+
+  /// Decode in copy() (e.g. called in loop1() on the second core) instead of
+  /// the Bluetooth run loop. Call before begin().
+  void setDecodeInWorker(bool active) { is_decode_in_worker = active; }
+
+  /// Decodes and outputs the received SBC frames which are due: call this
+  /// repeatedly from the second core if setDecodeInWorker(true) was used.
+  bool copy() {
+    if (!is_decode_in_worker) return false;
+    worker_busy = true;
+    int frames = decoding_active ? decode_due_frames(millis()) : 0;
+    worker_busy = false;
+    return frames > 0;
+  }
+
+#ifndef ARDUINO
+  /// Host builds: calls copy() in a separate std::thread
+  void startWorkerThread() {
+    setDecodeInWorker(true);
+    is_worker_thread_active = true;
+    worker_thread = std::thread([this]() {
+      while (is_worker_thread_active) {
+        if (!copy()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+
+  /// Host builds: stops the thread that was started with startWorkerThread()
+  void stopWorkerThread() {
+    is_worker_thread_active = false;
+    if (worker_thread.joinable()) worker_thread.join();
+  }
+#endif
+
+  /// Defines the delay in us of the output (e.g. the I2S DMA buffers) which
+  /// is added to the reported delay
+  void setOutputDelayUs(uint32_t us) { output_delay_us = us; }
+
+  /// Estimated delay in us from the reception of a frame until it is
+  /// played: this is reported to the source
+  uint32_t delayUs() {
+    auto &dec = get_decoder();
+    AudioInfo info = dec.audioInfo();
+    if (info.sample_rate == 0 || info.channels == 0) return output_delay_us;
+    uint32_t frame_samples =
+        dec.frameLengthDecoded() / (info.channels * sizeof(int16_t));
+    // before playback has started we will buffer the target
+    int frames = jitter_buffer.isReady() ? jitter_buffer.available()
+                                         : jitter_buffer.targetFrames();
+    return output_delay_us +
+           (uint64_t)frames * frame_samples * 1000000 / info.sample_rate;
+  }
+
+  /// Provides the processing time per frame on the receiving and on the
+  /// decoding side
+  A2DPSinkTiming timing() {
+    A2DPSinkTiming result = timing_info;
+    if (receive_frames > 0)
+      result.receive_us_per_frame = receive_time_us / receive_frames;
+    if (decode_frames > 0)
+      result.decode_us_per_frame = decode_time_us / decode_frames;
+    result.frames_received = receive_frames;
+    result.frames_decoded = decode_frames;
+    return result;
+  }
 
  protected:
-  friend void sink_hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                                      uint8_t *packet, uint16_t size);
-  friend void sink_a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                       uint8_t *packet, uint16_t event_size);
-  friend void sink_handle_l2cap_media_data_packet(uint8_t seid, uint8_t *packet,
-                                                  uint16_t size);
-  friend void sink_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                        uint8_t *packet, uint16_t size);
-  friend void sink_avrcp_controller_packet_handler(uint8_t packet_type,
-                                                   uint16_t channel,
-                                                   uint8_t *packet,
-                                                   uint16_t size);
-  friend void sink_avrcp_target_packet_handler(uint8_t packet_type,
-                                               uint16_t channel,
-                                               uint8_t *packet, uint16_t size);
+  friend void sink_playback_timeout_handler(btstack_timer_source_t *timer);
+  friend void sink_stop_timeout_handler(btstack_timer_source_t *timer);
 
   enum stream_state_t {
     STREAM_STATE_CLOSED,
@@ -182,172 +298,382 @@ class A2DPSinkClass : public A2DPCommon {
     STREAM_STATE_PAUSED,
   };
 
-  struct a2dp_sink_arduino_stream_endpoint_t {
-    uint8_t a2dp_local_seid;
-    // uint8_t media_sbc_codec_configuration[4]; ***
-  } a2dp_sink_arduino_stream_endpoint;
-
   struct a2dp_sink_arduino_a2dp_connection_t {
+    bool is_used = false;
     bd_addr_t addr;
-    uint16_t a2dp_cid;
-    uint8_t a2dp_local_seid;
-    stream_state_t stream_state;
-    // media_codec_configuration_sbc_t sbc_configuration; ***
-  } a2dp_sink_arduino_a2dp_connection;
+    uint16_t a2dp_cid = 0;
+    uint8_t a2dp_local_seid = 0;
+    stream_state_t stream_state = STREAM_STATE_CLOSED;
+    // the configuration is applied when the connection gets active
+    uint8_t config_event[SINK_CONFIG_EVENT_SIZE];
+    uint16_t config_size = 0;
+  } a2dp_connections[SINK_MAX_LINKS];
+  // connection which provides the audio
+  a2dp_sink_arduino_a2dp_connection_t *p_active = nullptr;
 
   struct a2dp_sink_arduino_avrcp_connection_t {
     bd_addr_t addr;
-    uint16_t avrcp_cid;
-    bool playing;
-  } a2dp_sink_arduino_avrcp_connection;
+    uint16_t avrcp_cid = 0;
+    bool playing = false;
+  } avrcp_connections[SINK_MAX_LINKS];
 
   // local state
   A2DPDecoderSBC decoder_sbc;
   A2DPDecoder *p_decoder = &decoder_sbc;
+  A2DPCodecRegistry<A2DPDecoder> decoders;
   const char *a2dp_name = "rp2040";
   EncodedAudioOutput dec_stream;
-  btstack_packet_callback_registration_t hci_event_callback_registration;
+  A2DPJitterBuffer jitter_buffer;
+  A2DPConcealment concealment;
+  A2DPResampler resampler;
+  A2DPDriftController drift_controller;
+  bool is_drift_compensation = true;
+  bool is_compressed_volume = false;
+  bool is_coarse_volume = false;
+  bool is_switch_to_latest = true;
+  bool is_pause_inactive = true;
+  std::atomic<uint32_t> switch_start_ms{0};
+  A2DPVolume residual_volume;
+  bool is_first_media_packet = true;
+  A2DPFrameOutput *p_frame_output = nullptr;
+  bool is_frame_passthrough = false;
+  uint16_t last_sequence_number = 0;
+  uint32_t last_timestamp = 0;
+  int last_num_frames = 0;
+  uint32_t lost_packets = 0;
+  uint32_t duplicate_packets = 0;
+  btstack_timer_source_t playback_timer;
+  uint32_t playback_time_ms = 0;
+  int32_t playback_samples_due = 0;
+  int playback_frame_samples = 0;
+  int playback_sample_rate = 0;
+  Vector<uint8_t> playback_frame;
+  bool is_decode_in_worker = false;
+  std::atomic<bool> decoding_active{false};
+  std::atomic<bool> worker_busy{false};
+  // stop which waits for the worker to finish the current frame
+  enum { STOP_NONE, STOP_PAUSE, STOP_CLOSE };
+  int stop_pending = STOP_NONE;
+  bool is_init_pending = false;
+  btstack_timer_source_t stop_timer;
+#ifndef ARDUINO
+  std::atomic<bool> is_worker_thread_active{false};
+  std::thread worker_thread;
+#endif
+  A2DPSinkTiming timing_info;
+  uint32_t output_delay_us = 0;
+  uint32_t delay_report_time_ms = 0;
+  uint32_t last_reported_delay_us = 0;
+  uint64_t receive_time_us = 0;
+  uint32_t receive_frames = 0;
+  uint64_t decode_time_us = 0;
+  uint32_t decode_frames = 0;
   uint8_t sdp_avdtp_sink_service_buffer[150];
-  uint8_t sdp_avrcp_target_service_buffer[150];
-  uint8_t sdp_avrcp_controller_service_buffer[200];
-  uint8_t device_id_sdp_service_buffer[100];
   unsigned int sbc_frame_size;
-  bool media_initialized = false;
-  bool audio_stream_started = false;
+  // also used by the worker
+  std::atomic<bool> media_initialized{false};
+  std::atomic<bool> audio_stream_started{false};
   avrcp_battery_status_t battery_status = AVRCP_BATTERY_STATUS_WARNING;
 
   // local methods
   int16_t get_max_input_amplitude() override { return MAX_AMPLITUDE_RECEIVED; }
 
-  int get_avrcp_cid() { return a2dp_sink_arduino_avrcp_connection.avrcp_cid; }
+  bool isSink() override { return true; }
+
+  bool hasConnection(uint16_t a2dpCid) override {
+    return get_connection(a2dpCid) != nullptr;
+  }
+
+  bool hasAddress(bd_addr_t address) override {
+    for (auto &conn : a2dp_connections) {
+      if (conn.is_used && bd_addr_cmp(conn.addr, address) == 0) return true;
+    }
+    return false;
+  }
+
+  bool hasSeid(uint8_t localSeid) override {
+    return decoders.find(localSeid) != nullptr;
+  }
+
+  bool acceptsConnection() override {
+    return is_active && connectedCount() < SINK_MAX_LINKS;
+  }
+
+  int maxConnections() override { return SINK_MAX_LINKS; }
+
+  int streamEndpointCount() override {
+    return SINK_MAX_LINKS * decoders.size();
+  }
+
+  int linkKeyCount() override { return SINK_MAX_LINKS; }
+
+  /// AVRCP of the active phone (or of any phone if none is active)
+  int get_avrcp_cid() {
+    a2dp_sink_arduino_avrcp_connection_t *p_avrcp = get_active_avrcp();
+    return p_avrcp != nullptr ? p_avrcp->avrcp_cid : 0;
+  }
+
+  a2dp_sink_arduino_avrcp_connection_t *get_active_avrcp() {
+    a2dp_sink_arduino_avrcp_connection_t *result = nullptr;
+    for (auto &avrcp : avrcp_connections) {
+      if (avrcp.avrcp_cid == 0) continue;
+      if (p_active != nullptr && bd_addr_cmp(avrcp.addr, p_active->addr) == 0)
+        return &avrcp;
+      if (result == nullptr) result = &avrcp;
+    }
+    return result;
+  }
+
+  a2dp_sink_arduino_avrcp_connection_t *get_avrcp(uint16_t avrcpCid) {
+    for (auto &avrcp : avrcp_connections) {
+      if (avrcp.avrcp_cid != 0 && avrcp.avrcp_cid == avrcpCid) return &avrcp;
+    }
+    return nullptr;
+  }
+
+  a2dp_sink_arduino_a2dp_connection_t *get_connection(uint16_t cid) {
+    for (auto &conn : a2dp_connections) {
+      if (conn.is_used && conn.a2dp_cid == cid) return &conn;
+    }
+    return nullptr;
+  }
+
+  /// Provides the connection: a new one is allocated if necessary; nullptr
+  /// if all are in use
+  a2dp_sink_arduino_a2dp_connection_t *add_connection(uint16_t cid) {
+    a2dp_sink_arduino_a2dp_connection_t *result = get_connection(cid);
+    if (result != nullptr) return result;
+    for (auto &conn : a2dp_connections) {
+      if (!conn.is_used) {
+        conn = a2dp_sink_arduino_a2dp_connection_t();
+        conn.is_used = true;
+        conn.a2dp_cid = cid;
+        return &conn;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Another connection which is streaming or nullptr
+  a2dp_sink_arduino_a2dp_connection_t *get_playing_connection() {
+    for (auto &conn : a2dp_connections) {
+      if (conn.is_used && &conn != p_active &&
+          conn.stream_state == STREAM_STATE_PLAYING)
+        return &conn;
+    }
+    return nullptr;
+  }
+
+  /// Records the configuration of the connection: it is only applied to the
+  /// decoder if the connection provides the audio
+  void store_configuration(uint16_t cid, uint8_t localSeid, uint8_t *packet,
+                           uint16_t size) {
+    a2dp_sink_arduino_a2dp_connection_t *conn = add_connection(cid);
+    if (conn == nullptr) return;
+    conn->a2dp_local_seid = localSeid;
+    if (size > SINK_CONFIG_EVENT_SIZE) {
+      LOGE("A2DP  Sink      : configuration event too big: %d", size);
+      conn->config_size = 0;
+      return;
+    }
+    memcpy(conn->config_event, packet, size);
+    conn->config_size = size;
+    if (p_active == nullptr || p_active == conn) {
+      p_active = conn;
+      apply_configuration(conn);
+    }
+  }
+
+  /// Selects and configures the decoder for the connection
+  bool apply_configuration(a2dp_sink_arduino_a2dp_connection_t *conn) {
+    if (conn->config_size == 0) return false;
+    if (!select_decoder(conn->a2dp_local_seid)) return false;
+    configure_decoder(conn->config_event, conn->config_size);
+    if (p_frame_output != nullptr)
+      p_frame_output->setFrameConfiguration(conn->config_event,
+                                            conn->config_size);
+    return true;
+  }
+
+  /// Offers the received frames to the frame output: returns true if they
+  /// were accepted, so that they do not need to be decoded
+  bool write_frame_output(uint8_t *frames, int frameSize, int numFrames) {
+    bool is_accepted = p_frame_output != nullptr &&
+                       get_decoder().codecType() == AVDTP_CODEC_SBC &&
+                       p_frame_output->writeFrames(frames, numFrames, frameSize);
+    if (!is_accepted) {
+      if (is_frame_passthrough) {
+        LOGI("A2DP  Sink      : decoding the received frames");
+        is_frame_passthrough = false;
+      }
+      return false;
+    }
+    if (!is_frame_passthrough) {
+      LOGI("A2DP  Sink      : forwarding the received frames");
+      is_frame_passthrough = true;
+      // drop the frames which were buffered for the decoding
+      media_processing_pause();
+    }
+    return true;
+  }
+
+  /// The active stream has stopped
+  void end_frame_output() {
+    if (p_frame_output != nullptr) p_frame_output->endFrames();
+    is_frame_passthrough = false;
+  }
+
+  /**
+   * @brief Switches the output to the connection: if the codec and the
+   * format did not change, the decoder, resampler and volume stay active and
+   * only the buffered frames of the previous phone are dropped.
+   */
+  void activate_connection(a2dp_sink_arduino_a2dp_connection_t *conn) {
+    if (conn == p_active) return;
+    LOGI("A2DP  Sink      : switching to %s", bd_addr_to_str(conn->addr));
+    a2dp_sink_arduino_a2dp_connection_t *p_previous = p_active;
+    a2dp_sink_arduino_avrcp_connection_t *p_previous_avrcp =
+        get_active_avrcp();
+    switch_start_ms = millis();
+    p_active = conn;
+    // this closes the media processing only if the format has changed
+    apply_configuration(conn);
+    if (media_initialized) {
+      media_processing_pause();
+      is_first_media_packet = true;
+    }
+    if (p_previous != nullptr &&
+        p_previous->stream_state == STREAM_STATE_PLAYING &&
+        is_pause_inactive && p_previous_avrcp != nullptr &&
+        p_previous_avrcp != get_active_avrcp()) {
+      avrcp_controller_pause(p_previous_avrcp->avrcp_cid);
+    }
+    send_delay_report(true);
+  }
 
   A2DPDecoder &get_decoder() { return *p_decoder; }
 
+  /// Updates the decoder with the configuration selected by the source: a
+  /// new configuration restarts the media processing with the new format
+  void configure_decoder(uint8_t *packet, uint16_t size) {
+    A2DPDecoder &dec = get_decoder();
+    AudioInfo old_info = dec.audioInfo();
+    dec.setValues(packet, size);
+    AudioInfo info = dec.audioInfo();
+    if (dec.isReconfigure() || info.sample_rate != old_info.sample_rate ||
+        info.channels != old_info.channels) {
+      media_processing_close();
+    }
+  }
+
+  /// Activates the decoder of the stream endpoint that was configured by
+  /// the source
+  bool select_decoder(uint8_t localSeid) {
+    A2DPDecoder *p_dec = decoders.find(localSeid);
+    if (p_dec == nullptr) {
+      LOGE("A2DP  Sink      : no decoder for local seid %d", localSeid);
+      return false;
+    }
+    if (p_dec != p_decoder) media_processing_close();
+    p_decoder = p_dec;
+    dec_stream.setDecoder(&(p_decoder->decoder()));
+    return true;
+  }
+
   void set_playing(bool playing) override {
     is_playing = playing;
-    a2dp_sink_arduino_avrcp_connection.playing = playing;
+    a2dp_sink_arduino_avrcp_connection_t *p_avrcp = get_active_avrcp();
+    if (p_avrcp != nullptr) p_avrcp->playing = playing;
   }
 
   /**
    * @text The Listing MainConfiguration shows how to set up AD2P Sink and
-   * AVRCP services. Besides calling init() method for each service, you'll
-   * also need to register several packet handlers:
-   * - sink_hci_packet_handler - handles legacy pairing, here by using fixed
+   * AVRCP services. The services which exist only once per device (L2CAP,
+   * SDP, AVRCP and the HCI event handler) are set up by the A2DPStack,
+   * which forwards the callbacks to this object:
+   * - hci_packet_handler - handles legacy pairing, here by using fixed
    * '0000' pin code.
-   * - sink_a2dp_packet_handler - handles events on stream connection status
+   * - a2dp_packet_handler - handles events on stream connection status
    * (established, released), the media codec configuration, and, the status
    * of the stream itself (opened, paused, stopped).
-   * - sink_handle_l2cap_media_data_packet - used to receive streaming SBC data.
-   * - sink_avrcp_packet_handler - receives connect/disconnect event.
-   * - sink_avrcp_controller_packet_handler - receives answers for sent AVRCP
+   * - handle_l2cap_media_data_packet - used to receive streaming SBC data.
+   * - avrcp_packet_handler - receives connect/disconnect event.
+   * - avrcp_controller_packet_handler - receives answers for sent AVRCP
    * commands.
-   * - sink_avrcp_target_packet_handler - receives AVRCP commands, and
+   * - avrcp_target_packet_handler - receives AVRCP commands, and
    * registered notifications.
    *
    * @text To announce A2DP Sink and AVRCP services, you need to create
    * corresponding SDP records and register them with the SDP service.
    *
-   * @text Note, currently only the SBC codec is supported.
+   * @text A stream endpoint is created for each registered decoder and
+   * connection, because an endpoint can only be used by one phone.
    */
 
   bool a2dp_and_avrcp_setup(void) {
     LOGI("a2dp_and_avrcp_setup");
-    l2cap_init();
-    // Initialize SDP
-    sdp_init();
+    A2DPStack.begin(isBLEEnabled());
+
+    // SBC is mandatory: we provide it if no SBC decoder was registered
+    if (decoders.size() == 0) decoders.add(*p_decoder);
+    if (!decoders.contains(AVDTP_CODEC_SBC)) decoders.add(decoder_sbc, -1);
+    p_decoder = decoders.first();
+
+    // Initialize AVDTP Sink: this checks the endpoints of the decoders
+    if (!A2DPStack.addRole(*this)) return false;
+
+    // Create a stream endpoint for each decoder and connection
+    for (int l = 0; l < SINK_MAX_LINKS; l++) {
+      for (int j = 0; j < decoders.size(); j++) {
+        A2DPDecoder &dec = *decoders[j].p_codec;
+        avdtp_stream_endpoint_t *local_stream_endpoint =
+            a2dp_sink_create_stream_endpoint(
+                AVDTP_AUDIO, dec.codecType(), dec.codecCapabilities(),
+                dec.codecCapabilitiesSize(), dec.config(), dec.configSize());
+        if (!local_stream_endpoint) {
+          LOGE(
+              "A2DP Sink: not enough memory to create local stream "
+              "endpoint\n");
+          return false;
+        }
 
-#ifdef ENABLE_BLE
-    if (isBLEEnabled()) {
-      // Initialize LE Security Manager. Needed for cross-transport key
-      // derivation
-      sm_init();
-    }
-#endif
-    // Initialize AVDTP Sink
-    a2dp_sink_init();
-    a2dp_sink_register_packet_handler(&sink_a2dp_packet_handler);
-    a2dp_sink_register_media_handler(&sink_handle_l2cap_media_data_packet);
-
-    // Create stream endpoint
-    a2dp_sink_arduino_stream_endpoint_t *stream_endpoint =
-        &a2dp_sink_arduino_stream_endpoint;
-    A2DPDecoder &dec = get_decoder();
-    avdtp_stream_endpoint_t *local_stream_endpoint =
-        a2dp_sink_create_stream_endpoint(
-            AVDTP_AUDIO, dec.codecType(), dec.codecCapabilities(),
-            dec.codecCapabilitiesSize(), dec.config(), dec.configSize());
-    if (!local_stream_endpoint) {
-      LOGE("A2DP Sink: not enough memory to create local stream endpoint\n");
-      return 1;
+        // Store stream enpoint's SEP ID, as it is used by A2DP API to
+        // identify the stream endpoint
+        uint8_t seid = avdtp_local_seid(local_stream_endpoint);
+        decoders[j].setSeid(l, seid);
+        avdtp_sink_register_delay_reporting_category(seid);
+        LOGI("A2DP Sink: codec %d with local seid %d for connection %d",
+             dec.codecType(), seid, l);
+      }
     }
 
-    // Store stream enpoint's SEP ID, as it is used by A2DP API to identify
-    // the stream endpoint
-    stream_endpoint->a2dp_local_seid = avdtp_local_seid(local_stream_endpoint);
-
-    // Initialize AVRCP service
-    avrcp_init();
-    avrcp_register_packet_handler(&sink_avrcp_packet_handler);
-
-    // Initialize AVRCP Controller
-    avrcp_controller_init();
-    avrcp_controller_register_packet_handler(
-        &sink_avrcp_controller_packet_handler);
-
-    // Initialize AVRCP Target
-    avrcp_target_init();
-    avrcp_target_register_packet_handler(&sink_avrcp_target_packet_handler);
-
     // Create A2DP Sink service record and register it with SDP
     memset(sdp_avdtp_sink_service_buffer, 0,
            sizeof(sdp_avdtp_sink_service_buffer));
-    a2dp_sink_create_sdp_record(sdp_avdtp_sink_service_buffer, 0x10001,
+    a2dp_sink_create_sdp_record(sdp_avdtp_sink_service_buffer,
+                                A2DPStack.nextServiceHandle(),
                                 AVDTP_SINK_FEATURE_MASK_HEADPHONE, NULL, NULL);
     sdp_register_service(sdp_avdtp_sink_service_buffer);
 
-    // Create AVRCP Controller service record and register it with SDP. We
-    // send Category 1 commands to the media player, e.g. play/pause
-    memset(sdp_avrcp_controller_service_buffer, 0,
-           sizeof(sdp_avrcp_controller_service_buffer));
+    // We send Category 1 commands to the media player, e.g. play/pause, and
+    // receive Category 2 commands from the media player, e.g. volume up/down
     uint16_t controller_supported_features =
         AVRCP_FEATURE_MASK_CATEGORY_PLAYER_OR_RECORDER;
 #ifdef AVRCP_BROWSING_ENABLED
     controller_supported_features |= AVRCP_FEATURE_MASK_BROWSING;
 #endif
-    avrcp_controller_create_sdp_record(sdp_avrcp_controller_service_buffer,
-                                       0x10002, controller_supported_features,
-                                       NULL, NULL);
-    sdp_register_service(sdp_avrcp_controller_service_buffer);
-
-    // Create AVRCP Target service record and register it with SDP. We receive
-    // Category 2 commands from the media player, e.g. volume up/down
-    memset(sdp_avrcp_target_service_buffer, 0,
-           sizeof(sdp_avrcp_target_service_buffer));
-    uint16_t target_supported_features =
-        AVRCP_FEATURE_MASK_CATEGORY_MONITOR_OR_AMPLIFIER;
-    avrcp_target_create_sdp_record(sdp_avrcp_target_service_buffer, 0x10003,
-                                   target_supported_features, NULL, NULL);
-    sdp_register_service(sdp_avrcp_target_service_buffer);
-
-    // Create Device ID (PnP) service record and register it with SDP
-    memset(device_id_sdp_service_buffer, 0,
-           sizeof(device_id_sdp_service_buffer));
-    device_id_create_sdp_record(device_id_sdp_service_buffer, 0x10004,
-                                DEVICE_ID_VENDOR_ID_SOURCE_BLUETOOTH,
-                                BLUETOOTH_COMPANY_ID_BLUEKITCHEN_GMBH, 1, 1);
-    sdp_register_service(device_id_sdp_service_buffer);
+    A2DPStack.addAvrcpFeatures(controller_supported_features,
+                               AVRCP_FEATURE_MASK_CATEGORY_MONITOR_OR_AMPLIFIER);
 
     // Set local name with a template Bluetooth address, that will be
     // automatically replaced with an actual address once it is available,
     // i.e. when BTstack boots up and starts talking to a Bluetooth module.
-    gap_set_local_name(a2dp_name);
+    // Service Class: Audio, Major Device Class: Audio, Minor: Loudspeaker
+    A2DPStack.setDeviceInfo(a2dp_name, 0x200414);
 
     // allot to show up in Bluetooth inquiry
     gap_discoverable_control(1);
 
-    // Service Class: Audio, Major Device Class: Audio, Minor: Loudspeaker
-    gap_set_class_of_device(0x200414);
-
     // allow for role switch in general and sniff mode
     gap_set_default_link_policy_settings(LM_LINK_POLICY_ENABLE_ROLE_SWITCH |
                                          LM_LINK_POLICY_ENABLE_SNIFF_MODE);
@@ -356,20 +682,17 @@ class A2DPSinkClass : public A2DPCommon {
     // Source, e.g. smartphone, to become master when we re-connect to it
     gap_set_allow_role_switch(true);
 
-    // Register for HCI events
-#if defined(RP2040_HOWER)
-    _hci.install();
-    _hci.begin();
-#else
-    hci_event_callback_registration.callback = &sink_hci_packet_handler;
-    hci_add_event_handler(&hci_event_callback_registration);
-#endif
     is_active = true;
     return true;
   }
 
   bool media_processing_init() {
     LOGI("media_processing_init");
+    if (stop_pending == STOP_CLOSE) {
+      // we continue when the worker has finished
+      is_init_pending = true;
+      return false;
+    }
     if (media_initialized) return false;
 
     auto &dec = get_decoder();
@@ -381,16 +704,40 @@ class A2DPSinkClass : public A2DPCommon {
     cfgd.copyFrom(cfg);
     dec_stream.begin(cfgd);
 
-    // setup volume output
-    auto vcfg = volume_stream.defaultConfig();
-    vcfg.copyFrom(cfg);
-    vcfg.allow_boost = true;
-    vcfg.volume = volume_as_float(volume_percentage);
-    volume_stream.begin(vcfg);
+    // setup volume: this is applied by the resampler unless we scale the
+    // SBC frames, where the resampler only applies the residual gain
+    volume_control.begin(cfg.channels);
+    residual_volume.begin(cfg.channels);
     avrcp_volume_changed(volume_percentage);
+    resampler.setVolume(is_compressed_volume ? residual_volume
+                                             : volume_control);
+
+    // setup jitter buffer
+    playback_sample_rate = cfg.sample_rate;
+    playback_frame_samples =
+        dec.frameLengthDecoded() / (cfg.channels * sizeof(int16_t));
+    // the default range is defined for SBC frames (max 128 samples): codecs
+    // with longer frames (e.g. AAC with 1024 samples) need less frames
+    if (dec.codecType() != AVDTP_CODEC_SBC && playback_frame_samples > 128) {
+      int scale = (playback_frame_samples + 127) / 128;
+      jitter_buffer.setRange(OPTIMAL_FRAMES_MIN / scale + 1,
+                             OPTIMAL_FRAMES_MAX / scale + 1);
+    } else {
+      // the range of a previous AAC stream must not be used for SBC
+      jitter_buffer.setRange(OPTIMAL_FRAMES_MIN, OPTIMAL_FRAMES_MAX);
+    }
+    jitter_buffer.begin(
+        playback_frame_samples * 1000000 / playback_sample_rate,
+        dec.maxFrameLength());
+    playback_frame.resize(dec.maxFrameLength());
+    concealment.begin(cfg, playback_frame_samples);
+    resampler.begin(cfg);
+    drift_controller.begin();
+    is_first_media_packet = true;
 
     audio_stream_started = false;
     media_initialized = true;
+    // the decoding is started by the first media packet
     return true;
   }
 
@@ -400,72 +747,310 @@ class A2DPSinkClass : public A2DPCommon {
 
     dec_stream.begin();
     audio_stream_started = true;
+    if (switch_start_ms > 0) {
+      timing_info.switch_ms = millis() - switch_start_ms;
+      LOGI("A2DP  Sink      : switched in %d ms", (int)timing_info.switch_ms);
+      switch_start_ms = 0;
+    }
   }
 
   void media_processing_pause(void) {
     LOGI("media_processing_pause");
     if (!media_initialized) return;
-    // stop audio playback
-    audio_stream_started = false;
+    // stop audio playback: the decoding stays suspended until we receive
+    // media packets again
+    suspend_decoding(STOP_PAUSE);
   }
 
   void media_processing_close(void) {
     LOGI("media_processing_close");
     if (!media_initialized) return;
-    media_initialized = false;
+    is_init_pending = false;
+    suspend_decoding(STOP_CLOSE);
+  }
+
+  /// Starts the decoding either with the playback timer or in the worker
+  void resume_decoding() {
+    playback_time_ms = millis();
+    playback_samples_due = 0;
+    decoding_active = true;
+    if (!is_decode_in_worker) playback_timer_start();
+  }
+
+  /// Stops the decoding: if the worker is still decoding a frame, the stop
+  /// is completed by the stop timer, so that the run loop is not blocked
+  void suspend_decoding(int action) {
+    decoding_active = false;
+    if (action > stop_pending) stop_pending = action;
+    if (!is_decode_in_worker) {
+      playback_timer_stop();
+    } else if (worker_busy) {
+      btstack_run_loop_remove_timer(&stop_timer);
+      btstack_run_loop_set_timer_handler(&stop_timer,
+                                         sink_stop_timeout_handler);
+      btstack_run_loop_set_timer_context(&stop_timer, this);
+      btstack_run_loop_set_timer(&stop_timer, 1);
+      btstack_run_loop_add_timer(&stop_timer);
+      return;
+    }
+    complete_stop();
+  }
+
+  /// Releases the data which is shared with the worker
+  void complete_stop() {
+    int action = stop_pending;
+    stop_pending = STOP_NONE;
     audio_stream_started = false;
-    sbc_frame_size = 0;
+    if (action == STOP_PAUSE) {
+      jitter_buffer.clear();
+    } else if (action == STOP_CLOSE) {
+      media_initialized = false;
+      sbc_frame_size = 0;
+      jitter_buffer.end();
+      concealment.end();
+      dec_stream.end();
+    }
+    if (is_init_pending) {
+      is_init_pending = false;
+      media_processing_init();
+    }
+  }
 
-    dec_stream.end();
+  void stop_timeout_handler(btstack_timer_source_t *timer) {
+    if (worker_busy) {
+      btstack_run_loop_set_timer(timer, 1);
+      btstack_run_loop_add_timer(timer);
+      return;
+    }
+    complete_stop();
+  }
+
+  void playback_timer_start() {
+    TRACED();
+    btstack_run_loop_remove_timer(&playback_timer);
+    btstack_run_loop_set_timer_handler(&playback_timer,
+                                       sink_playback_timeout_handler);
+    btstack_run_loop_set_timer_context(&playback_timer, this);
+    btstack_run_loop_set_timer(&playback_timer, SINK_PLAYBACK_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&playback_timer);
+  }
+
+  void playback_timer_stop() {
+    TRACED();
+    btstack_run_loop_remove_timer(&playback_timer);
+  }
+
+  void playback_timeout_handler(btstack_timer_source_t *timer) {
+    btstack_run_loop_set_timer(timer, SINK_PLAYBACK_TIMEOUT_MS);
+    btstack_run_loop_add_timer(timer);
+    decode_due_frames(millis());
+  }
+
+  /**
+   * @brief Decodes the SBC frames from the jitter buffer which are due since
+   * the last call. The elapsed time is accounted in 1/1000 output samples,
+   * so that no rounding errors accumulate: because of the drift
+   * compensation a frame can produce a few samples more or less.
+   * Returns the number of decoded frames.
+   */
+  int decode_due_frames(uint32_t now) {
+    uint32_t elapsed_ms = now - playback_time_ms;
+    playback_time_ms = now;
+
+    if (!jitter_buffer.updateReady()) {
+      // hold playback until the low-water mark is reached again
+      audio_stream_started = false;
+      playback_samples_due = 0;
+      return 0;
+    }
+    if (!audio_stream_started) {
+      media_processing_start();
+    }
+
+    int result = 0;
+    playback_samples_due += elapsed_ms * playback_sample_rate;
+    int32_t frame_units = playback_frame_samples * 1000;
+    while (playback_samples_due >= frame_units) {
+      uint32_t start = micros();
+      int len =
+          jitter_buffer.read(playback_frame.data(), playback_frame.size());
+      if (len == 0) {
+        playback_samples_due = 0;
+        break;
+      }
+      uint32_t output_frames = resampler.outputFrames();
+      if (len == A2DPJitterBuffer::LOST_FRAME) {
+        concealment.conceal(1);
+      } else {
+        if (is_compressed_volume)
+          apply_compressed_volume(playback_frame.data(), len);
+        dec_stream.write(playback_frame.data(), len);
+      }
+      int32_t produced = (resampler.outputFrames() - output_frames) * 1000;
+      if (produced == 0) produced = frame_units;
+      playback_samples_due -= produced;
+      result++;
+
+      if (is_drift_compensation) {
+        resampler.setRatioPpm(drift_controller.update(
+            jitter_buffer.available(), jitter_buffer.targetFrames()));
+      }
+
+      uint32_t time_us = micros() - start;
+      decode_time_us += time_us;
+      decode_frames++;
+      if (time_us > timing_info.decode_max_us)
+        timing_info.decode_max_us = time_us;
+    }
+    return result;
+  }
+
+  /**
+   * @brief Splits the actual volume into a power of 2 which is applied to
+   * the scale factors of the encoded frame and a residual gain >= 0.5 which
+   * is applied to the PCM samples. If the frame can not be scaled, the
+   * full gain is applied to the PCM samples.
+   */
+  void apply_compressed_volume(uint8_t *frame, int len) {
+    int32_t gain = volume_control.advance(playback_frame_samples);
+    int32_t residual = gain;
+    int shift = 0;
+    if (gain > 0) {
+      while (residual < A2DPVolume::Q15_ONE / 2 && shift < 15) {
+        residual <<= 1;
+        shift++;
+      }
+      if (is_coarse_volume) {
+        // round to the nearest 6 dB step: 23170 is 1/sqrt(2)
+        if (residual < 23170 && shift < 15) shift++;
+        residual = A2DPVolume::Q15_ONE;
+      }
+    }
+    if (shift > 0 && get_decoder().scaleVolume(frame, len, shift)) {
+      residual_volume.setGain(residual, false);
+    } else {
+      residual_volume.setGain(gain, false);
+    }
   }
 
   /**
    * @brief Here the audio data, are received through the
-   * sink_handle_l2cap_media_data_packet callback. Currently, only the SBC media
+   * handle_l2cap_media_data_packet callback. Currently, only the SBC media
    * codec is supported. Hence, the media data consists of the media packet
-   * header and the SBC packet. The SBC frame will be stored in a ring buffer
-   * for later processing (instead of decoding it to PCM right away which
-   * would require a much larger buffer). If the audio stream wasn't started
-   * already and there are enough SBC frames in the ring buffer, start
-   * playback.
+   * header and the SBC packet. The SBC frames will be stored in the jitter
+   * buffer for later processing (instead of decoding them to PCM right away
+   * which would require a much larger buffer). The playback timer starts
+   * the audio stream when there are enough SBC frames in the jitter buffer.
    */
 
   void handle_l2cap_media_data_packet(uint8_t seid, uint8_t *packet,
                                       uint16_t size) {
-    LOGI("handle_l2cap_media_data_packet");
+    LOGD("handle_l2cap_media_data_packet");
+    // only the active phone is played
+    if (p_active == nullptr || seid != p_active->a2dp_local_seid) return;
+    uint32_t start = micros();
     int pos = 0;
     //   avdtp_media_packet_header_t media_header;
     avdtp_media_packet_header_t media_header;
     if (!read_media_data_header(packet, size, &pos, &media_header)) return;
-    avdtp_sbc_codec_header_t sbc_header;
-    if (!read_sbc_header(packet, size, &pos, &sbc_header)) return;
 
-    // store sbc frame size for buffer management
-    sbc_frame_size = (size - pos) / sbc_header.num_frames;
-    dec_stream.write(packet + pos, size - pos);
+    // the decoder knows the payload format (e.g. SBC header + frames)
+    uint8_t *frames = nullptr;
+    int frame_size = 0;
+    int num_frames =
+        get_decoder().readFrames(packet + pos, size - pos, frames, frame_size);
+    if (num_frames == 0) return;
+    if (!check_sequence(media_header, num_frames)) return;
+    if (write_frame_output(frames, frame_size, num_frames)) return;
+
+    // store frame size for buffer management
+    sbc_frame_size = frame_size;
+    jitter_buffer.write(frames, frame_size, num_frames, start);
+    if (media_initialized && !decoding_active && stop_pending == STOP_NONE)
+      resume_decoding();
+    send_delay_report(false);
+
+    uint32_t time_us = micros() - start;
+    receive_time_us += time_us;
+    receive_frames += num_frames;
+    uint32_t time_per_frame = time_us / num_frames;
+    if (time_per_frame > timing_info.receive_max_us)
+      timing_info.receive_max_us = time_per_frame;
   }
 
-  bool read_sbc_header(uint8_t *packet, int size, int *offset,
-                      avdtp_sbc_codec_header_t *sbc_header) {
-    LOGI("read_sbc_header");
-    int sbc_header_len = 12;  // without crc
-    int pos = *offset;
+  /**
+   * @brief Reports the actual buffer depth to the source. Updates are limited
+   * to one per SINK_DELAY_REPORT_INTERVAL_MS and are only sent when the delay
+   * has changed by SINK_DELAY_REPORT_MIN_CHANGE_US.
+   */
+  void send_delay_report(bool force,
+                         a2dp_sink_arduino_a2dp_connection_t *conn = nullptr) {
+    if (conn == nullptr) conn = p_active;
+    if (conn == nullptr || conn->a2dp_cid == 0) return;
+    if (conn->stream_state == STREAM_STATE_CLOSED) return;
+    uint32_t now = millis();
+    if (!force && now - delay_report_time_ms < SINK_DELAY_REPORT_INTERVAL_MS)
+      return;
+    uint32_t delay_us = delayUs();
+    int32_t change = (int32_t)(delay_us - last_reported_delay_us);
+    if (!force && abs(change) < SINK_DELAY_REPORT_MIN_CHANGE_US) return;
+
+    // the delay is reported in 1/10 ms
+    uint32_t delay_100us = delay_us / 100;
+    if (delay_100us > 0xFFFF) delay_100us = 0xFFFF;
+    LOGI("A2DP  Sink      : Delay report %d.%d ms", (int)delay_100us / 10,
+         (int)delay_100us % 10);
+    a2dp_sink_delay_report(conn->a2dp_cid, conn->a2dp_local_seid,
+                           delay_100us);
+    delay_report_time_ms = now;
+    last_reported_delay_us = delay_us;
+  }
 
-    if (size - pos < sbc_header_len) {
-      LOGW("Not enough data to read SBC header, expected %d, received %d",
-           sbc_header_len, size - pos);
-      return false;
+  /**
+   * @brief Detects lost and duplicate packets from the RTP sequence number.
+   * The number of lost frames is determined from the timestamp delta (in
+   * samples) and recorded in the jitter buffer, so that they can be
+   * concealed. Returns false if the packet needs to be ignored.
+   */
+  bool check_sequence(avdtp_media_packet_header_t &header, int numFrames) {
+    if (is_first_media_packet) {
+      is_first_media_packet = false;
+    } else {
+      uint16_t delta = header.sequence_number - last_sequence_number;
+      if (delta == 0 || delta >= 0x8000) {
+        LOGW("Duplicate or late packet: %d", header.sequence_number);
+        duplicate_packets++;
+        return false;
+      }
+      if (delta > 1) {
+        int lost = delta - 1;
+        lost_packets += lost;
+        int lost_frames = lost_frame_count(header.timestamp, lost);
+        LOGW("%d packets lost: concealing %d frames", lost, lost_frames);
+        if (!is_frame_passthrough) jitter_buffer.writeLost(lost_frames);
+      }
     }
-
-    sbc_header->fragmentation = get_bit16(packet[pos], 7);
-    sbc_header->starting_packet = get_bit16(packet[pos], 6);
-    sbc_header->last_packet = get_bit16(packet[pos], 5);
-    sbc_header->num_frames = packet[pos] & 0x0f;
-    pos++;
-    *offset = pos;
+    last_sequence_number = header.sequence_number;
+    last_timestamp = header.timestamp;
+    last_num_frames = numFrames;
     return true;
   }
 
+  /// Determines the missing frames from the timestamp: if the timestamp is
+  /// not plausible we assume that the lost packets had the same size as the
+  /// last one.
+  int lost_frame_count(uint32_t timestamp, int lostPackets) {
+    int estimate = lostPackets * last_num_frames;
+    int frame_samples = playback_frame_samples;
+    if (frame_samples == 0) return 0;
+    int32_t missing_samples = (int32_t)(timestamp - last_timestamp) -
+                              last_num_frames * frame_samples;
+    int frames = (missing_samples + frame_samples / 2) / frame_samples;
+    // a packet can contain at most 15 SBC frames
+    if (frames <= 0 || frames > lostPackets * 15) frames = estimate;
+    return frames > MAX_CONCEALED_FRAMES ? MAX_CONCEALED_FRAMES : frames;
+  }
+
   bool read_media_data_header(uint8_t *packet, int size, int *offset,
                              avdtp_media_packet_header_t *media_header) {
     LOGI("read_media_data_header");
@@ -511,8 +1096,7 @@ class A2DPSinkClass : public A2DPCommon {
     uint16_t local_cid;
     uint8_t status;
     bd_addr_t address;
-    a2dp_sink_arduino_avrcp_connection_t *connection =
-        &a2dp_sink_arduino_avrcp_connection;
+    a2dp_sink_arduino_avrcp_connection_t *connection = nullptr;
 
     if (packet_type != HCI_EVENT_PACKET) return;
     if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META) return;
@@ -523,12 +1107,23 @@ class A2DPSinkClass : public A2DPCommon {
         status = avrcp_subevent_connection_established_get_status(packet);
         if (status != ERROR_CODE_SUCCESS) {
           LOGE("AVRCP: Connection failed: status 0x%02x", status);
-          connection->avrcp_cid = 0;
           return;
         }
 
+        for (auto &avrcp : avrcp_connections) {
+          if (avrcp.avrcp_cid == 0) {
+            connection = &avrcp;
+            break;
+          }
+        }
+        if (connection == nullptr) {
+          LOGW("AVRCP: max %d connections", SINK_MAX_LINKS);
+          return;
+        }
         connection->avrcp_cid = local_cid;
+        connection->playing = false;
         avrcp_subevent_connection_established_get_bd_addr(packet, address);
+        memcpy(connection->addr, address, 6);
         LOGI("AVRCP: Connected to %s, cid 0x%02x\n", bd_addr_to_str(address),
              connection->avrcp_cid);
 
@@ -556,9 +1151,10 @@ class A2DPSinkClass : public A2DPCommon {
       }
 
       case AVRCP_SUBEVENT_CONNECTION_RELEASED:
-        LOGI("AVRCP: Channel released: cid 0x%02x",
-             avrcp_subevent_connection_released_get_avrcp_cid(packet));
-        connection->avrcp_cid = 0;
+        local_cid = avrcp_subevent_connection_released_get_avrcp_cid(packet);
+        LOGI("AVRCP: Channel released: cid 0x%02x", local_cid);
+        connection = get_avrcp(local_cid);
+        if (connection != nullptr) *connection = {};
         return;
       default:
         break;
@@ -581,12 +1177,21 @@ class A2DPSinkClass : public A2DPCommon {
 
     switch (packet[2]) {
       case AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED:
+        // the phone which is not played does not change the volume
+        if (avrcp_subevent_notification_volume_changed_get_avrcp_cid(packet) !=
+            get_avrcp_cid())
+          break;
         volume = avrcp_subevent_notification_volume_changed_get_absolute_volume(
             packet);
         volume_percentage = volume_to_percent(volume);
         LOGI("AVRCP Target    : Volume set to %d%% (%d)", volume_percentage,
              volume);
-        avrcp_volume_changed(volume);
+        // relay: the volume is applied by the speaker
+        if (p_frame_output != nullptr) {
+          p_frame_output->setFrameVolume(volume_percentage);
+          break;
+        }
+        avrcp_absolute_volume_changed(volume);
         break;
 
       case AVRCP_SUBEVENT_OPERATION:
@@ -613,20 +1218,6 @@ class A2DPSinkClass : public A2DPCommon {
     }
   }
 
-  virtual void hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                                  uint8_t *packet, uint16_t size) {
-    LOGI("hci_packet_handler");
-    UNUSED(channel);
-    UNUSED(size);
-    if (packet_type != HCI_EVENT_PACKET) return;
-    if (hci_event_packet_get_type(packet) == HCI_EVENT_PIN_CODE_REQUEST) {
-      bd_addr_t address;
-      LOGI("Pin code request - using '0000'");
-      hci_event_pin_code_request_get_bd_addr(packet, address);
-      gap_pin_code_response(address, "0000");
-    }
-  }
-
   virtual void a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
                                    uint8_t *packet, uint16_t size) {
     LOGD("a2dp_packet_handler");
@@ -634,13 +1225,11 @@ class A2DPSinkClass : public A2DPCommon {
     UNUSED(size);
     bd_addr_t address;
     uint8_t status;
-    auto &dec = get_decoder();
 
     if (packet_type != HCI_EVENT_PACKET) return;
     if (hci_event_packet_get_type(packet) != HCI_EVENT_A2DP_META) return;
 
-    a2dp_sink_arduino_a2dp_connection_t *a2dp_conn =
-        &a2dp_sink_arduino_a2dp_connection;
+    a2dp_sink_arduino_a2dp_connection_t *a2dp_conn = nullptr;
 
     switch (packet[2]) {
     case A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED: {
@@ -651,20 +1240,48 @@ class A2DPSinkClass : public A2DPCommon {
 
         if (status != ERROR_CODE_SUCCESS) {
             LOGE("A2DP Source: Connection failed, status 0x%02x", status);
+            break;
         }
+        a2dp_conn = add_connection(cid);
+        if (a2dp_conn == nullptr) {
+          LOGW("A2DP  Sink      : max %d phones: disconnecting %s",
+               SINK_MAX_LINKS, bd_addr_to_str(address));
+          a2dp_sink_disconnect(cid);
+          break;
+        }
+        memcpy(a2dp_conn->addr, address, 6);
         } break;
 
+      case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_MPEG_AAC_CONFIGURATION:
+        LOGI("A2DP  Sink      : MPEG_AAC_CONFIGURATION");
+        store_configuration(
+            a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_a2dp_cid(
+                packet),
+            a2dp_subevent_signaling_media_codec_mpeg_aac_configuration_get_local_seid(
+                packet),
+            packet, size);
+        break;
       case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_OTHER_CONFIGURATION:
-        LOGI("A2DP  Sink      : Received non SBC codec - not implemented");
+        LOGI("A2DP  Sink      : OTHER_CONFIGURATION");
+        store_configuration(
+            a2dp_subevent_signaling_media_codec_other_configuration_get_a2dp_cid(
+                packet),
+            a2dp_subevent_signaling_media_codec_other_configuration_get_local_seid(
+                packet),
+            packet, size);
         break;
-      case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION: {
+      case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION:
         LOGI("A2DP  Sink      : SBC_CONFIGURATION");
-        dec.setValues(packet, size);
+        store_configuration(
+            a2dp_subevent_signaling_media_codec_sbc_configuration_get_a2dp_cid(
+                packet),
+            a2dp_subevent_signaling_media_codec_sbc_configuration_get_local_seid(
+                packet),
+            packet, size);
         break;
-      }
       case A2DP_SUBEVENT_STREAM_ESTABLISHED:
         LOGI("A2DP  Sink      : A2DP_SUBEVENT_STREAM_ESTABLISHED");
-        a2dp_subevent_stream_established_get_bd_addr(packet, a2dp_conn->addr);
+        a2dp_subevent_stream_established_get_bd_addr(packet, address);
 
         status = a2dp_subevent_stream_established_get_status(packet);
         if (status != ERROR_CODE_SUCCESS) {
@@ -673,8 +1290,10 @@ class A2DPSinkClass : public A2DPCommon {
           break;
         }
 
-        a2dp_conn->a2dp_cid =
-            a2dp_subevent_stream_established_get_a2dp_cid(packet);
+        a2dp_conn = add_connection(
+            a2dp_subevent_stream_established_get_a2dp_cid(packet));
+        if (a2dp_conn == nullptr) break;
+        memcpy(a2dp_conn->addr, address, 6);
         a2dp_conn->stream_state = STREAM_STATE_OPEN;
 
         LOGI(
@@ -683,6 +1302,8 @@ class A2DPSinkClass : public A2DPCommon {
             "cid 0x%02X, local seid %d",
             bd_addr_to_str(address), a2dp_conn->a2dp_cid,
             a2dp_conn->a2dp_local_seid);
+        // initial delay report
+        send_delay_report(true, a2dp_conn);
         break;
 
 #ifdef ENABLE_AVDTP_ACCEPTOR_EXPLICIT_START_STREAM_CONFIRMATION
@@ -692,16 +1313,25 @@ class A2DPSinkClass : public A2DPCommon {
             "0x%02x",
             a2dp_subevent_start_stream_requested_get_local_seid(packet));
         // ps
-        a2dp_sink_start_stream_accept(a2dp_conn->a2dp_cid,
-                                      a2dp_conn->a2dp_local_seid);
+        a2dp_sink_start_stream_accept(
+            a2dp_subevent_start_stream_requested_get_a2dp_cid(packet),
+            a2dp_subevent_start_stream_requested_get_local_seid(packet));
         break;
 #endif
       case A2DP_SUBEVENT_STREAM_STARTED: {
         LOGI("A2DP  Sink      : Stream started");
-        auto &dec = get_decoder();
+        a2dp_conn =
+            get_connection(a2dp_subevent_stream_started_get_a2dp_cid(packet));
+        if (a2dp_conn == nullptr) break;
         a2dp_conn->stream_state = STREAM_STATE_PLAYING;
-        if (dec.isReconfigure()) {
-          media_processing_close();
+        if (a2dp_conn != p_active) {
+          if (p_active != nullptr && !is_switch_to_latest &&
+              p_active->stream_state == STREAM_STATE_PLAYING) {
+            LOGI("A2DP  Sink      : %s keeps playing",
+                 bd_addr_to_str(p_active->addr));
+            break;
+          }
+          activate_connection(a2dp_conn);
         }
         // prepare media processing
         media_processing_init();
@@ -710,20 +1340,39 @@ class A2DPSinkClass : public A2DPCommon {
 
       case A2DP_SUBEVENT_STREAM_SUSPENDED:
         LOGI("A2DP  Sink      : Stream paused");
+        a2dp_conn =
+            get_connection(a2dp_subevent_stream_suspended_get_a2dp_cid(packet));
+        if (a2dp_conn == nullptr) break;
         a2dp_conn->stream_state = STREAM_STATE_PAUSED;
+        if (a2dp_conn != p_active) break;
+        end_frame_output();
         media_processing_pause();
+        activate_playing_connection();
         break;
 
       case A2DP_SUBEVENT_STREAM_RELEASED:
         LOGI("A2DP  Sink      : Stream released");
+        a2dp_conn =
+            get_connection(a2dp_subevent_stream_released_get_a2dp_cid(packet));
+        if (a2dp_conn == nullptr) break;
         a2dp_conn->stream_state = STREAM_STATE_CLOSED;
+        if (a2dp_conn != p_active) break;
+        end_frame_output();
         media_processing_close();
+        activate_playing_connection();
         break;
 
       case A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED:
         LOGI("A2DP  Sink      : Signaling connection released");
-        a2dp_conn->a2dp_cid = 0;
+        a2dp_conn = get_connection(
+            a2dp_subevent_signaling_connection_released_get_a2dp_cid(packet));
+        if (a2dp_conn == nullptr) break;
+        *a2dp_conn = a2dp_sink_arduino_a2dp_connection_t();
+        if (a2dp_conn != p_active) break;
+        p_active = nullptr;
+        end_frame_output();
         media_processing_close();
+        activate_playing_connection();
         break;
 
       default:
@@ -732,38 +1381,35 @@ class A2DPSinkClass : public A2DPCommon {
     }
   }
 
-} A2DPSink;
-
-// -- Implement Callback functions which forward calls to A2DPSink
-
-void sink_hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                             uint8_t *packet, uint16_t size) {
-  A2DPSink.hci_packet_handler(packet_type, channel, packet, size);
-}
+  /// The active phone has stopped: we continue with another phone which is
+  /// streaming
+  void activate_playing_connection() {
+    a2dp_sink_arduino_a2dp_connection_t *p_next = get_playing_connection();
+    if (p_next == nullptr) return;
+    activate_connection(p_next);
+    media_processing_init();
+  }
 
-void sink_a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
-                              uint8_t *packet, uint16_t event_size) {
-  A2DPSink.a2dp_packet_handler(packet_type, channel, packet, event_size);
-}
+};
 
-void sink_handle_l2cap_media_data_packet(uint8_t seid, uint8_t *packet,
-                                         uint16_t size) {
-  A2DPSink.handle_l2cap_media_data_packet(seid, packet, size);
+/// Provides the single A2DPSinkClass object: it is shared by all
+/// translation units, so the header can be included more than once
+inline A2DPSinkClass &getA2DPSink() {
+  static A2DPSinkClass sink;
+  return sink;
 }
+static A2DPSinkClass &A2DPSink = getA2DPSink();
 
-void sink_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                               uint8_t *packet, uint16_t size) {
-  A2DPSink.avrcp_packet_handler(packet_type, channel, packet, size);
-}
+// -- Implement Callback functions which forward calls to the A2DPSinkClass
 
-void sink_avrcp_controller_packet_handler(uint8_t packet_type, uint16_t channel,
-                                          uint8_t *packet, uint16_t size) {
-  A2DPSink.avrcp_controller_packet_handler(packet_type, channel, packet, size);
+inline void sink_playback_timeout_handler(btstack_timer_source_t *timer) {
+  ((A2DPSinkClass *)btstack_run_loop_get_timer_context(timer))
+      ->playback_timeout_handler(timer);
 }
 
-void sink_avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel,
-                                      uint8_t *packet, uint16_t size) {
-  A2DPSink.avrcp_target_packet_handler(packet_type, channel, packet, size);
+inline void sink_stop_timeout_handler(btstack_timer_source_t *timer) {
+  ((A2DPSinkClass *)btstack_run_loop_get_timer_context(timer))
+      ->stop_timeout_handler(timer);
 }
 
 }  // namespace btstack_a2dp
\ No newline at end of file
@@ -47,9 +47,9 @@
  * played media, as well as to handle remote playback control, i.e. play, stop,
  * repeat, etc.
  *
- * @text To test with a remote device, e.g. a Bluetooth speaker,
- * set the device_addr_string to the Bluetooth address of your
- * remote device in the code, and use the UI to connect and start playback.
+ * @text The speakers which were connected before are reconnected directly:
+ * an inquiry for a Bluetooth speaker is only started if none of them
+ * answers. Additional speakers can be defined with addKnownSink().
  *
  * @text For more info on BTstack audio, see our blog post
  * [A2DP Sink and Source on STM32 F4 Discovery
@@ -60,38 +60,38 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "A2DPBitpoolController.h"
 #include "A2DPCommon.h"
+#include "A2DPPacketPool.h"
+#include "A2DPStack.h"
 
 namespace btstack_a2dp {
 
 // -- Declare Source Callback functions
 
-extern "C" void source_a2dp_audio_timeout_handler(btstack_timer_source_t *timer);
-
-extern "C" void source_a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                uint8_t *event, uint16_t event_size);
-
-extern "C" void source_a2dp_configure_sample_rate(int sample_rate);
-extern "C" void source_avrcp_controller_packet_handler(uint8_t packet_type,
-                                            uint16_t channel, uint8_t *packet,
-                                            uint16_t size);
-extern "C" void source_avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel,
-                                        uint8_t *packet, uint16_t size);
-
-extern "C" void source_hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                               uint8_t *packet, uint16_t size);
-
-extern "C" void source_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                 uint8_t *packet, uint16_t size);
+extern "C" inline void source_a2dp_audio_timeout_handler(
+    btstack_timer_source_t *timer);
 
+/**
+ * @brief Statistics of the PCM input: frames which could not be filled in
+ * time from the input are replaced by silence.
+ */
+struct A2DPSourceUnderruns {
+  uint32_t underruns = 0;       // number of times the input stalled
+  uint32_t silence_frames = 0;  // frames which were replaced by silence
+  uint32_t partial_frames = 0;  // frames which were padded with silence
+};
 
 /**
- * @brief A2DPSource for the RP2040
+ * @brief A2DPSource for the RP2040. As A2DPFrameOutput it can also send the
+ * SBC frames which were received by the A2DPSink without transcoding (relay):
+ * the PCM input is only encoded when the configurations do not match.
  * @author Phil Schatzmann
  */
-class A2DPSourceClass : public A2DPCommon {
+class A2DPSourceClass : public A2DPCommon, public A2DPFrameOutput {
  public:
   bool begin(Stream &in) { return begin(in, nullptr); }
 
@@ -106,64 +106,246 @@ class A2DPSourceClass : public A2DPCommon {
 
   bool begin(Stream &in, const char *name) {
     TRACEI();
-    volume_stream.setStream(in);
+    p_in = &in;
     remote_name = name;
-    // setup output chain: in -> volume_stream -> encoder_stream -> queue
-    encoder_stream.setOutput(&media_tracker.queue);
+    // setup output chain: in -> pcm_buffer (volume) -> encoder_stream ->
+    // packets
+    encoder_stream.setOutput(&media_tracker.packets);
     encoder_stream.setEncoder(&(get_encoder().encoder()));
     setupTrack();
     int err = a2dp_source_and_avrcp_services_init();
-    // hci_power_control(HCI_POWER_ON);
-    setPower(true);
-    return err = 0;
+    if (err != 0) return false;
+    if (!A2DPStack.powerOn()) return false;
+    // BTstack was already started by the sink (relay mode)
+    if (A2DPStack.isWorking()) a2dp_source_arduino_start_scanning();
+    return true;
   }
 
   /// Defines the encoder. Set a value if you do not intend to use the default
-  /// SBC encoder!
-  void setEncoder(A2DPEncoder &enc) { p_encoder = &enc; }
+  /// SBC encoder! This replaces all registered encoders.
+  void setEncoder(A2DPEncoder &enc) {
+    encoders.clear();
+    encoders.add(enc);
+    p_encoder = &enc;
+  }
+
+  /// Registers an additional encoder with its own stream endpoint: the
+  /// endpoints of the encoders with a higher priority are created first.
+  /// Call before begin().
+  bool addEncoder(A2DPEncoder &enc, int priority = 0) {
+    return encoders.add(enc, priority);
+  }
 
   /// Resets the conder to use the SBC encoder
-  void resetEncoder() { p_encoder = &encoder_sbc; }
+  void resetEncoder() {
+    encoders.clear();
+    p_encoder = &encoder_sbc;
+  }
 
   /// Provides access to the track information (to read or update)
   avrcp_track_t &track() { return track_info; }
 
- protected:
-  friend void source_a2dp_audio_timeout_handler(btstack_timer_source_t *timer);
+  /// Defines the audio (in ms) which is sent as burst when the stream
+  /// starts, so that the sink can fill its buffer
+  void setPrerollMs(int ms) { preroll_ms = ms; }
+
+  /// Defines how long (in ms) we wait for PCM data from the input before
+  /// silence is sent
+  void setInputTimeoutMs(int ms) { input_timeout_ms = ms; }
+
+  /// Provides the statistics of the PCM input
+  A2DPSourceUnderruns underruns() { return underrun_info; }
+
+  /// Defines the number of speakers (max A2DP_MAX_LINKS) which are
+  /// connected: the audio is encoded only once and the same packets are sent
+  /// to all of them, so they must accept the same codec configuration.
+  /// Call before begin().
+  void setSinkCount(int count) {
+    if (count < 1) count = 1;
+    if (count > A2DP_MAX_LINKS) {
+      LOGW("setSinkCount: max %d sinks", A2DP_MAX_LINKS);
+      count = A2DP_MAX_LINKS;
+    }
+    sink_count = count;
+  }
 
-  friend void source_a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                         uint8_t *event, uint16_t event_size);
+  /// Adds the Bluetooth address (e.g. "00:21:3C:AC:F7:38") of a speaker
+  /// which is connected directly without inquiry. Call before begin().
+  bool addKnownSink(const char *address) {
+    bd_addr_t addr;
+    if (sscanf_bd_addr(address, addr) == 0) {
+      LOGE("addKnownSink: invalid address %s", address);
+      return false;
+    }
+    add_known_sink(addr, false);
+    return true;
+  }
 
-  friend void source_a2dp_configure_sample_rate(int sample_rate);
-  friend void source_avrcp_controller_packet_handler(uint8_t packet_type,
-                                                     uint16_t channel,
-                                                     uint8_t *packet,
-                                                     uint16_t size);
-  friend void source_avrcp_target_packet_handler(uint8_t packet_type,
-                                                 uint16_t channel,
-                                                 uint8_t *packet,
-                                                 uint16_t size);
+  /// Removes all known speakers (also from the persisted list)
+  void clearKnownSinks() {
+    known_count = 0;
+    is_known_loaded = true;
+    const btstack_tlv_t *p_tlv = nullptr;
+    void *p_tlv_context = nullptr;
+    btstack_tlv_get_instance(&p_tlv, &p_tlv_context);
+    if (p_tlv != nullptr) p_tlv->delete_tag(p_tlv_context, SOURCE_KNOWN_SINKS_TAG);
+  }
+
+  /// Defines if the known speakers are connected before an inquiry is
+  /// started (default: true)
+  void setReconnect(bool active) { is_reconnect = active; }
+
+  /// Number of speakers which are streaming
+  int activeSinks() {
+    int result = 0;
+    for (auto &link : links) {
+      if (link.is_streaming) result++;
+    }
+    return result;
+  }
+
+  /// Highest delay in us that was reported by the sinks (0 if not supported)
+  uint32_t remoteDelayUs() { return remote_delay_us; }
+
+  /// Estimated time in us from the PCM input until the audio is played by
+  /// the sink: reported sink delay + queued audio + encoder delay
+  uint32_t latencyUs() {
+    if (current_sample_rate <= 0) return remote_delay_us;
+    uint32_t samples = media_tracker.packets.frames() * sbc_frame_samples() +
+                       media_tracker.pcm_buffer_len /
+                           (current_channels * sizeof(int16_t)) +
+                       get_encoder().delaySamples();
+    return remote_delay_us +
+           (uint64_t)samples * 1000000 / current_sample_rate;
+  }
 
-  friend void source_hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                                        uint8_t *packet, uint16_t size);
+  /// Activates/deactivates the adaptation of the SBC bitpool to the link
+  /// quality (default: active)
+  void setAdaptiveBitpool(bool active) { is_adaptive_bitpool = active; }
 
-  friend void source_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                          uint8_t *packet, uint16_t size);
+  /// Actual SBC bitpool
+  int bitpool() { return media_tracker.bitpool; }
 
+  /// SBC XQ with the default SBC encoder: dual channel with the XQ bitpool
+  /// is used if the sink supports it. Call before begin().
+  void setHighQuality(bool active) { encoder_sbc.setHighQuality(active); }
+
+  /// Defines a callback which is called with the new latencyUs() when the
+  /// sink reports its delay
+  void setLatencyCallback(void (*callback)(uint32_t latencyUs)) {
+    latency_callback = callback;
+  }
+
+  /// Determines if the received frames are sent without transcoding
+  bool isPassthrough() { return is_passthrough; }
+
+  /// The configuration of the received stream: it is preferred for the next
+  /// negotiation with the speaker
+  void setFrameConfiguration(uint8_t *packet, uint16_t size) override {
+    if (size > SINK_CONFIG_EVENT_SIZE) return;
+    memcpy(frame_config, packet, size);
+    frame_config_size = size;
+    for (int j = 0; j < encoders.size(); j++) {
+      encoders[j].p_codec->preferConfiguration(packet, size);
+    }
+    update_frame_match();
+  }
+
+  /// Sends the received frames as they are, if the speaker uses the same
+  /// configuration and the bitpool of the frame is in the negotiated range
+  bool writeFrames(const uint8_t *frames, int frameCount,
+                   int frameSize) override {
+    a2dp_media_sending_context_t *context = &media_tracker;
+    bool is_valid = is_frame_match && context->is_streaming &&
+                    frameSize >= 4 && frames[0] == SBC_FRAME_SYNCWORD &&
+                    frames[2] >= get_encoder().minBitpool() &&
+                    frames[2] <= get_encoder().maxBitpool();
+    if (!is_valid) {
+      a2dp_arduino_passthrough_stop(context);
+      return false;
+    }
+    if (!is_passthrough || frameSize != passthrough_frame_size) {
+      is_passthrough = true;
+      passthrough_frame_size = frameSize;
+      LOGI("A2DP Source: passthrough of SBC frames with %d bytes", frameSize);
+      a2dp_arduino_update_frame_size(context);
+    }
+    for (int j = 0; j < frameCount; j++) {
+      // a slow link must not stall the others
+      if (!context->packets.dropLagging()) {
+        context->is_dropped = true;
+        break;
+      }
+      context->packets.write(frames + j * frameSize, frameSize);
+    }
+    for (auto &link : links) a2dp_arduino_request_can_send_now(&link);
+    return true;
+  }
+
+  /// The received stream has stopped: we continue with the PCM input
+  void endFrames() override { a2dp_arduino_passthrough_stop(&media_tracker); }
+
+  /// The volume of the received stream is set as AVRCP absolute volume on
+  /// all speakers
+  void setFrameVolume(int volumePercent) override {
+    volume_percentage = btstack_max(0, btstack_min(100, volumePercent));
+    for (auto &link : links) {
+      if (!link.is_used || link.avrcp_cid == 0) continue;
+      avrcp_controller_set_absolute_volume(
+          link.avrcp_cid, percent_to_volume(volume_percentage));
+    }
+  }
+
+ protected:
+  friend void source_a2dp_audio_timeout_handler(btstack_timer_source_t *timer);
+
+  /// Connection to a sink: the encoded packets are shared by all links, but
+  /// each link has its own position in the packet pool and its own can send
+  /// now request
+  struct a2dp_link_t {
+    bool is_used = false;
+    bd_addr_t address;
+    uint16_t a2dp_cid = 0;
+    uint16_t avrcp_cid = 0;
+    uint8_t local_seid = 0;
+    uint8_t remote_seid = 0;
+    uint8_t stream_opened = 0;
+    bool is_configured = false;
+    bool is_streaming = false;
+    bool sbc_is_busy = false;
+    bool is_rtp_marker = false;
+    uint32_t rtp_timestamp = 0;  // samples before the first frame
+    uint32_t time_stream_stopped = 0;  // ms
+    uint32_t can_send_request_ms = 0;
+    uint32_t send_latency_ms = 0;
+    uint32_t remote_delay_us = 0;
+    int max_media_payload_size = 0;
+  };
+
+  /// Encoding state which is shared by all links
   struct a2dp_media_sending_context_t {
-    uint16_t a2dp_cid;
-    uint8_t local_seid;
-    uint8_t remote_seid;
-    uint8_t stream_opened;
-    uint16_t avrcp_cid;
     btstack_timer_source_t audio_timer;
     int max_media_payload_size;
-    RingBuffer<uint8_t> rb{SBC_STORAGE_SIZE};
-    QueueStream<uint8_t> queue{rb};
+    A2DPPacketPool packets;
+    uint32_t time_audio_data_sent = 0;  // ms
+    uint32_t acc_num_missed_samples = 0;  // 1/1000 samples
+    uint32_t samples_ready = 0;
+    Vector<uint8_t> pcm_buffer;
+    int pcm_buffer_len = 0;
+    Vector<uint8_t> input_buffer;  // input which is mixed down
+    int input_buffer_len = 0;
+    uint32_t input_wait_start = 0;  // ms
+    bool is_input_waiting = false;
+    bool is_input_silent = false;
+    int bitpool = 0;
+    uint32_t dropped_bytes = 0;
+    uint32_t dropped_packets = 0;
+    bool is_dropped = false;
     bool is_streaming = false;
-    bool sbc_is_busy = false;
   } media_tracker;
 
+  a2dp_link_t links[A2DP_MAX_LINKS];
+
   struct avrcp_play_status_info_t {
     uint8_t track_id[8];
     uint32_t song_length_ms;
@@ -174,49 +356,138 @@ class A2DPSourceClass : public A2DPCommon {
   // State
   A2DPEncoderSBC encoder_sbc;
   A2DPEncoder *p_encoder = &encoder_sbc;
+  A2DPCodecRegistry<A2DPEncoder> encoders;
   Stream *p_in = nullptr;
   EncodedAudioStream encoder_stream;
   AudioStream *p_input = nullptr;
   avrcp_track_t track_info;
+  bool is_track_setup = false;
   bool is_streams_opened = false;
-  btstack_packet_callback_registration_t hci_event_callback_registration;
   const int A2DP_SOURCE_arduino_INQUIRY_DURATION_1280MS = 12;
-  const char *device_addr_string = "00:21:3C:AC:F7:38";
   const char *remote_name = nullptr;
   bd_addr_t device_addr;
   bool scan_active;
+  int sink_count = 1;
+  bd_addr_t found_addr[A2DP_MAX_LINKS];
+  int found_count = 0;
+  int connect_pos = 0;
+  bd_addr_t known_addr[SOURCE_MAX_KNOWN_SINKS];
+  int known_count = 0;
+  int known_pos = 0;
+  bool is_known_loaded = false;
+  bool is_reconnect = true;
+  bool is_reconnecting = false;
   uint8_t sdp_a2dp_source_service_buffer[150];
-  uint8_t sdp_avrcp_target_service_buffer[200];
-  uint8_t sdp_avrcp_controller_service_buffer[200];
-  uint8_t device_id_sdp_service_buffer[100];
   int current_sample_rate = 44100;
+  int current_channels = NUM_CHANNELS;
+  int input_channels = NUM_CHANNELS;
   int new_sample_rate = 44100;
   int current_track_index;
   int data_source = 0;
   const int track_count = 1;
+  int preroll_ms = SOURCE_PREROLL_MS;
+  int input_timeout_ms = SOURCE_INPUT_TIMEOUT_MS;
+  A2DPSourceUnderruns underrun_info;
+  uint32_t remote_delay_us = 0;
+  A2DPBitpoolController bitpool_controller;
+  bool is_adaptive_bitpool = true;
+  void (*latency_callback)(uint32_t latencyUs) = nullptr;
   avrcp_play_status_info_t play_info;
+  static const uint8_t SBC_FRAME_SYNCWORD = 0x9C;
+  uint8_t frame_config[SINK_CONFIG_EVENT_SIZE];
+  uint16_t frame_config_size = 0;
+  bool is_frame_match = false;
+  bool is_passthrough = false;
+  int passthrough_frame_size = 0;
 
   // Methods
 
   int16_t get_max_input_amplitude() override { return MAX_AMPLITUDE_INPUT; }
 
-  virtual int get_avrcp_cid() { return media_tracker.a2dp_cid; }
+  /// AVRCP connection of the first speaker
+  int get_avrcp_cid() override {
+    uint16_t cid = 0;
+    return get_avrcp_cids(&cid, 1) > 0 ? cid : 0;
+  }
+
+  /// The commands are sent to all speakers
+  int get_avrcp_cids(uint16_t *cids, int max) override {
+    int result = 0;
+    for (auto &link : links) {
+      if (result < max && link.is_used && link.avrcp_cid != 0)
+        cids[result++] = link.avrcp_cid;
+    }
+    return result;
+  }
+
+  /// Publishes the playback status (and the track) to all speakers
+  void avrcp_set_playback_status(avrcp_playback_status_t status,
+                                 bool withTrack) {
+    for (auto &link : links) {
+      if (!link.is_used || link.avrcp_cid == 0) continue;
+      if (withTrack) {
+        avrcp_target_set_now_playing_info(
+            link.avrcp_cid,
+            status == AVRCP_PLAYBACK_STATUS_STOPPED ? NULL : &track_info,
+            track_count);
+      }
+      avrcp_target_set_playback_status(link.avrcp_cid, status);
+    }
+  }
+
+  bool isSink() override { return false; }
+
+  bool hasConnection(uint16_t a2dpCid) override {
+    return get_link(a2dpCid) != nullptr;
+  }
+
+  bool hasAddress(bd_addr_t address) override {
+    for (auto &link : links) {
+      if (link.is_used && bd_addr_cmp(link.address, address) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  bool hasSeid(uint8_t localSeid) override {
+    return encoders.find(localSeid) != nullptr;
+  }
+
+  bool acceptsConnection() override { return missing_sinks() > 0; }
+
+  int maxConnections() override { return sink_count; }
+
+  int streamEndpointCount() override { return sink_count * encoders.size(); }
+
+  int linkKeyCount() override { return SOURCE_MAX_KNOWN_SINKS; }
 
   A2DPEncoder &get_encoder() { return *p_encoder; }
 
+  /// Activates the encoder of the stream endpoint that was configured
+  bool select_encoder(uint8_t localSeid) {
+    A2DPEncoder *p_enc = encoders.find(localSeid);
+    if (p_enc == nullptr) {
+      LOGE("A2DP Source: no encoder for local seid %d", localSeid);
+      return false;
+    }
+    p_encoder = p_enc;
+    encoder_stream.setEncoder(&(p_encoder->encoder()));
+    return true;
+  }
+
   /**
    * @text The Listing MainConfiguration shows how to setup AD2P Source and
-   * AVRCP services. Besides calling init() method for each service, you'll also
-   * need to register several packet handlers:
-   * - source_hci_packet_handler - handles legacy pairing, here by using fixed
-   * '0000' pin code.
-   * - source_a2dp_packet_handler - handles events on stream connection status
+   * AVRCP services. The services which exist only once per device (L2CAP,
+   * SDP, AVRCP and the HCI event handler) are set up by the A2DPStack, which
+   * forwards the callbacks to this object:
+   * - hci_packet_handler - handles the inquiry of the speakers.
+   * - a2dp_packet_handler - handles events on stream connection status
    * (established, released), the media codec configuration, and, the commands
    * on stream itself (open, pause, stopp).
-   * - source_avrcp_packet_handler - receives connect/disconnect event.
-   * - source_avrcp_controller_packet_handler - receives answers for sent AVRCP
+   * - avrcp_packet_handler - receives connect/disconnect event.
+   * - avrcp_controller_packet_handler - receives answers for sent AVRCP
    * commands.
-   * - source_avrcp_target_packet_handler - receives AVRCP commands, and
+   * - avrcp_target_packet_handler - receives AVRCP commands, and
    * registered notifications.
    * @text To announce A2DP Source and AVRCP services, you need to create
    * corresponding SDP records and register them with the SDP service.
@@ -234,104 +505,73 @@ class A2DPSourceClass : public A2DPCommon {
     // enabled EIR
     hci_set_inquiry_mode(INQUIRY_MODE_RSSI_AND_EIR);
 
-    l2cap_init();
-
-    if (isBLEEnabled()) {
-      // Initialize LE Security Manager. Needed for cross-transport key
-      // derivation
-      sm_init();
+    A2DPStack.begin(isBLEEnabled());
+
+    // SBC is mandatory: we provide it if no SBC encoder was registered
+    if (encoders.size() == 0) encoders.add(*p_encoder);
+    if (!encoders.contains(AVDTP_CODEC_SBC)) encoders.add(encoder_sbc, -1);
+    p_encoder = encoders.first();
+
+    // Initialize A2DP Source: this checks the endpoints of the encoders
+    if (!A2DPStack.addRole(*this)) return 1;
+
+    // Create a stream endpoint for each encoder and sink: an endpoint can
+    // only be used by a single connection
+    for (int l = 0; l < sink_count; l++) {
+      for (int j = 0; j < encoders.size(); j++) {
+        A2DPEncoder &enc = *encoders[j].p_codec;
+        avdtp_stream_endpoint_t *local_stream_endpoint =
+            a2dp_source_create_stream_endpoint(
+                AVDTP_AUDIO, enc.codecType(), enc.codecCapabilities(),
+                enc.codecCapabilitiesSize(), enc.config(), enc.configSize());
+        if (!local_stream_endpoint) {
+          LOGE(
+              "A2DP Source: not enough memory to create local stream "
+              "endpoint");
+          return 1;
+        }
+        enc.setupEndpoint(local_stream_endpoint);
+
+        // Store stream enpoint's SEP ID, as it is used by A2DP API to
+        // indentify the stream endpoint
+        uint8_t seid = avdtp_local_seid(local_stream_endpoint);
+        encoders[j].setSeid(l, seid);
+        avdtp_source_register_delay_reporting_category(seid);
+        LOGI("A2DP Source: codec %d with local seid %d for sink %d",
+             enc.codecType(), seid, l);
+      }
     }
 
-    // Initialize  A2DP Source
-    a2dp_source_init();
-    a2dp_source_register_packet_handler(&source_a2dp_packet_handler);
-
-    // Create stream endpoint
-    A2DPEncoder &enc = get_encoder();
-    avdtp_stream_endpoint_t *local_stream_endpoint =
-        a2dp_source_create_stream_endpoint(
-            AVDTP_AUDIO, enc.codecType(), enc.codecCapabilities(),
-            enc.codecCapabilitiesSize(), enc.config(), enc.configSize());
-    if (!local_stream_endpoint) {
-      LOGE("A2DP Source: not enough memory to create local stream endpoint");
-      return 1;
-    }
-
-    // Store stream enpoint's SEP ID, as it is used by A2DP API to indentify the
-    // stream endpoint
-    media_tracker.local_seid = avdtp_local_seid(local_stream_endpoint);
-    avdtp_source_register_delay_reporting_category(media_tracker.local_seid);
-
-    // Initialize AVRCP Service
-    avrcp_init();
-    avrcp_register_packet_handler(&source_avrcp_packet_handler);
-    // Initialize AVRCP Target
-    avrcp_target_init();
-    avrcp_target_register_packet_handler(&source_avrcp_target_packet_handler);
-
-    // Initialize AVRCP Controller
-    avrcp_controller_init();
-    avrcp_controller_register_packet_handler(
-        &source_avrcp_controller_packet_handler);
-
-    // Initialize SDP,
-    sdp_init();
-
     // Create A2DP Source service record and register it with SDP
     memset(sdp_a2dp_source_service_buffer, 0,
            sizeof(sdp_a2dp_source_service_buffer));
-    a2dp_source_create_sdp_record(sdp_a2dp_source_service_buffer, 0x10001,
+    a2dp_source_create_sdp_record(sdp_a2dp_source_service_buffer,
+                                  A2DPStack.nextServiceHandle(),
                                   AVDTP_SOURCE_FEATURE_MASK_PLAYER, NULL, NULL);
     sdp_register_service(sdp_a2dp_source_service_buffer);
 
-    // Create AVRCP Target service record and register it with SDP. We receive
-    // Category 1 commands from the headphone, e.g. play/pause
-    memset(sdp_avrcp_target_service_buffer, 0,
-           sizeof(sdp_avrcp_target_service_buffer));
+    // We receive Category 1 commands from the headphone, e.g. play/pause, and
+    // send Category 2 commands to the headphone, e.g. volume up/down
     uint16_t supported_features =
         AVRCP_FEATURE_MASK_CATEGORY_PLAYER_OR_RECORDER;
 #ifdef AVRCP_BROWSING_ENABLED
     supported_features |= AVRCP_FEATURE_MASK_BROWSING;
 #endif
-    avrcp_target_create_sdp_record(sdp_avrcp_target_service_buffer, 0x10002,
-                                   supported_features, NULL, NULL);
-    sdp_register_service(sdp_avrcp_target_service_buffer);
-
-    // Create AVRCP Controller service record and register it with SDP. We send
-    // Category 2 commands to the headphone, e.g. volume up/down
-    memset(sdp_avrcp_controller_service_buffer, 0,
-           sizeof(sdp_avrcp_controller_service_buffer));
-    uint16_t controller_supported_features =
-        AVRCP_FEATURE_MASK_CATEGORY_MONITOR_OR_AMPLIFIER;
-    avrcp_controller_create_sdp_record(sdp_avrcp_controller_service_buffer,
-                                       0x10003, controller_supported_features,
-                                       NULL, NULL);
-    sdp_register_service(sdp_avrcp_controller_service_buffer);
-
-    // Register Device ID (PnP) service SDP record
-    memset(device_id_sdp_service_buffer, 0,
-           sizeof(device_id_sdp_service_buffer));
-    device_id_create_sdp_record(device_id_sdp_service_buffer, 0x10004,
-                                DEVICE_ID_VENDOR_ID_SOURCE_BLUETOOTH,
-                                BLUETOOTH_COMPANY_ID_BLUEKITCHEN_GMBH, 1, 1);
-    sdp_register_service(device_id_sdp_service_buffer);
+    A2DPStack.addAvrcpFeatures(AVRCP_FEATURE_MASK_CATEGORY_MONITOR_OR_AMPLIFIER,
+                               supported_features);
 
     // Set local name with a template Bluetooth address, that will be
     // automatically replaced with a actual address once it is available, i.e.
     // when BTstack boots up and starts talking to a Bluetooth module.
-    gap_set_local_name("A2DP Source 00:00:00:00:00:00");
+    A2DPStack.setDeviceInfo("A2DP Source 00:00:00:00:00:00", 0x200408);
     gap_discoverable_control(1);
-    gap_set_class_of_device(0x200408);
 
-    // Register for HCI events.
-    hci_event_callback_registration.callback = &source_hci_packet_handler;
-    hci_add_event_handler(&hci_event_callback_registration);
+    // a known speaker answers quickly: so we do not wait the default 5.12 s
+    // for a speaker which is off
+    gap_set_page_timeout(SOURCE_PAGE_TIMEOUT_MS * 8 / 5);
 
     source_a2dp_configure_sample_rate(current_sample_rate);
 
-    // Parse human readable Bluetooth address.
-    sscanf_bd_addr(device_addr_string, device_addr);
-
     return 0;
   }
   /* LISTING_END */
@@ -358,23 +598,38 @@ class A2DPSourceClass : public A2DPCommon {
     // setup ecoder_stream
     auto cfg = encoder_stream.defaultConfig();
     cfg.sample_rate = current_sample_rate;
-    cfg.channels = NUM_CHANNELS;
-    encoder_stream.begin(cfg);
-
-    // setup volume input
-    auto vcfg = volume_stream.defaultConfig();
-    vcfg.copyFrom(cfg);
-    vcfg.volume = 0.01f * volume_percentage;
-    volume_stream.begin(vcfg);
-
-    // configure input if possible
+    current_channels = get_encoder().audioInfo().channels;
+    if (current_channels <= 0) current_channels = NUM_CHANNELS;
+    cfg.channels = current_channels;
+    // the frame encoder does not need the buffers of the encoder_stream
+    if (!get_encoder().isFrameEncoder()) encoder_stream.begin(cfg);
+
+    // setup volume which is applied to the pcm_buffer
+    volume_control.begin(cfg.channels);
+    avrcp_volume_changed(volume_percentage);
+
+    // configure input if possible: otherwise a stereo input is mixed down
+    input_channels = NUM_CHANNELS;
     if (p_input != nullptr) {
       p_input->setAudioInfo(cfg);
+      if (p_input->audioInfo().channels > 0)
+        input_channels = p_input->audioInfo().channels;
+    }
+    if (input_channels > current_channels) {
+      LOGI("A2DP Source: mixing %d input channels down to %d", input_channels,
+           current_channels);
     }
 
-    // start queue stream
-    media_tracker.queue.clear();
-    media_tracker.queue.begin();
+    // setup the packets
+    media_tracker.packets.begin(sbc_buffer_length_sbc(), SBC_PACKET_COUNT);
+    media_tracker.pcm_buffer.resize(sbc_buffer_length_pcm());
+    media_tracker.pcm_buffer_len = 0;
+    media_tracker.input_buffer.resize(
+        input_channels > current_channels
+            ? sbc_buffer_length_pcm() / current_channels * input_channels
+            : 0);
+    media_tracker.input_buffer_len = 0;
+    media_tracker.bitpool = get_encoder().maxBitpool();
     is_streams_opened = true;
   }
 
@@ -382,105 +637,665 @@ class A2DPSourceClass : public A2DPCommon {
 
   int sbc_buffer_length_pcm() { return get_encoder().frameLengthDecoded(); }
 
-  void a2dp_arduino_send_media_packet(void) {
+  /// Number of samples (per channel) in an encoded frame
+  int sbc_frame_samples() {
+    return sbc_buffer_length_pcm() / (current_channels * sizeof(int16_t));
+  }
+
+  /// Sends the next packet of the link: the packet is released when it was
+  /// sent to all links
+  void a2dp_arduino_send_media_packet(a2dp_link_t *link) {
+    TRACED();
+    int idx = link_index(link);
+    link->send_latency_ms =
+        btstack_run_loop_get_time_ms() - link->can_send_request_ms;
+    a2dp_media_packet_t *packet = media_tracker.packets.peek(idx);
+    if (packet != nullptr) {
+      LOGD("a2dp_arduino_send_media_packet: %d frames (%d bytes)",
+           packet->frames, packet->size);
+
+      // Fill the reserved SBC Header: (fragmentation << 7) |
+      // (starting_packet << 6) | (last_packet << 5) | num_frames;
+      packet->data[0] = packet->frames;
+      // the sequence number is maintained by BTstack, the timestamp is the
+      // sample clock of the first frame in the packet
+      uint32_t timestamp =
+          link->rtp_timestamp + packet->frame_index * sbc_frame_samples();
+      int rc = avdtp_source_stream_send_media_payload_rtp(
+          link->a2dp_cid, link->local_seid, link->is_rtp_marker, timestamp,
+          packet->data, packet->packetSize());
+
+      if (rc != ERROR_CODE_SUCCESS) {
+        LOGE("avdtp_source_stream_send_media_payload_rtp: %d", rc);
+      }
+      link->is_rtp_marker = false;
+      media_tracker.packets.release(idx);
+    }
+
+    // allow to process the next packets
+    link->sbc_is_busy = false;
+
+    // catch up if there are more packets ready
+    a2dp_arduino_request_can_send_now(link);
+  }
+
+  /// Encodes all frames that are due: this never blocks, if the input can
+  /// not provide the data we wait for the next timer tick
+  int a2dp_arduino_fill_sbc_audio_buffer(
+      a2dp_media_sending_context_t *context, uint32_t now) {
     TRACED();
+    int len = context->pcm_buffer.size();
+    uint32_t frame_samples = len / (current_channels * sizeof(int16_t));
+    if (frame_samples == 0) return 0;
+    // the remaining samples stay due until a packet is free again
+    while (context->samples_ready >= frame_samples) {
+      // a slow link must not stall the others
+      if (!context->packets.dropLagging()) break;
+      if (!a2dp_arduino_read_pcm_frame(context, now)) break;
+      if (!volume_control.isUnity()) {
+        volume_control.process((int16_t *)context->pcm_buffer.data(),
+                               len / sizeof(int16_t));
+      }
 
-    // determine data
-    int num_bytes_in_frame = sbc_buffer_length_sbc();
-    int available = media_tracker.queue.available();
-    int num_frames = available / num_bytes_in_frame;
+      A2DPEncoder &enc = get_encoder();
+      if (enc.isFrameEncoder()) {
+        // encode from the pcm buffer directly into the media packet
+        int encoded = enc.encodeFrame(
+            context->pcm_buffer.data(), len, context->packets.frameBuffer(),
+            context->packets.frameBufferSize());
+        context->packets.commitFrame(encoded);
+      } else {
+        size_t bytes_written =
+            encoder_stream.write(context->pcm_buffer.data(), len);
+        LOGD("write: %d -> %d", bytes_written, context->packets.available());
+      }
+      context->pcm_buffer_len = 0;
+      context->samples_ready -= frame_samples;
+    }
+    int available = context->packets.available();
+    LOGD("sbc packets: %d", available);
+    return available;
+  }
 
-    // log output
-    LOGI("a2dp_arduino_send_media_packet: %d packets (%d bytes)", num_frames,
-         available);
-    if (available % num_bytes_in_frame) {
-      LOGW("Invalid number of available bytes: available: %d, frame_size: %d",
-           available, num_bytes_in_frame);
+  /**
+   * @brief Reads the available PCM data into the frame buffer: returns true
+   * when the frame is complete. If the input stalls for longer than
+   * input_timeout_ms the frame is completed with silence, so that the sink
+   * keeps on playing. We do not wait again until the input has recovered.
+   */
+  bool a2dp_arduino_read_pcm_frame(a2dp_media_sending_context_t *context,
+                                   uint32_t now) {
+    int len = context->pcm_buffer.size();
+    int open = len - context->pcm_buffer_len;
+    if (p_in == nullptr) return false;
+    if (input_channels > current_channels) {
+      a2dp_arduino_read_mixdown(context, open);
+    } else {
+      int available = p_in->available();
+      if (available > open) available = open;
+      if (available > 0) {
+        size_t bytes = p_in->readBytes(
+            context->pcm_buffer.data() + context->pcm_buffer_len, available);
+        LOGD("readBytes: %d -> %d", available, bytes);
+        context->pcm_buffer_len += bytes;
+      }
     }
 
-    // send out data
-    uint8_t buffer[available + 1];
-    // Prepend SBC Header // (fragmentation << 7) | (starting_packet << 6) |
-    // (last_packet << 5) | num_frames;
-    media_tracker.queue.readBytes(buffer + 1, available);
-    buffer[0] = num_frames;
-    int rc = avdtp_source_stream_send_media_payload_rtp(
-        media_tracker.a2dp_cid, media_tracker.local_seid, 0, 0, buffer,
-        available + 1);
+    if (context->pcm_buffer_len == len) {
+      if (context->is_input_silent) LOGI("PCM input has recovered");
+      context->is_input_waiting = false;
+      context->is_input_silent = false;
+      return true;
+    }
 
-    if (rc != ERROR_CODE_SUCCESS) {
-      LOGE("avdtp_source_stream_send_media_payload_rtp: %d", rc);
+    // the input can not provide a full frame
+    if (!context->is_input_waiting) {
+      context->is_input_waiting = true;
+      context->input_wait_start = now;
+      underrun_info.underruns++;
+    }
+    if (!context->is_input_silent) {
+      if ((int)(now - context->input_wait_start) < input_timeout_ms)
+        return false;
+      LOGW("PCM input stalled for %d ms: sending silence", input_timeout_ms);
+      context->is_input_silent = true;
     }
 
-    // allow to process the next packets
-    media_tracker.sbc_is_busy = false;
+    if (context->pcm_buffer_len > 0) {
+      underrun_info.partial_frames++;
+    } else {
+      underrun_info.silence_frames++;
+    }
+    memset(context->pcm_buffer.data() + context->pcm_buffer_len, 0,
+           len - context->pcm_buffer_len);
+    context->pcm_buffer_len = len;
+    return true;
   }
 
-  int a2dp_arduino_fill_sbc_audio_buffer(
-      a2dp_media_sending_context_t *context) {
-    TRACED();
-    int len = sbc_buffer_length_pcm() * SBC_PACKET_COUNT;
-    uint8_t pcm_buffer[len];
-    while (media_tracker.queue.available() == 0) {
-      size_t bytes = volume_stream.readBytes(pcm_buffer, len);
-      LOGD("readBytes: %d -> %d", len, bytes);
+  /**
+   * @brief Reads up to open bytes of output from an input with more
+   * channels (e.g. a stereo input for a mono stream): the channels of each
+   * sample are averaged. Incomplete input samples are kept for the next call.
+   */
+  void a2dp_arduino_read_mixdown(a2dp_media_sending_context_t *context,
+                                 int open) {
+    int sample_bytes = input_channels * sizeof(int16_t);
+    int max_bytes = open / current_channels * input_channels -
+                    context->input_buffer_len;
+    int available = p_in->available();
+    if (available > max_bytes) available = max_bytes;
+    if (available > 0) {
+      size_t bytes = p_in->readBytes(
+          context->input_buffer.data() + context->input_buffer_len, available);
+      LOGD("readBytes: %d -> %d", available, bytes);
+      context->input_buffer_len += bytes;
+    }
+    int samples = context->input_buffer_len / sample_bytes;
+    int16_t *in = (int16_t *)context->input_buffer.data();
+    int16_t *out =
+        (int16_t *)(context->pcm_buffer.data() + context->pcm_buffer_len);
+    for (int j = 0; j < samples; j++) {
+      int ch_in = 0;
+      for (int ch = 0; ch < current_channels; ch++) {
+        // the input channels are split evenly among the output channels
+        int count = input_channels / current_channels;
+        int32_t sum = 0;
+        for (int k = 0; k < count; k++) sum += in[j * input_channels + ch_in++];
+        out[j * current_channels + ch] = sum / count;
+      }
+    }
+    int used = samples * sample_bytes;
+    context->input_buffer_len -= used;
+    memmove(context->input_buffer.data(), context->input_buffer.data() + used,
+            context->input_buffer_len);
+    context->pcm_buffer_len += samples * current_channels * sizeof(int16_t);
+  }
 
-      size_t bytes_written = encoder_stream.write(pcm_buffer, bytes);
-      LOGD("write: %d -> %d", bytes_written, media_tracker.queue.available());
+  /**
+   * @brief Determines the number of samples which are due since the last
+   * call: the remainder is accumulated in 1/1000 samples, so that the send
+   * rate follows the sample rate exactly, independent of the timer jitter.
+   * After a late tick we catch up by at most SOURCE_MAX_CATCHUP_MS.
+   */
+  void a2dp_arduino_update_samples_ready(a2dp_media_sending_context_t *context,
+                                         uint32_t now) {
+    uint32_t update_period_ms = AUDIO_TIMEOUT_MS;
+    if (context->time_audio_data_sent > 0) {
+      update_period_ms = now - context->time_audio_data_sent;
+    }
+    context->time_audio_data_sent = now;
+
+    uint32_t num_samples = (update_period_ms * current_sample_rate) / 1000;
+    context->acc_num_missed_samples +=
+        (update_period_ms * current_sample_rate) % 1000;
+    while (context->acc_num_missed_samples >= 1000) {
+      num_samples++;
+      context->acc_num_missed_samples -= 1000;
+    }
+    context->samples_ready += num_samples;
+
+    uint32_t max_samples = SOURCE_MAX_CATCHUP_MS * current_sample_rate / 1000;
+    if (preroll_ms > SOURCE_MAX_CATCHUP_MS) {
+      max_samples = preroll_ms * current_sample_rate / 1000;
+    }
+    if (context->samples_ready > max_samples) {
+      uint32_t skipped = context->samples_ready - max_samples;
+      LOGW("Audio timer late: skipping %d samples", (int)skipped);
+      context->samples_ready = max_samples;
+      context->is_dropped = true;
+      // the sample clock continues: the receiver sees the gap
+      for (auto &link : links) {
+        if (link.is_streaming) link.rtp_timestamp += skipped;
+      }
     }
-    int available = media_tracker.queue.available();
-    LOGD("sbc bytes: %d", available);
-    return available;
+  }
+
+  /// Requests to send the next packet of the link if there is no pending
+  /// request
+  void a2dp_arduino_request_can_send_now(a2dp_link_t *link) {
+    if (link->sbc_is_busy || !link->is_streaming) return;
+    if (media_tracker.packets.available(link_index(link)) == 0) return;
+    link->sbc_is_busy = true;
+    link->can_send_request_ms = btstack_run_loop_get_time_ms();
+    a2dp_source_stream_endpoint_request_can_send_now(link->a2dp_cid,
+                                                     link->local_seid);
   }
 
   void a2dp_audio_timeout_handler(btstack_timer_source_t *timer) {
     TRACED();
-    a2dp_media_sending_context_t *context =
-        (a2dp_media_sending_context_t *)btstack_run_loop_get_timer_context(
-            timer);
+    a2dp_media_sending_context_t *context = &media_tracker;
     btstack_run_loop_set_timer(&context->audio_timer, AUDIO_TIMEOUT_MS);
     btstack_run_loop_add_timer(&context->audio_timer);
     uint32_t now = btstack_run_loop_get_time_ms();
 
-    if (context->sbc_is_busy) return;
     if (!context->is_streaming) return;
 
-    a2dp_arduino_fill_sbc_audio_buffer(context);
+    // the received frames are sent when they arrive
+    if (!is_passthrough) {
+      a2dp_arduino_update_samples_ready(context, now);
+      a2dp_arduino_fill_sbc_audio_buffer(context, now);
+      if (is_adaptive_bitpool) a2dp_arduino_update_bitpool(context, now);
+    }
 
     // schedule sending
-    context->sbc_is_busy = true;
-    a2dp_source_stream_endpoint_request_can_send_now(context->a2dp_cid,
-                                                     context->local_seid);
+    for (auto &link : links) a2dp_arduino_request_can_send_now(&link);
+  }
+
+  /**
+   * @brief Adapts the bitpool to the link quality: a changed frame size is
+   * used from the next packet on.
+   */
+  void a2dp_arduino_update_bitpool(a2dp_media_sending_context_t *context,
+                                   uint32_t now) {
+    uint32_t dropped_bytes = context->packets.droppedBytes();
+    uint32_t dropped_packets = a2dp_arduino_dropped_packets(context);
+    bool is_dropped = context->is_dropped ||
+                      dropped_bytes != context->dropped_bytes ||
+                      dropped_packets != context->dropped_packets;
+    context->dropped_bytes = dropped_bytes;
+    context->dropped_packets = dropped_packets;
+    context->is_dropped = false;
+    // the slowest link decides: a pending request which is late counts as
+    // well
+    uint32_t latency = 0;
+    for (auto &link : links) {
+      if (!link.is_streaming) continue;
+      uint32_t link_latency = link.send_latency_ms;
+      if (link.sbc_is_busy && now - link.can_send_request_ms > link_latency) {
+        link_latency = now - link.can_send_request_ms;
+      }
+      if (link_latency > latency) latency = link_latency;
+    }
+
+    int bitpool = bitpool_controller.update(
+        now, context->packets.available(), latency, is_dropped);
+    if (bitpool == context->bitpool) return;
+    if (!get_encoder().setBitpool(bitpool)) return;
+    context->bitpool = bitpool;
+    a2dp_arduino_update_frame_size(context);
+  }
+
+  /// Packets which were dropped for links that were behind the others
+  uint32_t a2dp_arduino_dropped_packets(a2dp_media_sending_context_t *context) {
+    uint32_t result = 0;
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) {
+      result += context->packets.droppedPackets(j);
+    }
+    return result;
   }
 
+  /// An additional link has narrowed the bitpool range
+  void a2dp_arduino_limit_bitpool(a2dp_media_sending_context_t *context) {
+    A2DPEncoder &enc = get_encoder();
+    int bitpool = btstack_max(btstack_min(context->bitpool, enc.maxBitpool()),
+                              enc.minBitpool());
+    if (bitpool != context->bitpool && enc.setBitpool(bitpool)) {
+      context->bitpool = bitpool;
+      a2dp_arduino_update_frame_size(context);
+    }
+    if (context->is_streaming) {
+      bitpool_controller.begin(enc.minBitpool(), enc.maxBitpool(),
+                               btstack_run_loop_get_time_ms());
+    }
+  }
+
+  /// Fills each packet with as many whole frames as fit into the MTU: the
+  /// packets are shared, so the smallest MTU of all links is relevant
+  void a2dp_arduino_update_frame_size(a2dp_media_sending_context_t *context) {
+    int frame_size =
+        is_passthrough ? passthrough_frame_size : sbc_buffer_length_sbc();
+    if (frame_size <= 0) return;
+    context->max_media_payload_size = A2DP_MEDIA_HEADER_SIZE + SBC_STORAGE_SIZE;
+    for (auto &link : links) {
+      if (link.is_streaming && link.max_media_payload_size > 0) {
+        context->max_media_payload_size = btstack_min(
+            context->max_media_payload_size, link.max_media_payload_size);
+      }
+    }
+    context->packets.setFrameSize(
+        frame_size,
+        (context->max_media_payload_size - A2DP_MEDIA_HEADER_SIZE) /
+            frame_size);
+  }
+
+  /// Starts the encoding for the first link which is streaming
   void a2dp_arduino_timer_start(a2dp_media_sending_context_t *context) {
     TRACED();
-    context->max_media_payload_size = btstack_min(
-        a2dp_max_media_payload_size(context->a2dp_cid, context->local_seid),
-        SBC_STORAGE_SIZE);
-    context->sbc_is_busy = false;
+    // start with the best quality
+    A2DPEncoder &enc = get_encoder();
+    if (context->bitpool != enc.maxBitpool() &&
+        enc.setBitpool(enc.maxBitpool())) {
+      context->bitpool = enc.maxBitpool();
+    }
+    a2dp_arduino_update_frame_size(context);
+    LOGI("max_media_payload_size: %d -> %d frames per packet",
+         context->max_media_payload_size,
+         context->packets.framesPerPacket());
+    // the links join when they start streaming
+    for (int j = 0; j < A2DP_MAX_LINKS; j++) context->packets.removeReader(j);
     context->is_streaming = true;
+    uint32_t now = btstack_run_loop_get_time_ms();
+    context->dropped_bytes = context->packets.droppedBytes();
+    context->dropped_packets = a2dp_arduino_dropped_packets(context);
+    context->is_dropped = false;
+    bitpool_controller.begin(enc.minBitpool(), enc.maxBitpool(), now);
+    // start with a burst of preroll_ms audio
+    context->time_audio_data_sent = now;
+    context->acc_num_missed_samples = 0;
+    context->samples_ready = preroll_ms * current_sample_rate / 1000;
+    context->pcm_buffer_len = 0;
+    context->input_buffer_len = 0;
+    context->is_input_waiting = false;
+    context->is_input_silent = false;
     btstack_run_loop_remove_timer(&context->audio_timer);
     btstack_run_loop_set_timer_handler(&context->audio_timer,
                                        source_a2dp_audio_timeout_handler);
-    btstack_run_loop_set_timer_context(&context->audio_timer, context);
+    btstack_run_loop_set_timer_context(&context->audio_timer, this);
     btstack_run_loop_set_timer(&context->audio_timer, AUDIO_TIMEOUT_MS);
     btstack_run_loop_add_timer(&context->audio_timer);
   }
 
   void a2dp_arduino_timer_stop(a2dp_media_sending_context_t *context) {
     TRACED();
-    // context->time_audio_data_sent = 0;
-    // context->acc_num_missed_samples = 0;
-    // context->samples_ready = 0;
-    context->is_streaming = true;
-    context->sbc_is_busy = false;
+    // packets which were not sent do not match the timeline any more
+    context->packets.clear();
+    context->time_audio_data_sent = 0;
+    context->acc_num_missed_samples = 0;
+    context->samples_ready = 0;
+    context->is_streaming = false;
+    is_passthrough = false;
     btstack_run_loop_remove_timer(&context->audio_timer);
   }
 
+  /// Continues with the encoding of the PCM input after the passthrough
+  void a2dp_arduino_passthrough_stop(a2dp_media_sending_context_t *context) {
+    if (!is_passthrough) return;
+    LOGI("A2DP Source: passthrough stopped: encoding the PCM input");
+    is_passthrough = false;
+    context->time_audio_data_sent = btstack_run_loop_get_time_ms();
+    context->acc_num_missed_samples = 0;
+    context->samples_ready = 0;
+    context->pcm_buffer_len = 0;
+    context->input_buffer_len = 0;
+    a2dp_arduino_update_frame_size(context);
+  }
+
+  /// Determines if the received frames can be sent to the speakers
+  void update_frame_match() {
+    if (frame_config_size == 0) return;
+    is_frame_match = is_streams_opened && configured_links() > 0 &&
+                     get_encoder().acceptsFrames(frame_config,
+                                                 frame_config_size);
+    LOGI("A2DP Source: received frames %s be sent without transcoding",
+         is_frame_match ? "can" : "can not");
+  }
+
+  /// The link starts streaming: it sends the packets which are encoded from
+  /// now on
+  void a2dp_arduino_link_start(a2dp_link_t *link) {
+    link->max_media_payload_size = btstack_min(
+        a2dp_max_media_payload_size(link->a2dp_cid, link->local_seid),
+        A2DP_MEDIA_HEADER_SIZE + SBC_STORAGE_SIZE);
+    link->sbc_is_busy = false;
+    link->is_streaming = true;
+    // the sample clock has continued during the pause
+    uint32_t now = btstack_run_loop_get_time_ms();
+    if (link->time_stream_stopped > 0) {
+      link->rtp_timestamp += (uint64_t)(now - link->time_stream_stopped) *
+                             current_sample_rate / 1000;
+      link->time_stream_stopped = 0;
+    }
+    link->is_rtp_marker = true;
+    link->send_latency_ms = 0;
+    if (!media_tracker.is_streaming) {
+      a2dp_arduino_timer_start(&media_tracker);
+    } else {
+      a2dp_arduino_update_frame_size(&media_tracker);
+    }
+    media_tracker.packets.addReader(link_index(link));
+  }
+
+  /// The link stops streaming: the encoding stops with the last link
+  void a2dp_arduino_link_stop(a2dp_link_t *link) {
+    if (link->is_streaming) {
+      link->time_stream_stopped = btstack_run_loop_get_time_ms();
+    }
+    link->is_streaming = false;
+    link->sbc_is_busy = false;
+    media_tracker.packets.removeReader(link_index(link));
+    if (activeSinks() == 0) a2dp_arduino_timer_stop(&media_tracker);
+  }
+
+  int link_index(a2dp_link_t *link) { return link - links; }
+
+  /// Provides the link of the connection or nullptr
+  a2dp_link_t *get_link(uint16_t cid) {
+    for (auto &link : links) {
+      if (link.is_used && link.a2dp_cid == cid) return &link;
+    }
+    return nullptr;
+  }
+
+  /// Provides the link of the device or nullptr
+  a2dp_link_t *get_link_by_address(bd_addr_t address) {
+    for (auto &link : links) {
+      if (link.is_used && bd_addr_cmp(link.address, address) == 0)
+        return &link;
+    }
+    return nullptr;
+  }
+
+  /// Provides the link of the connection (cid 0: AVRCP only): the link of
+  /// the device or a new link is used if necessary; nullptr if all links are
+  /// in use
+  a2dp_link_t *add_link(uint16_t cid, bd_addr_t address) {
+    a2dp_link_t *result = cid != 0 ? get_link(cid) : nullptr;
+    if (result == nullptr) result = get_link_by_address(address);
+    for (int j = 0; j < sink_count && result == nullptr; j++) {
+      if (!links[j].is_used) {
+        links[j] = a2dp_link_t();
+        links[j].is_used = true;
+        result = &links[j];
+      }
+    }
+    if (result == nullptr) return nullptr;
+    if (cid != 0) result->a2dp_cid = cid;
+    memcpy(result->address, address, 6);
+    return result;
+  }
+
+  void remove_link(a2dp_link_t *link) {
+    a2dp_arduino_link_stop(link);
+    *link = a2dp_link_t();
+  }
+
+  /// Number of links (without the indicated one) which are configured
+  int configured_links(a2dp_link_t *except = nullptr) {
+    int result = 0;
+    for (auto &link : links) {
+      if (&link != except && link.is_used && link.is_configured) result++;
+    }
+    return result;
+  }
+
+  /// Number of additional sinks that we are looking for
+  int missing_sinks() {
+    int result = sink_count;
+    for (auto &link : links) {
+      if (link.is_used) result--;
+    }
+    return result;
+  }
+
+  /// The first configured link defines the encoder configuration: the
+  /// additional links must use the same encoded frames
+  void configure_link(uint16_t cid, uint8_t localSeid, uint8_t remoteSeid,
+                      uint8_t *packet, uint16_t size) {
+    a2dp_link_t *link = get_link(cid);
+    if (link == nullptr) return;
+    link->local_seid = localSeid;
+    link->remote_seid = remoteSeid;
+    // a new configuration starts a new RTP timeline (RFC 3550: random start)
+    link->rtp_timestamp = rand();
+    link->time_stream_stopped = 0;
+
+    if (configured_links(link) > 0) {
+      A2DPEncoder *p_enc = encoders.find(localSeid);
+      if (p_enc != p_encoder || !p_enc->joinConfiguration(packet, size)) {
+        LOGE("A2DP Source: a2dp_cid 0x%02x can not share the stream",
+             cid);
+        link->is_configured = false;
+        a2dp_source_disconnect(cid);
+        return;
+      }
+      link->is_configured = true;
+      a2dp_arduino_limit_bitpool(&media_tracker);
+      update_frame_match();
+      return;
+    }
+
+    if (!select_encoder(localSeid)) return;
+    link->is_configured = true;
+    A2DPEncoder &enc = get_encoder();
+    enc.setValues(cid, packet, size);
+    // Setup encoder
+    auto info = enc.audioInfo();
+    source_a2dp_configure_sample_rate(info.sample_rate);
+    open_audio_streams();
+    update_frame_match();
+  }
+
+  /// Remembers a speaker which was found by the inquiry: returns false if it
+  /// is already known
+  bool add_found_sink(bd_addr_t address) {
+    for (int j = 0; j < found_count; j++) {
+      if (bd_addr_cmp(found_addr[j], address) == 0) return false;
+    }
+    for (auto &link : links) {
+      if (link.is_used && bd_addr_cmp(link.address, address) == 0)
+        return false;
+    }
+    if (found_count >= A2DP_MAX_LINKS) return false;
+    memcpy(found_addr[found_count++], address, 6);
+    return true;
+  }
+
+  /// Connects the speakers which were found one after the other
+  void connect_next_sink() {
+    while (connect_pos < found_count) {
+      bd_addr_t &address = found_addr[connect_pos++];
+      memcpy(device_addr, address, 6);
+      LOGI("Trying to connect to %s...", bd_addr_to_str(device_addr));
+      uint16_t cid = 0;
+      uint8_t status = a2dp_source_establish_stream(device_addr, &cid);
+      a2dp_link_t *link =
+          status == ERROR_CODE_SUCCESS ? add_link(cid, device_addr) : nullptr;
+      if (link != nullptr) return;
+      LOGE("A2DP Source: could not connect to %s, status 0x%02x",
+           bd_addr_to_str(device_addr), status);
+    }
+  }
+
+  /// Connects the next speaker: the known speakers are tried first
+  void connect_next() {
+    if (is_reconnecting) {
+      connect_next_known_sink();
+    } else {
+      connect_next_sink();
+    }
+  }
+
+  /// Pages the known speakers one after the other, until all sinks are
+  /// connected: if this does not succeed we start the inquiry
+  void connect_next_known_sink() {
+    while (missing_sinks() > 0 && known_pos < known_count) {
+      bd_addr_t &address = known_addr[known_pos++];
+      if (hasAddress(address)) continue;
+      memcpy(device_addr, address, 6);
+      LOGI("Reconnecting to %s...", bd_addr_to_str(device_addr));
+      uint16_t cid = 0;
+      uint8_t status = a2dp_source_establish_stream(device_addr, &cid);
+      a2dp_link_t *link =
+          status == ERROR_CODE_SUCCESS ? add_link(cid, device_addr) : nullptr;
+      if (link != nullptr) return;
+      LOGE("A2DP Source: could not reconnect to %s, status 0x%02x",
+           bd_addr_to_str(device_addr), status);
+    }
+    is_reconnecting = false;
+    if (missing_sinks() > 0) a2dp_source_arduino_start_inquiry();
+  }
+
+  /// Adds a speaker to the known speakers: at the start of the list if it
+  /// has been connected, otherwise at the end. Returns true if the list has
+  /// changed.
+  bool add_known_sink(bd_addr_t address, bool isConnected) {
+    int pos = known_count;
+    for (int j = 0; j < known_count; j++) {
+      if (bd_addr_cmp(known_addr[j], address) == 0) pos = j;
+    }
+    if (!isConnected) {
+      if (pos < known_count || known_count >= SOURCE_MAX_KNOWN_SINKS)
+        return false;
+      memcpy(known_addr[known_count++], address, 6);
+      return true;
+    }
+    if (pos == 0) return false;
+    if (pos == known_count && known_count < SOURCE_MAX_KNOWN_SINKS)
+      known_count++;
+    if (pos >= SOURCE_MAX_KNOWN_SINKS) pos = SOURCE_MAX_KNOWN_SINKS - 1;
+    memmove(known_addr[1], known_addr[0], pos * sizeof(bd_addr_t));
+    memcpy(known_addr[0], address, 6);
+    return true;
+  }
+
+  /// Reads the speakers which were connected before
+  void load_known_sinks() {
+    if (is_known_loaded) return;
+    is_known_loaded = true;
+    const btstack_tlv_t *p_tlv = nullptr;
+    void *p_tlv_context = nullptr;
+    btstack_tlv_get_instance(&p_tlv, &p_tlv_context);
+    if (p_tlv == nullptr) return;
+    uint8_t data[SOURCE_MAX_KNOWN_SINKS * sizeof(bd_addr_t)];
+    int len = p_tlv->get_tag(p_tlv_context, SOURCE_KNOWN_SINKS_TAG, data,
+                             sizeof(data));
+    for (int pos = 0; pos + (int)sizeof(bd_addr_t) <= len;
+         pos += sizeof(bd_addr_t)) {
+      add_known_sink(data + pos, false);
+    }
+    LOGI("A2DP Source: %d known speakers", known_count);
+  }
+
+  /// Persists the known speakers (most recent first)
+  void store_known_sinks() {
+    const btstack_tlv_t *p_tlv = nullptr;
+    void *p_tlv_context = nullptr;
+    btstack_tlv_get_instance(&p_tlv, &p_tlv_context);
+    if (p_tlv == nullptr) return;
+    p_tlv->store_tag(p_tlv_context, SOURCE_KNOWN_SINKS_TAG,
+                     (const uint8_t *)known_addr,
+                     known_count * sizeof(bd_addr_t));
+  }
+
+  /// Reconnects the known speakers: the inquiry is only started if none of
+  /// them answers
   void a2dp_source_arduino_start_scanning(void) {
+    TRACED();
+    load_known_sinks();
+    if (is_reconnect && known_count > 0 && missing_sinks() > 0) {
+      is_reconnecting = true;
+      known_pos = 0;
+      connect_next_known_sink();
+      return;
+    }
+    a2dp_source_arduino_start_inquiry();
+  }
+
+  void a2dp_source_arduino_start_inquiry(void) {
     TRACED();
     LOGI("Start scanning...");
+    found_count = 0;
+    connect_pos = 0;
     gap_inquiry_start(A2DP_SOURCE_arduino_INQUIRY_DURATION_1280MS);
     scan_active = true;
   }
@@ -506,11 +1321,6 @@ class A2DPSourceClass : public A2DPCommon {
         if (btstack_event_state_get_state(packet) != HCI_STATE_WORKING) return;
         a2dp_source_arduino_start_scanning();
         break;
-      case HCI_EVENT_PIN_CODE_REQUEST:
-        LOGI("Pin code request - using '0000'");
-        hci_event_pin_code_request_get_bd_addr(packet, address);
-        gap_pin_code_response(address, "0000");
-        break;
       case GAP_EVENT_INQUIRY_RESULT:
         gap_event_inquiry_result_get_bd_addr(packet, address);
         // print info
@@ -533,20 +1343,29 @@ class A2DPSourceClass : public A2DPCommon {
             name_matches = Str(name_buffer).equalsIgnoreCase(remote_name);
           }
         }
-        if (name_matches &&
-            (cod & bluetooth_speaker_cod) == bluetooth_speaker_cod) {
-          memcpy(device_addr, address, 6);
-          LOGI("Bluetooth speaker detected, trying to connect to %s...",
-               bd_addr_to_str(device_addr));
-          scan_active = false;
-          gap_inquiry_stop();
-          a2dp_source_establish_stream(device_addr, &media_tracker.a2dp_cid);
+        if (scan_active && name_matches &&
+            (cod & bluetooth_speaker_cod) == bluetooth_speaker_cod &&
+            add_found_sink(address)) {
+          LOGI("Bluetooth speaker detected: %s", bd_addr_to_str(address));
+          // we continue the inquiry until all sinks were found
+          if (found_count >= missing_sinks()) {
+            scan_active = false;
+            gap_inquiry_stop();
+            connect_next_sink();
+          }
         }
         break;
       case GAP_EVENT_INQUIRY_COMPLETE:
         if (scan_active) {
-          LOGW("No Bluetooth speakers found, scanning again...");
-          gap_inquiry_start(A2DP_SOURCE_arduino_INQUIRY_DURATION_1280MS);
+          if (found_count > 0) {
+            LOGW("Only %d of %d Bluetooth speakers found", found_count,
+                 missing_sinks());
+            scan_active = false;
+            connect_next_sink();
+          } else {
+            LOGW("No Bluetooth speakers found, scanning again...");
+            gap_inquiry_start(A2DP_SOURCE_arduino_INQUIRY_DURATION_1280MS);
+          }
         }
         break;
       default:
@@ -571,7 +1390,7 @@ class A2DPSourceClass : public A2DPCommon {
     if (hci_event_packet_get_type(packet) != HCI_EVENT_A2DP_META) return;
 
     switch (hci_event_a2dp_meta_get_subevent_code(packet)) {
-      case A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED:
+      case A2DP_SUBEVENT_SIGNALING_CONNECTION_ESTABLISHED: {
         a2dp_subevent_signaling_connection_established_get_bd_addr(packet,
                                                                    address);
         cid =
@@ -583,29 +1402,46 @@ class A2DPSourceClass : public A2DPCommon {
           LOGE(
               "A2DP Source: Connection failed, status 0x%02x, cid 0x%02x", 
               status, cid);
+          a2dp_link_t *link = get_link(cid);
+          if (link != nullptr) remove_link(link);
+          connect_next();
+          break;
+        }
+        // the connection might have been initiated by the speaker
+        a2dp_link_t *link = add_link(cid, address);
+        if (link == nullptr) {
+          LOGW("A2DP Source: max %d sinks: disconnecting %s", sink_count,
+               bd_addr_to_str(address));
+          a2dp_source_disconnect(cid);
           break;
         }
         LOGI("A2DP Source: Connected to address %s", bd_addr_to_str(address));
+        if (add_known_sink(address, true)) store_known_sinks();
+        connect_next();
         break;
+      }
 
-      case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION: {
-        cid =
+      case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_SBC_CONFIGURATION:
+        configure_link(
             avdtp_subevent_signaling_media_codec_sbc_configuration_get_avdtp_cid(
-                packet);
-        if (cid != media_tracker.a2dp_cid) return;
-
-        media_tracker.remote_seid =
+                packet),
+            a2dp_subevent_signaling_media_codec_sbc_configuration_get_local_seid(
+                packet),
             a2dp_subevent_signaling_media_codec_sbc_configuration_get_remote_seid(
-                packet);
+                packet),
+            packet, size);
+        break;
 
-        A2DPEncoder &enc = get_encoder();
-        enc.setValues(cid, packet, size);
-        // Setup SBC decoder
-        auto info = enc.audioInfo();
-        source_a2dp_configure_sample_rate(info.sample_rate);
-        open_audio_streams();
+      case A2DP_SUBEVENT_SIGNALING_MEDIA_CODEC_OTHER_CONFIGURATION:
+        configure_link(
+            a2dp_subevent_signaling_media_codec_other_configuration_get_a2dp_cid(
+                packet),
+            a2dp_subevent_signaling_media_codec_other_configuration_get_local_seid(
+                packet),
+            a2dp_subevent_signaling_media_codec_other_configuration_get_remote_seid(
+                packet),
+            packet, size);
         break;
-      }
 
       case A2DP_SUBEVENT_SIGNALING_DELAY_REPORTING_CAPABILITY:
         LOGI(
@@ -619,16 +1455,30 @@ class A2DPSourceClass : public A2DPCommon {
             avdtp_subevent_signaling_capabilities_done_get_remote_seid(packet));
         break;
 
-      case A2DP_SUBEVENT_SIGNALING_DELAY_REPORT:
+      case A2DP_SUBEVENT_SIGNALING_DELAY_REPORT: {
         LOGI(
             "A2DP Source: Received delay report of %d.%0d ms, local seid "
             "%d",
             avdtp_subevent_signaling_delay_report_get_delay_100us(packet) / 10,
             avdtp_subevent_signaling_delay_report_get_delay_100us(packet) % 10,
             avdtp_subevent_signaling_delay_report_get_local_seid(packet));
+        a2dp_link_t *link =
+            get_link(avdtp_subevent_signaling_delay_report_get_avdtp_cid(packet));
+        if (link == nullptr) break;
+        link->remote_delay_us =
+            avdtp_subevent_signaling_delay_report_get_delay_100us(packet) *
+            100;
+        // the slowest sink decides
+        remote_delay_us = 0;
+        for (auto &l : links) {
+          if (l.is_used && l.remote_delay_us > remote_delay_us)
+            remote_delay_us = l.remote_delay_us;
+        }
+        if (latency_callback) latency_callback(latencyUs());
         break;
+      }
 
-      case A2DP_SUBEVENT_STREAM_ESTABLISHED:
+      case A2DP_SUBEVENT_STREAM_ESTABLISHED: {
         a2dp_subevent_stream_established_get_bd_addr(packet, address);
         status = a2dp_subevent_stream_established_get_status(packet);
         if (status != ERROR_CODE_SUCCESS) {
@@ -645,11 +1495,13 @@ class A2DPSourceClass : public A2DPCommon {
             cid, local_seid,
             a2dp_subevent_stream_established_get_remote_seid(packet));
 
+        a2dp_link_t *link = get_link(cid);
+        if (link == nullptr || !link->is_configured) break;
         source_a2dp_configure_sample_rate(current_sample_rate);
-        media_tracker.stream_opened = 1;
-        status = a2dp_source_start_stream(media_tracker.a2dp_cid,
-                                          media_tracker.local_seid);
+        link->stream_opened = 1;
+        status = a2dp_source_start_stream(cid, local_seid);
         break;
+      }
 
       case A2DP_SUBEVENT_STREAM_RECONFIGURED:
         status = a2dp_subevent_stream_reconfigured_get_status(packet);
@@ -669,57 +1521,55 @@ class A2DPSourceClass : public A2DPCommon {
             "0x%02x",
             cid, local_seid);
         source_a2dp_configure_sample_rate(new_sample_rate);
-        status = a2dp_source_start_stream(media_tracker.a2dp_cid,
-                                          media_tracker.local_seid);
+        status = a2dp_source_start_stream(cid, local_seid);
         break;
 
-      case A2DP_SUBEVENT_STREAM_STARTED:
+      case A2DP_SUBEVENT_STREAM_STARTED: {
         local_seid = a2dp_subevent_stream_started_get_local_seid(packet);
         cid = a2dp_subevent_stream_started_get_a2dp_cid(packet);
+        a2dp_link_t *link = get_link(cid);
+        if (link == nullptr) break;
 
         play_info.status = AVRCP_PLAYBACK_STATUS_PLAYING;
-        if (media_tracker.avrcp_cid) {
-          avrcp_target_set_now_playing_info(media_tracker.avrcp_cid,
-                                            &track_info, track_count);
-          avrcp_target_set_playback_status(media_tracker.avrcp_cid,
-                                           AVRCP_PLAYBACK_STATUS_PLAYING);
-        }
-        a2dp_arduino_timer_start(&media_tracker);
+        avrcp_set_playback_status(AVRCP_PLAYBACK_STATUS_PLAYING, true);
+        a2dp_arduino_link_start(link);
         LOGI(
             "A2DP Source: Stream started, a2dp_cid 0x%02x, local_seid "
             "0x%02x",
             cid, local_seid);
         break;
+      }
 
-      case A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW:
+      case A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW: {
         local_seid =
             a2dp_subevent_streaming_can_send_media_packet_now_get_local_seid(
                 packet);
-        cid =
-            a2dp_subevent_signaling_media_codec_sbc_configuration_get_a2dp_cid(
-                packet);
-        a2dp_arduino_send_media_packet();
+        cid = a2dp_subevent_streaming_can_send_media_packet_now_get_a2dp_cid(
+            packet);
+        a2dp_link_t *link = get_link(cid);
+        if (link != nullptr) a2dp_arduino_send_media_packet(link);
         break;
+      }
 
-      case A2DP_SUBEVENT_STREAM_SUSPENDED:
+      case A2DP_SUBEVENT_STREAM_SUSPENDED: {
         local_seid = a2dp_subevent_stream_suspended_get_local_seid(packet);
         cid = a2dp_subevent_stream_suspended_get_a2dp_cid(packet);
+        a2dp_link_t *link = get_link(cid);
+        if (link == nullptr) break;
 
-        play_info.status = AVRCP_PLAYBACK_STATUS_PAUSED;
-        if (media_tracker.avrcp_cid) {
-          avrcp_target_set_playback_status(media_tracker.avrcp_cid,
-                                           AVRCP_PLAYBACK_STATUS_PAUSED);
-        }
         LOGI(
             "A2DP Source: Stream paused, a2dp_cid 0x%02x, local_seid "
             "0x%02x",
             cid, local_seid);
 
-        a2dp_arduino_timer_stop(&media_tracker);
+        a2dp_arduino_link_stop(link);
+        if (activeSinks() > 0) break;
+        play_info.status = AVRCP_PLAYBACK_STATUS_PAUSED;
+        avrcp_set_playback_status(AVRCP_PLAYBACK_STATUS_PAUSED, false);
         break;
+      }
 
-      case A2DP_SUBEVENT_STREAM_RELEASED:
-        play_info.status = AVRCP_PLAYBACK_STATUS_STOPPED;
+      case A2DP_SUBEVENT_STREAM_RELEASED: {
         cid = a2dp_subevent_stream_released_get_a2dp_cid(packet);
         local_seid = a2dp_subevent_stream_released_get_local_seid(packet);
 
@@ -728,26 +1578,24 @@ class A2DPSourceClass : public A2DPCommon {
             "0x%02x",
             cid, local_seid);
 
-        if (cid == media_tracker.a2dp_cid) {
-          media_tracker.stream_opened = 0;
-          LOGI("A2DP Source: Stream released.");
-        }
-        if (media_tracker.avrcp_cid) {
-          avrcp_target_set_now_playing_info(media_tracker.avrcp_cid, NULL,
-                                            track_count);
-          avrcp_target_set_playback_status(media_tracker.avrcp_cid,
-                                           AVRCP_PLAYBACK_STATUS_STOPPED);
-        }
-        a2dp_arduino_timer_stop(&media_tracker);
+        a2dp_link_t *link = get_link(cid);
+        if (link == nullptr) break;
+        link->stream_opened = 0;
+        link->is_configured = false;
+        a2dp_arduino_link_stop(link);
+        if (activeSinks() > 0) break;
+        play_info.status = AVRCP_PLAYBACK_STATUS_STOPPED;
+        avrcp_set_playback_status(AVRCP_PLAYBACK_STATUS_STOPPED, true);
         break;
-      case A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED:
+      }
+      case A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED: {
         cid = a2dp_subevent_signaling_connection_released_get_a2dp_cid(packet);
-        if (cid == media_tracker.a2dp_cid) {
-          media_tracker.avrcp_cid = 0;
-          media_tracker.a2dp_cid = 0;
-          LOGI("A2DP Source: Signaling released.");
-        }
+        a2dp_link_t *link = get_link(cid);
+        if (link == nullptr) break;
+        remove_link(link);
+        LOGI("A2DP Source: Signaling released, a2dp_cid 0x%02x", cid);
         break;
+      }
       default:
         break;
     }
@@ -761,6 +1609,7 @@ class A2DPSourceClass : public A2DPCommon {
     bd_addr_t event_addr;
     uint16_t local_cid;
     uint8_t status = ERROR_CODE_SUCCESS;
+    a2dp_link_t *link = nullptr;
 
     if (packet_type != HCI_EVENT_PACKET) return;
     if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META) return;
@@ -774,36 +1623,43 @@ class A2DPSourceClass : public A2DPCommon {
                local_cid, status);
           return;
         }
-        media_tracker.avrcp_cid = local_cid;
         avrcp_subevent_connection_established_get_bd_addr(packet, event_addr);
+        // the speaker might connect AVRCP before A2DP
+        link = add_link(0, event_addr);
+        if (link == nullptr) {
+          LOGW("AVRCP: no link for %s", bd_addr_to_str(event_addr));
+          return;
+        }
+        link->avrcp_cid = local_cid;
 
         LOGI("AVRCP: Channel to %s successfully opened, avrcp_cid 0x%02x",
-             bd_addr_to_str(event_addr), media_tracker.avrcp_cid);
+             bd_addr_to_str(event_addr), local_cid);
 
         avrcp_target_support_event(
-            media_tracker.avrcp_cid,
-            AVRCP_NOTIFICATION_EVENT_PLAYBACK_STATUS_CHANGED);
-        avrcp_target_support_event(media_tracker.avrcp_cid,
+            local_cid, AVRCP_NOTIFICATION_EVENT_PLAYBACK_STATUS_CHANGED);
+        avrcp_target_support_event(local_cid,
                                    AVRCP_NOTIFICATION_EVENT_TRACK_CHANGED);
         avrcp_target_support_event(
-            media_tracker.avrcp_cid,
-            AVRCP_NOTIFICATION_EVENT_NOW_PLAYING_CONTENT_CHANGED);
-        avrcp_target_set_now_playing_info(media_tracker.avrcp_cid, NULL,
-                                          track_count);
+            local_cid, AVRCP_NOTIFICATION_EVENT_NOW_PLAYING_CONTENT_CHANGED);
+        avrcp_target_set_now_playing_info(local_cid, NULL, track_count);
 
         LOGI("Enable Volume Change notification");
         avrcp_controller_enable_notification(
-            media_tracker.avrcp_cid, AVRCP_NOTIFICATION_EVENT_VOLUME_CHANGED);
+            local_cid, AVRCP_NOTIFICATION_EVENT_VOLUME_CHANGED);
         LOGI("Enable Battery Status Change notification");
         avrcp_controller_enable_notification(
-            media_tracker.avrcp_cid,
-            AVRCP_NOTIFICATION_EVENT_BATT_STATUS_CHANGED);
+            local_cid, AVRCP_NOTIFICATION_EVENT_BATT_STATUS_CHANGED);
         return;
 
       case AVRCP_SUBEVENT_CONNECTION_RELEASED:
-        LOGI("AVRCP Target: Disconnected, avrcp_cid 0x%02x",
-             avrcp_subevent_connection_released_get_avrcp_cid(packet));
-        media_tracker.avrcp_cid = 0;
+        local_cid = avrcp_subevent_connection_released_get_avrcp_cid(packet);
+        LOGI("AVRCP Target: Disconnected, avrcp_cid 0x%02x", local_cid);
+        for (auto &link : links) {
+          if (!link.is_used || link.avrcp_cid != local_cid) continue;
+          link.avrcp_cid = 0;
+          // the link was only used by AVRCP
+          if (link.a2dp_cid == 0) link = a2dp_link_t();
+        }
         return;
       default:
         break;
@@ -823,7 +1679,7 @@ class A2DPSourceClass : public A2DPCommon {
 
     if (packet_type != HCI_EVENT_PACKET) return;
     if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META) return;
-    if (!media_tracker.avrcp_cid) return;
+    if (get_avrcp_cid() == 0) return;
 
     switch (packet[2]) {
       case AVRCP_SUBEVENT_NOTIFICATION_VOLUME_CHANGED:
@@ -870,9 +1726,12 @@ class A2DPSourceClass : public A2DPCommon {
 
     switch (packet[2]) {
       case AVRCP_SUBEVENT_PLAY_STATUS_QUERY:
+        // the status is the same for all speakers: we answer the one which
+        // asked
         status = avrcp_target_play_status(
-            media_tracker.avrcp_cid, play_info.song_length_ms,
-            play_info.song_position_ms, play_info.status);
+            avrcp_subevent_play_status_query_get_avrcp_cid(packet),
+            play_info.song_length_ms, play_info.song_position_ms,
+            play_info.status);
         break;
       // case AVRCP_SUBEVENT_NOW_PLAYING_INFO_QUERY:
       //     status = avrcp_target_now_playing_info(avrcp_cid);
@@ -892,16 +1751,26 @@ class A2DPSourceClass : public A2DPCommon {
           break;
         }
         switch (operation_id) {
+          // the operation applies to all sinks
           case AVRCP_OPERATION_ID_PLAY:
-            status = a2dp_source_start_stream(media_tracker.a2dp_cid,
-                                              media_tracker.local_seid);
+            for (auto &link : links) {
+              if (link.is_configured && !link.is_streaming)
+                status = a2dp_source_start_stream(link.a2dp_cid,
+                                                  link.local_seid);
+            }
             break;
           case AVRCP_OPERATION_ID_PAUSE:
-            status = a2dp_source_pause_stream(media_tracker.a2dp_cid,
-                                              media_tracker.local_seid);
+            for (auto &link : links) {
+              if (link.is_streaming)
+                status = a2dp_source_pause_stream(link.a2dp_cid,
+                                                  link.local_seid);
+            }
             break;
           case AVRCP_OPERATION_ID_STOP:
-            status = a2dp_source_disconnect(media_tracker.a2dp_cid);
+            for (auto &link : links) {
+              if (link.a2dp_cid != 0)
+                status = a2dp_source_disconnect(link.a2dp_cid);
+            }
             break;
           default:
             break;
@@ -918,7 +1787,6 @@ class A2DPSourceClass : public A2DPCommon {
   }
 
   void setupTrack() {
-    static bool is_track_setup = false;
     if (!is_track_setup) {
       TRACED();
       char *empty = (char *)"n/a";
@@ -935,40 +1803,22 @@ class A2DPSourceClass : public A2DPCommon {
     }
   }
 
-} A2DPSource;
-
-// -- Implement Callback functions which forward calls to A2DPSource
+};
 
-void source_a2dp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                uint8_t *event, uint16_t event_size) {
-  A2DPSource.a2dp_packet_handler(packet_type, channel, event, event_size);
+/// Provides the single A2DPSourceClass object: it is shared by all
+/// translation units, so the header can be included more than once
+inline A2DPSourceClass &getA2DPSource() {
+  static A2DPSourceClass source;
+  return source;
 }
+static A2DPSourceClass &A2DPSource = getA2DPSource();
 
-void source_avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel,
-                                        uint8_t *packet, uint16_t size) {
-  A2DPSource.avrcp_target_packet_handler(packet_type, channel, packet,
-                                               size);
-}
-
-void source_hci_packet_handler(uint8_t packet_type, uint16_t channel,
-                               uint8_t *packet, uint16_t size) {
-  A2DPSource.hci_packet_handler(packet_type, channel, packet, size);
-}
-
-void source_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
-                                 uint8_t *packet, uint16_t size) {
-  A2DPSource.avrcp_packet_handler(packet_type, channel, packet, size);
-}
-
-void source_a2dp_audio_timeout_handler(btstack_timer_source_t *timer) {
-  A2DPSource.a2dp_audio_timeout_handler(timer);
-}
+// -- Implement Callback functions which forward calls to the A2DPSourceClass
 
-void source_avrcp_controller_packet_handler(uint8_t packet_type,
-                                            uint16_t channel, uint8_t *packet,
-                                            uint16_t size) {
-  A2DPSource.avrcp_controller_packet_handler(packet_type, channel, packet,
-                                                   size);
+inline void source_a2dp_audio_timeout_handler(
+    btstack_timer_source_t *timer) {
+  ((A2DPSourceClass *)btstack_run_loop_get_timer_context(timer))
+      ->a2dp_audio_timeout_handler(timer);
 }
 
 }  // namespace btstack_a2dp
@@ -0,0 +1,439 @@
+/**
+ * @file A2DPStack.h
+ * @author Phil Schatzmann
+ * @brief Shared BTstack context of the A2DP sink and source objects
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include "A2DPCommon.h"
+
+namespace btstack_a2dp {
+
+// -- Declare Stack Callback functions
+extern "C" inline void stack_hci_packet_handler(uint8_t packet_type,
+                                                uint16_t channel,
+                                                uint8_t *packet, uint16_t size);
+extern "C" inline void stack_a2dp_sink_packet_handler(uint8_t packet_type,
+                                                      uint16_t channel,
+                                                      uint8_t *packet,
+                                                      uint16_t size);
+extern "C" inline void stack_a2dp_source_packet_handler(uint8_t packet_type,
+                                                        uint16_t channel,
+                                                        uint8_t *packet,
+                                                        uint16_t size);
+extern "C" inline void stack_media_packet_handler(uint8_t seid,
+                                                  uint8_t *packet,
+                                                  uint16_t size);
+extern "C" inline void stack_avrcp_packet_handler(uint8_t packet_type,
+                                                  uint16_t channel,
+                                                  uint8_t *packet,
+                                                  uint16_t size);
+extern "C" inline void stack_avrcp_controller_packet_handler(
+    uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+extern "C" inline void stack_avrcp_target_packet_handler(uint8_t packet_type,
+                                                         uint16_t channel,
+                                                         uint8_t *packet,
+                                                         uint16_t size);
+
+/**
+ * @brief Shared BTstack context: the services which exist only once per
+ * device (L2CAP, SDP, AVRCP, the HCI event handler and the A2DP callbacks)
+ * are set up here, and the callbacks are dispatched by cid, seid or address
+ * to the registered sink and source objects. So one device can receive from a
+ * phone and send to a speaker at the same time (relay mode).
+ * @author Phil Schatzmann
+ */
+class A2DPStackClass {
+ public:
+  /// Initializes the shared services (only the first call has an effect)
+  void begin(bool isBLEEnabled = false) {
+    if (is_active) return;
+    LOGI("A2DPStack::begin");
+    l2cap_init();
+    sdp_init();
+#ifdef ENABLE_BLE
+    if (isBLEEnabled) {
+      // Initialize LE Security Manager. Needed for cross-transport key
+      // derivation
+      sm_init();
+    }
+#endif
+
+    avrcp_init();
+    avrcp_register_packet_handler(&stack_avrcp_packet_handler);
+    avrcp_controller_init();
+    avrcp_controller_register_packet_handler(
+        &stack_avrcp_controller_packet_handler);
+    avrcp_target_init();
+    avrcp_target_register_packet_handler(&stack_avrcp_target_packet_handler);
+
+    // Register Device ID (PnP) service SDP record
+    memset(device_id_sdp_service_buffer, 0,
+           sizeof(device_id_sdp_service_buffer));
+    device_id_create_sdp_record(device_id_sdp_service_buffer,
+                                nextServiceHandle(),
+                                DEVICE_ID_VENDOR_ID_SOURCE_BLUETOOTH,
+                                BLUETOOTH_COMPANY_ID_BLUEKITCHEN_GMBH, 1, 1);
+    sdp_register_service(device_id_sdp_service_buffer);
+
+    // Register for HCI events
+    hci_event_callback_registration.callback = &stack_hci_packet_handler;
+    hci_add_event_handler(&hci_event_callback_registration);
+    is_active = true;
+  }
+
+  /// Turns on Bluetooth (only the first call has an effect)
+  bool powerOn() {
+    if (is_powered) return true;
+#if defined(RP2040_HOWER)
+    _hci.install();
+    _hci.begin();
+#endif
+    LOGI("Power On ...");
+    if (hci_power_control(HCI_POWER_ON) != 0) {
+      LOGE("hci_power_control");
+      return false;
+    }
+    is_powered = true;
+    return true;
+  }
+
+  /// Registers a sink or source object which receives the callbacks
+  bool addRole(A2DPCommon &role) {
+    for (int j = 0; j < role_count; j++) {
+      if (roles[j] == &role) return true;
+    }
+    if (role_count >= MAX_ROLES) {
+      LOGE("A2DPStack: max %d roles", MAX_ROLES);
+      return false;
+    }
+    if (!check_pools(role)) return false;
+    roles[role_count++] = &role;
+    if (role.isSink() && !is_sink_init) {
+      a2dp_sink_init();
+      a2dp_sink_register_packet_handler(&stack_a2dp_sink_packet_handler);
+      a2dp_sink_register_media_handler(&stack_media_packet_handler);
+      is_sink_init = true;
+    }
+    if (!role.isSink() && !is_source_init) {
+      a2dp_source_init();
+      a2dp_source_register_packet_handler(&stack_a2dp_source_packet_handler);
+      is_source_init = true;
+    }
+    return true;
+  }
+
+  /// Provides a unique SDP service record handle
+  uint32_t nextServiceHandle() { return service_handle++; }
+
+  /// Adds the supported AVRCP features of a role: the AVRCP controller and
+  /// target records are registered with the features of all roles
+  void addAvrcpFeatures(uint16_t controllerFeatures, uint16_t targetFeatures) {
+    avrcp_controller_features |= controllerFeatures;
+    avrcp_target_features |= targetFeatures;
+
+    if (avrcp_controller_handle != 0)
+      sdp_unregister_service(avrcp_controller_handle);
+    else
+      avrcp_controller_handle = nextServiceHandle();
+    memset(sdp_avrcp_controller_service_buffer, 0,
+           sizeof(sdp_avrcp_controller_service_buffer));
+    avrcp_controller_create_sdp_record(sdp_avrcp_controller_service_buffer,
+                                       avrcp_controller_handle,
+                                       avrcp_controller_features, NULL, NULL);
+    sdp_register_service(sdp_avrcp_controller_service_buffer);
+
+    if (avrcp_target_handle != 0)
+      sdp_unregister_service(avrcp_target_handle);
+    else
+      avrcp_target_handle = nextServiceHandle();
+    memset(sdp_avrcp_target_service_buffer, 0,
+           sizeof(sdp_avrcp_target_service_buffer));
+    avrcp_target_create_sdp_record(sdp_avrcp_target_service_buffer,
+                                   avrcp_target_handle, avrcp_target_features,
+                                   NULL, NULL);
+    sdp_register_service(sdp_avrcp_target_service_buffer);
+  }
+
+  /// Defines the local name and the class of device: the first role wins
+  void setDeviceInfo(const char *name, uint32_t classOfDevice) {
+    if (is_device_info) return;
+    gap_set_local_name(name);
+    gap_set_class_of_device(classOfDevice);
+    is_device_info = true;
+  }
+
+  /// Determines if BTstack is up and running
+  bool isWorking() { return hci_get_state() == HCI_STATE_WORKING; }
+
+ protected:
+  friend void stack_hci_packet_handler(uint8_t packet_type, uint16_t channel,
+                                       uint8_t *packet, uint16_t size);
+  friend void stack_a2dp_sink_packet_handler(uint8_t packet_type,
+                                             uint16_t channel,
+                                             uint8_t *packet, uint16_t size);
+  friend void stack_a2dp_source_packet_handler(uint8_t packet_type,
+                                               uint16_t channel,
+                                               uint8_t *packet,
+                                               uint16_t size);
+  friend void stack_media_packet_handler(uint8_t seid, uint8_t *packet,
+                                         uint16_t size);
+  friend void stack_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
+                                         uint8_t *packet, uint16_t size);
+  friend void stack_avrcp_controller_packet_handler(uint8_t packet_type,
+                                                    uint16_t channel,
+                                                    uint8_t *packet,
+                                                    uint16_t size);
+  friend void stack_avrcp_target_packet_handler(uint8_t packet_type,
+                                                uint16_t channel,
+                                                uint8_t *packet,
+                                                uint16_t size);
+
+  static const int MAX_ROLES = 4;
+
+  /// AVRCP connection which was assigned to a role
+  struct avrcp_route_t {
+    uint16_t avrcp_cid = 0;
+    A2DPCommon *p_role = nullptr;
+  };
+
+#if defined(RP2040_HOWER)
+  BluetoothHCI _hci;
+#endif
+  A2DPCommon *roles[MAX_ROLES] = {nullptr};
+  int role_count = 0;
+  avrcp_route_t avrcp_routes[MAX_NR_AVRCP_CONNECTIONS];
+  bool is_active = false;
+  bool is_powered = false;
+  bool is_sink_init = false;
+  bool is_source_init = false;
+  bool is_device_info = false;
+  uint32_t service_handle = 0x10001;
+  uint32_t avrcp_controller_handle = 0;
+  uint32_t avrcp_target_handle = 0;
+  uint16_t avrcp_controller_features = 0;
+  uint16_t avrcp_target_features = 0;
+  btstack_packet_callback_registration_t hci_event_callback_registration;
+  uint8_t sdp_avrcp_target_service_buffer[200];
+  uint8_t sdp_avrcp_controller_service_buffer[200];
+  uint8_t device_id_sdp_service_buffer[100];
+
+  /// BTstack has no malloc: the connections, stream endpoints and link keys
+  /// of all roles come from the pools defined in btstack_config.h
+  bool check_pools(A2DPCommon &role) {
+    int connections = role.maxConnections();
+    int endpoints = role.streamEndpointCount();
+    int link_keys = role.linkKeyCount();
+    for (int j = 0; j < role_count; j++) {
+      connections += roles[j]->maxConnections();
+      endpoints += roles[j]->streamEndpointCount();
+      link_keys += roles[j]->linkKeyCount();
+    }
+    if (connections > MAX_NR_AVDTP_CONNECTIONS ||
+        connections > MAX_NR_AVRCP_CONNECTIONS) {
+      LOGE(
+          "A2DPStack: %d connections exceed MAX_NR_AVDTP_CONNECTIONS (%d) or "
+          "MAX_NR_AVRCP_CONNECTIONS (%d)",
+          connections, MAX_NR_AVDTP_CONNECTIONS, MAX_NR_AVRCP_CONNECTIONS);
+      return false;
+    }
+    if (endpoints > MAX_NR_AVDTP_STREAM_ENDPOINTS) {
+      LOGE("A2DPStack: %d stream endpoints exceed "
+           "MAX_NR_AVDTP_STREAM_ENDPOINTS (%d)",
+           endpoints, MAX_NR_AVDTP_STREAM_ENDPOINTS);
+      return false;
+    }
+    if (link_keys > MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES) {
+      LOGE("A2DPStack: %d link keys exceed "
+           "MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES (%d)",
+           link_keys, MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES);
+      return false;
+    }
+    return true;
+  }
+
+  /// All roles get the HCI events
+  void hci_packet_handler(uint8_t packet_type, uint16_t channel,
+                          uint8_t *packet, uint16_t size) {
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) == HCI_EVENT_PIN_CODE_REQUEST) {
+      bd_addr_t address;
+      LOGI("Pin code request - using '0000'");
+      hci_event_pin_code_request_get_bd_addr(packet, address);
+      gap_pin_code_response(address, "0000");
+    }
+    for (int j = 0; j < role_count; j++) {
+      roles[j]->hci_packet_handler(packet_type, channel, packet, size);
+    }
+  }
+
+  /**
+   * @brief All A2DP subevents start with the a2dp_cid: the event goes to
+   * the role which knows the connection. A new connection goes to the first
+   * role which accepts it.
+   */
+  void a2dp_packet_handler(bool isSink, uint8_t packet_type, uint16_t channel,
+                           uint8_t *packet, uint16_t size) {
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_A2DP_META) return;
+    uint16_t cid = little_endian_read_16(packet, 3);
+    A2DPCommon *p_role = nullptr;
+    for (int j = 0; j < role_count && p_role == nullptr; j++) {
+      if (roles[j]->isSink() == isSink && roles[j]->hasConnection(cid))
+        p_role = roles[j];
+    }
+    for (int j = 0; j < role_count && p_role == nullptr; j++) {
+      if (roles[j]->isSink() == isSink && roles[j]->acceptsConnection())
+        p_role = roles[j];
+    }
+    if (p_role == nullptr) {
+      LOGW("A2DPStack: no %s for a2dp_cid 0x%02x", isSink ? "sink" : "source",
+           cid);
+      // the last role gets the event, so that it can refuse the connection
+      for (int j = 0; j < role_count; j++) {
+        if (roles[j]->isSink() == isSink) p_role = roles[j];
+      }
+      if (p_role == nullptr) return;
+    }
+    p_role->a2dp_packet_handler(packet_type, channel, packet, size);
+  }
+
+  /// The media packets go to the sink which owns the stream endpoint
+  void media_packet_handler(uint8_t seid, uint8_t *packet, uint16_t size) {
+    for (int j = 0; j < role_count; j++) {
+      if (roles[j]->isSink() && roles[j]->hasSeid(seid)) {
+        roles[j]->handle_l2cap_media_data_packet(seid, packet, size);
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief A new AVRCP connection is assigned to the role which has an A2DP
+   * connection to the same device (or which accepts a new connection). The
+   * other AVRCP subevents start with the avrcp_cid.
+   */
+  A2DPCommon *avrcp_role(uint8_t *packet) {
+    if (packet[2] == AVRCP_SUBEVENT_CONNECTION_ESTABLISHED) {
+      bd_addr_t address;
+      avrcp_subevent_connection_established_get_bd_addr(packet, address);
+      uint16_t cid =
+          avrcp_subevent_connection_established_get_avrcp_cid(packet);
+      A2DPCommon *p_role = nullptr;
+      for (int j = 0; j < role_count && p_role == nullptr; j++) {
+        if (roles[j]->hasAddress(address)) p_role = roles[j];
+      }
+      for (int j = 0; j < role_count && p_role == nullptr; j++) {
+        if (roles[j]->acceptsConnection()) p_role = roles[j];
+      }
+      if (p_role == nullptr && role_count > 0) p_role = roles[0];
+      if (avrcp_subevent_connection_established_get_status(packet) ==
+          ERROR_CODE_SUCCESS) {
+        for (auto &route : avrcp_routes) {
+          if (route.avrcp_cid == 0) {
+            route.avrcp_cid = cid;
+            route.p_role = p_role;
+            break;
+          }
+        }
+      }
+      return p_role;
+    }
+
+    uint16_t cid = little_endian_read_16(packet, 3);
+    for (auto &route : avrcp_routes) {
+      if (route.avrcp_cid == cid && route.avrcp_cid != 0) {
+        A2DPCommon *p_role = route.p_role;
+        if (packet[2] == AVRCP_SUBEVENT_CONNECTION_RELEASED) route = {};
+        return p_role;
+      }
+    }
+    return role_count > 0 ? roles[0] : nullptr;
+  }
+
+  void avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
+                            uint8_t *packet, uint16_t size) {
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META) return;
+    A2DPCommon *p_role = avrcp_role(packet);
+    if (p_role != nullptr)
+      p_role->avrcp_packet_handler(packet_type, channel, packet, size);
+  }
+
+  void avrcp_controller_packet_handler(uint8_t packet_type, uint16_t channel,
+                                       uint8_t *packet, uint16_t size) {
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META) return;
+    A2DPCommon *p_role = avrcp_role(packet);
+    if (p_role != nullptr)
+      p_role->avrcp_controller_packet_handler(packet_type, channel, packet,
+                                              size);
+  }
+
+  void avrcp_target_packet_handler(uint8_t packet_type, uint16_t channel,
+                                   uint8_t *packet, uint16_t size) {
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_AVRCP_META) return;
+    A2DPCommon *p_role = avrcp_role(packet);
+    if (p_role != nullptr)
+      p_role->avrcp_target_packet_handler(packet_type, channel, packet, size);
+  }
+
+};
+
+/// Provides the single A2DPStackClass object: it is shared by all
+/// translation units, so the header can be included more than once
+inline A2DPStackClass &getA2DPStack() {
+  static A2DPStackClass stack;
+  return stack;
+}
+static A2DPStackClass &A2DPStack = getA2DPStack();
+
+// -- Implement Callback functions which forward calls to A2DPStack
+
+inline void stack_hci_packet_handler(uint8_t packet_type, uint16_t channel,
+                                     uint8_t *packet, uint16_t size) {
+  A2DPStack.hci_packet_handler(packet_type, channel, packet, size);
+}
+
+inline void stack_a2dp_sink_packet_handler(uint8_t packet_type,
+                                           uint16_t channel, uint8_t *packet,
+                                           uint16_t size) {
+  A2DPStack.a2dp_packet_handler(true, packet_type, channel, packet, size);
+}
+
+inline void stack_a2dp_source_packet_handler(uint8_t packet_type,
+                                             uint16_t channel, uint8_t *packet,
+                                             uint16_t size) {
+  A2DPStack.a2dp_packet_handler(false, packet_type, channel, packet, size);
+}
+
+inline void stack_media_packet_handler(uint8_t seid, uint8_t *packet,
+                                       uint16_t size) {
+  A2DPStack.media_packet_handler(seid, packet, size);
+}
+
+inline void stack_avrcp_packet_handler(uint8_t packet_type, uint16_t channel,
+                                       uint8_t *packet, uint16_t size) {
+  A2DPStack.avrcp_packet_handler(packet_type, channel, packet, size);
+}
+
+inline void stack_avrcp_controller_packet_handler(uint8_t packet_type,
+                                                  uint16_t channel,
+                                                  uint8_t *packet,
+                                                  uint16_t size) {
+  A2DPStack.avrcp_controller_packet_handler(packet_type, channel, packet,
+                                            size);
+}
+
+inline void stack_avrcp_target_packet_handler(uint8_t packet_type,
+                                              uint16_t channel,
+                                              uint8_t *packet, uint16_t size) {
+  A2DPStack.avrcp_target_packet_handler(packet_type, channel, packet, size);
+}
+
+}  // namespace btstack_a2dp
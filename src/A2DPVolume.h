@@ -0,0 +1,191 @@
+/**
+ * @file A2DPVolume.h
+ * @author Phil Schatzmann
+ * @brief Fixed point volume control
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <atomic>
+
+#include "A2DPConfig.h"
+#include "AudioTools.h"
+#if defined(__ARM_FEATURE_DSP)
+#  include <arm_acle.h>
+#endif
+
+namespace btstack_a2dp {
+
+/**
+ * @brief Volume control with a Q15 gain, so that no floating point
+ * operations are needed. The AVRCP absolute volume (0 - 127) is mapped with a
+ * table to a gain from -60 dB to 0 dB. Gain changes are ramped over
+ * VOLUME_RAMP_FRAMES frames to avoid clicks. On processors with the DSP
+ * extension two 16 bit samples are processed with each instruction.
+ *
+ * The volume can be changed from another core or thread than the one which
+ * processes the samples: the new gain is handed over with a single atomic
+ * value and the ramp is only updated by the processing side.
+ * @author Phil Schatzmann
+ */
+class A2DPVolume {
+ public:
+  static const int32_t Q15_ONE = 32768;
+
+  /// Call while no samples are processed
+  void begin(int channels) {
+    this->channels = channels;
+    applied_request = requested_gain.load();
+    target_gain = applied_request & GAIN_MASK;
+    current_gain = target_gain;
+    ramp_start_gain = target_gain;
+    ramp_frames = 0;
+  }
+
+  /// Defines the volume as AVRCP absolute volume (0 - 127)
+  void setVolume(int avrcpVolume) {
+    if (avrcpVolume < 0) avrcpVolume = 0;
+    if (avrcpVolume > 127) avrcpVolume = 127;
+    setGain(volume_table[avrcpVolume]);
+  }
+
+  /// Defines the gain in Q15 (32768 = 1.0): the change is ramped unless
+  /// isRamp is false. It is taken over by the next processing call.
+  void setGain(int32_t gainQ15, bool isRamp = true) {
+    if (gainQ15 > Q15_ONE) gainQ15 = Q15_ONE;
+    if (gainQ15 < 0) gainQ15 = 0;
+    requested_gain.store(isRamp ? gainQ15 : gainQ15 | NO_RAMP);
+  }
+
+  /// Requested gain in Q15
+  int32_t gain() { return requested_gain.load() & GAIN_MASK; }
+
+  /// The samples do not need to be changed
+  bool isUnity() {
+    take_request();
+    return ramp_frames == 0 && current_gain == Q15_ONE;
+  }
+
+  /// Provides the gain for the next frame (a sample of each channel)
+  int32_t nextGain() {
+    take_request();
+    if (ramp_frames > 0) {
+      ramp_frames--;
+      current_gain = target_gain + (ramp_start_gain - target_gain) *
+                                       ramp_frames / VOLUME_RAMP_FRAMES;
+    }
+    return current_gain;
+  }
+
+  /// Advances the ramp by the indicated number of frames without processing
+  /// any samples and provides the resulting gain
+  int32_t advance(int frames) {
+    take_request();
+    if (frames >= ramp_frames) {
+      ramp_frames = 0;
+      current_gain = target_gain;
+    } else {
+      ramp_frames -= frames;
+      current_gain = target_gain + (ramp_start_gain - target_gain) *
+                                       ramp_frames / VOLUME_RAMP_FRAMES;
+    }
+    return current_gain;
+  }
+
+  /// Scales a single sample
+  static int16_t scale(int32_t sample, int32_t gainQ15) {
+    return (sample * gainQ15) >> 15;
+  }
+
+  /// Applies the gain to the interleaved samples
+  void process(int16_t *samples, int sampleCount) {
+    take_request();
+    int frames = sampleCount / channels;
+    int pos = 0;
+    // ramp the gain frame by frame
+    while (ramp_frames > 0 && pos < frames) {
+      int32_t gain = nextGain();
+      for (int ch = 0; ch < channels; ch++) {
+        samples[pos * channels + ch] =
+            scale(samples[pos * channels + ch], gain);
+      }
+      pos++;
+    }
+    if (pos == frames || current_gain == Q15_ONE) return;
+    process_constant(samples + pos * channels, (frames - pos) * channels,
+                     current_gain);
+  }
+
+ protected:
+  // the gain is below 0x10000: the flag requests a change without ramp
+  static const int32_t GAIN_MASK = 0xFFFF;
+  static const int32_t NO_RAMP = 0x10000;
+  int channels = NUM_CHANNELS;
+  // written by setGain(), read by the processing side
+  std::atomic<int32_t> requested_gain{Q15_ONE};
+  // only used by the processing side
+  int32_t applied_request = Q15_ONE;
+  int32_t target_gain = Q15_ONE;
+  int32_t current_gain = Q15_ONE;
+  int32_t ramp_start_gain = Q15_ONE;
+  int ramp_frames = 0;
+
+  /// AVRCP absolute volume to Q15 gain: 0 is muted, 1 - 127 are linear in dB
+  /// from -60 dB to 0 dB
+  static constexpr uint16_t volume_table[128] = {
+      0, 33, 35, 37, 39, 41, 43, 46, 48, 51,
+      54, 57, 60, 63, 67, 71, 75, 79, 83, 88,
+      93, 98, 104, 109, 116, 122, 129, 136, 144, 152,
+      161, 170, 179, 189, 200, 211, 223, 236, 249, 263,
+      278, 294, 310, 328, 346, 366, 386, 408, 431, 455,
+      481, 508, 537, 567, 599, 633, 668, 706, 746, 788,
+      832, 879, 929, 981, 1036, 1095, 1156, 1221, 1290, 1363,
+      1440, 1521, 1607, 1697, 1793, 1894, 2001, 2113, 2232, 2358,
+      2491, 2632, 2780, 2937, 3102, 3277, 3461, 3657, 3863, 4080,
+      4310, 4553, 4810, 5081, 5367, 5670, 5989, 6327, 6683, 7060,
+      7457, 7878, 8322, 8791, 9286, 9809, 10362, 10946, 11563, 12215,
+      12903, 13630, 14398, 15210, 16067, 16972, 17929, 18939, 20006, 21134,
+      22325, 23583, 24912, 26316, 27799, 29365, 31020, 32768,
+  };
+
+  /// Starts the ramp to a gain that was requested by setGain()
+  void take_request() {
+    int32_t request = requested_gain.load(std::memory_order_relaxed);
+    if (request == applied_request) return;
+    applied_request = request;
+    ramp_start_gain = current_gain;
+    target_gain = request & GAIN_MASK;
+    if (request & NO_RAMP) {
+      current_gain = target_gain;
+      ramp_frames = 0;
+    } else {
+      ramp_frames = VOLUME_RAMP_FRAMES;
+    }
+  }
+
+  void process_constant(int16_t *samples, int sampleCount, int32_t gainQ15) {
+    int pos = 0;
+#if defined(__ARM_FEATURE_DSP)
+    // two samples per 32 bit word: the gain is < 1.0 so it fits into 16 bits
+    if (((uintptr_t)samples & 3) == 0) {
+      uint32_t *pairs = (uint32_t *)samples;
+      int pair_count = sampleCount / 2;
+      for (int j = 0; j < pair_count; j++) {
+        uint32_t pair = pairs[j];
+        int32_t low = __smulbb(pair, gainQ15) >> 15;
+        int32_t high = __smultb(pair, gainQ15) >> 15;
+        pairs[j] = (low & 0xFFFF) | ((uint32_t)high << 16);
+      }
+      pos = pair_count * 2;
+    }
+#endif
+    for (; pos < sampleCount; pos++) {
+      samples[pos] = scale(samples[pos], gainQ15);
+    }
+  }
+};
+
+}  // namespace btstack_a2dp
@@ -21,18 +21,22 @@
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 4
 #define HCI_ACL_PAYLOAD_SIZE (1691 + 4)
 #define HCI_ACL_CHUNK_SIZE_ALIGNMENT 4
-#define MAX_NR_AVDTP_CONNECTIONS 1
-#define MAX_NR_AVDTP_STREAM_ENDPOINTS 1
-#define MAX_NR_AVRCP_CONNECTIONS 2
+// shared by the sink and the source (there is no malloc): 2 phones and 1
+// speaker with up to 2 codecs per phone
+#define MAX_NR_AVDTP_CONNECTIONS 3
+#define MAX_NR_AVDTP_STREAM_ENDPOINTS 6
+#define MAX_NR_AVRCP_CONNECTIONS 3
 #define MAX_NR_BNEP_CHANNELS 1
 #define MAX_NR_BNEP_SERVICES 1
-#define MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES  2
+// paired devices: SINK_MAX_LINKS phones + SOURCE_MAX_KNOWN_SINKS speakers
+#define MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES  6
 #define MAX_NR_GATT_CLIENTS 1
-#define MAX_NR_HCI_CONNECTIONS 2
+#define MAX_NR_HCI_CONNECTIONS 3
 #define MAX_NR_HID_HOST_CONNECTIONS 1
 #define MAX_NR_HIDS_CLIENTS 1
 #define MAX_NR_HFP_CONNECTIONS 1
-#define MAX_NR_L2CAP_CHANNELS  4
+// AVDTP signaling and media, AVRCP and browsing for each connection
+#define MAX_NR_L2CAP_CHANNELS  12
 #define MAX_NR_L2CAP_SERVICES  3
 #define MAX_NR_RFCOMM_CHANNELS 1
 #define MAX_NR_RFCOMM_MULTIPLEXERS 1